@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# TazWeb assets - Compile the files served by the tazweb: scheme into a
+# C header, so internal pages never read from the disk.
+#
+# Usage: lib/assets.sh file... > src/assets.h
+#
+# Copyright (C) 2017 SliTaz GNU/Linux - BSD License
+# See AUTHORS and LICENSE for detailed information
+#
+
+echo "/* Generated by lib/assets.sh, do not edit */"
+echo
+
+# One string per file: escape backslashes and quotes, keep the newlines
+for file in "$@"; do
+	name="$(basename $file | sed 's/[^a-zA-Z0-9]/_/g')"
+	echo "static const gchar asset_$name[] ="
+	sed -e 's/\\/\\\\/g' -e 's/"/\\"/g' -e 's/^/\t"/' -e 's/$/\\n"/' "$file"
+	echo "	;"
+	echo
+done
+
+echo "static const struct asset assets[] = {"
+for file in "$@"; do
+	base="$(basename $file)"
+	name="$(echo $base | sed 's/[^a-zA-Z0-9]/_/g')"
+	case "$base" in
+		*.css) mime="text/css" ;;
+		*.html) mime="text/html" ;;
+		*.js) mime="application/javascript" ;;
+		*) mime="text/plain" ;;
+	esac
+	echo "	{ \"$base\", \"$mime\", asset_$name, sizeof(asset_$name) - 1 },"
+done
+echo "	{ NULL, NULL, NULL, 0 }"
+echo "};"
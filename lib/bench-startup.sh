@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# TazWeb startup benchmark - Cold start each browser on the local corpus
+# in data/bench and report percentiles of the traced startup phases.
+#
+# Usage: lib/bench-startup.sh [runs]
+#
+# Set COLD=yes as root to also drop the page cache before each start.
+# The raw trace is kept in $BENCH_TRACE when it is set.
+#
+# Copyright (C) 2017 SliTaz GNU/Linux - BSD License
+# See AUTHORS and LICENSE for detailed information
+#
+
+runs="${1:-20}"
+corpus="file://$(pwd)/data/bench/index.html"
+tmp="$(mktemp -d /tmp/tazweb-bench.XXXXXX)"
+trace="${BENCH_TRACE:-$tmp/trace.json}"
+
+# Run under Xvfb when there is no display
+if [ -z "$DISPLAY" ]; then
+	if ! which Xvfb >/dev/null 2>&1; then
+		echo "No DISPLAY and no Xvfb to run the browsers" >&2
+		exit 1
+	fi
+	Xvfb :99 -screen 0 1024x768x24 >/dev/null 2>&1 &
+	xvfb=$!
+	export DISPLAY=:99
+	sleep 1
+fi
+
+# Start a browser: bench program [options]
+bench() {
+	prog="$1"; shift
+	if [ ! -x "$prog" ]; then
+		echo "Skipping $prog: not built"
+		return
+	fi
+	echo "Running $runs cold starts of $prog..."
+	for i in $(seq $runs); do
+		# Fresh profile: first-run setup is part of the startup
+		rm -rf $tmp/home && mkdir -p $tmp/home
+		if [ "$COLD" = "yes" ] && [ "$(id -u)" = "0" ]; then
+			sync && echo 3 > /proc/sys/vm/drop_caches
+		fi
+		HOME=$tmp/home TAZWEB_TRACE="$trace" TAZWEB_TRACE_QUIT=1 \
+			timeout 60 "$prog" "$@" "$corpus" >/dev/null 2>&1
+	done
+}
+
+bench ./tazweb --newinstance --nosession
+bench ./tazweb-ng --newinstance --nosession
+bench ./src/tazweb-qt
+
+# Percentiles per program and phase, phases in startup order
+echo
+printf "%-10s %-16s %5s %9s %9s %9s %9s\n" \
+	"program" "phase" "runs" "p50 ms" "p90 ms" "p99 ms" "max ms"
+sed -n 's/.*"prog":"\([^"]*\)","phase":"\([^"]*\)","us":\([0-9]*\).*/\1 \2 \3/p' \
+	"$trace" 2>/dev/null | sort -k1,1 -k2,2 -k3,3n | awk '
+function report() {
+	if (n)
+		printf "%-10s %-16s %5d %9.1f %9.1f %9.1f %9.1f\n", prog, phase, n,
+			v[int((n - 1) * 0.5) + 1] / 1000, v[int((n - 1) * 0.9) + 1] / 1000,
+			v[int((n - 1) * 0.99) + 1] / 1000, v[n] / 1000
+}
+{
+	if ($1 != prog || $2 != phase) {
+		report()
+		prog = $1; phase = $2; n = 0
+	}
+	v[++n] = $3
+}
+END { report() }' | sort -k1,1 -k4,4n
+
+[ -n "$xvfb" ] && kill $xvfb
+rm -rf $tmp
+exit 0
@@ -1,6 +1,6 @@
 #!/bin/sh
 #
-# TazWeb Helper - Handle bookmarks and cookies
+# TazWeb Helper - Handle bookmarks
 #
 # Coding: No libtaz.sh and so it is usable on any Linux distro
 #
@@ -11,8 +11,6 @@
 config="$HOME/.config/tazweb"
 bm_txt="$config/bookmarks.txt"
 bm_html="$config/bookmarks.html"
-cookies_txt="$config/cookies.txt"
-cookies_html="$config/cookies.html"
 
 export TEXTDOMAIN='tazweb'
 
@@ -109,26 +107,6 @@ bookmarks_handler() {
 	fi
 }
 
-# Generate cookies.html (for direct view of cookies in TazWeb)
-html_cookies() {
-	{
-		html_header "$(gettext 'Cookies')"
-		echo '<pre style="overflow: auto;">'
-
-		while read line; do
-			echo "${line#\#HttpOnly_}"
-		done < ${cookies_txt}
-
-		echo '</pre>'
-		num=$(wc -l < $cookies_txt)
-		html_footer "$(printf "$(ngettext "%d cookie" "%d cookies" "$num")" "$num") - $(date)"
-	} > ${cookies_html}
-}
-
-clean_cookies() {
-	rm ${cookies_txt}; touch ${cookies_txt}
-}
-
 #
 # Execute any shell_function
 #
@@ -0,0 +1,267 @@
+/*
+ * Back/forward cache of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Back/forward cache
+ *
+ * WebKit keeps the pages left recently suspended in its page cache, which
+ * is on unless the config turns it off. On top of it, each webview keeps
+ * a snapshot and the scroll position of the last pages it left, up to
+ * bfcache_entries entries and bfcache_size MB of snapshots. Going back or
+ * forward to one of them shows its snapshot at once in place of the
+ * webview, the page is restored behind it and scrolled back where it was.
+ *
+ */
+
+#define BFCACHE_ENTRIES		8
+#define BFCACHE_SIZE		16
+#define BFCACHE_TIMEOUT		3
+
+struct bfcache_entry {
+	gchar			*uri;
+	GdkPixbuf		*snapshot;
+	gsize			bytes;
+	gdouble			x;
+	gdouble			y;
+};
+
+/* Per webview, most recent entry first */
+struct bfcache {
+	WebKitWebView	*webview;
+	GQueue			entries;
+	gsize			bytes;
+	GtkWidget		*image;
+	struct bfcache_entry *restore;
+	gchar			*stored;
+	guint			timeout_id;
+};
+
+gint					bfcache_entries	= BFCACHE_ENTRIES;
+gint					bfcache_size	= BFCACHE_SIZE;
+
+static void
+bfcache_entry_free(struct bfcache_entry *e)
+{
+	if (e->snapshot)
+		g_object_unref(e->snapshot);
+	g_free(e->uri);
+	g_free(e);
+}
+
+static void
+bfcache_free(struct bfcache *bc)
+{
+	if (bc->timeout_id)
+		g_source_remove(bc->timeout_id);
+	if (bc->restore)
+		bfcache_entry_free(bc->restore);
+	g_free(bc->stored);
+	if (bc->image) {
+		g_object_remove_weak_pointer(G_OBJECT(bc->image),
+			(gpointer *)&bc->image);
+		gtk_widget_destroy(bc->image);
+	}
+	g_queue_foreach(&bc->entries, (GFunc)bfcache_entry_free, NULL);
+	g_queue_clear(&bc->entries);
+	g_free(bc);
+}
+
+/* Entry of an uri, out of the cache */
+static struct bfcache_entry*
+bfcache_take(struct bfcache *bc, const gchar *uri)
+{
+	struct bfcache_entry *e;
+	GList *l;
+
+	for (l = bc->entries.head; l; l = l->next) {
+		e = l->data;
+		if (! strcmp(e->uri, uri)) {
+			g_queue_delete_link(&bc->entries, l);
+			bc->bytes -= e->bytes;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/* Visible part and scroll position of the page being left */
+static void
+bfcache_store(struct bfcache *bc)
+{
+	struct bfcache_entry *e;
+	GtkWidget *scrolled;
+	GtkAllocation a;
+	const gchar *uri;
+
+	scrolled = gtk_widget_get_parent(GTK_WIDGET(bc->webview));
+	if (bfcache_entries <= 0 || ! GTK_IS_SCROLLED_WINDOW(scrolled)
+			|| ! (uri = webkit_web_view_get_uri(bc->webview)))
+		return;
+	if ((e = bfcache_take(bc, uri)))
+		bfcache_entry_free(e);
+
+	e = g_new0(struct bfcache_entry, 1);
+	e->uri = g_strdup(uri);
+	e->x = gtk_adjustment_get_value(gtk_scrolled_window_get_hadjustment(
+		GTK_SCROLLED_WINDOW(scrolled)));
+	e->y = gtk_adjustment_get_value(gtk_scrolled_window_get_vadjustment(
+		GTK_SCROLLED_WINDOW(scrolled)));
+	if (gtk_widget_is_drawable(scrolled)) {
+		gtk_widget_get_allocation(scrolled, &a);
+		e->snapshot = gdk_pixbuf_get_from_drawable(NULL,
+			gtk_widget_get_window(scrolled), NULL, a.x, a.y, 0, 0,
+			a.width, a.height);
+	}
+	if (e->snapshot)
+		e->bytes = gdk_pixbuf_get_rowstride(e->snapshot)
+			* gdk_pixbuf_get_height(e->snapshot);
+	g_queue_push_head(&bc->entries, e);
+	bc->bytes += e->bytes;
+
+	while (g_queue_get_length(&bc->entries) > (guint)bfcache_entries
+			|| bc->bytes > (gsize)bfcache_size * 1024 * 1024) {
+		e = g_queue_pop_tail(&bc->entries);
+		bc->bytes -= e->bytes;
+		bfcache_entry_free(e);
+	}
+}
+
+/* The page is back: scroll it and drop the snapshot */
+static void
+bfcache_reveal(struct bfcache *bc)
+{
+	GtkWidget *scrolled;
+
+	if (bc->timeout_id)
+		g_source_remove(bc->timeout_id);
+	bc->timeout_id = 0;
+
+	scrolled = gtk_widget_get_parent(GTK_WIDGET(bc->webview));
+	if (bc->restore && GTK_IS_SCROLLED_WINDOW(scrolled)) {
+		gtk_adjustment_set_value(gtk_scrolled_window_get_hadjustment(
+			GTK_SCROLLED_WINDOW(scrolled)), bc->restore->x);
+		gtk_adjustment_set_value(gtk_scrolled_window_get_vadjustment(
+			GTK_SCROLLED_WINDOW(scrolled)), bc->restore->y);
+	}
+	if (bc->image) {
+		gtk_widget_hide(bc->image);
+		gtk_image_clear(GTK_IMAGE(bc->image));
+		gtk_widget_show(scrolled);
+	}
+	if (bc->restore)
+		bfcache_entry_free(bc->restore);
+	bc->restore = NULL;
+}
+
+static gboolean
+bfcache_timeout_cb(gpointer data)
+{
+	struct bfcache *bc = data;
+
+	bc->timeout_id = 0;
+	bfcache_reveal(bc);
+	return FALSE;
+}
+
+/* Snapshot in place of the scrolled window */
+static void
+bfcache_show(struct bfcache *bc)
+{
+	GtkWidget *scrolled, *box;
+	gint position;
+
+	scrolled = gtk_widget_get_parent(GTK_WIDGET(bc->webview));
+	box = scrolled ? gtk_widget_get_parent(scrolled) : NULL;
+	if (! bc->restore->snapshot || ! box || ! GTK_IS_BOX(box))
+		return;
+
+	if (! bc->image) {
+		bc->image = gtk_image_new();
+		g_object_add_weak_pointer(G_OBJECT(bc->image), (gpointer *)&bc->image);
+		gtk_box_pack_start(GTK_BOX(box), bc->image, TRUE, TRUE, 0);
+		gtk_container_child_get(GTK_CONTAINER(box), scrolled,
+			"position", &position, NULL);
+		gtk_box_reorder_child(GTK_BOX(box), bc->image, position + 1);
+	}
+	gtk_image_set_from_pixbuf(GTK_IMAGE(bc->image), bc->restore->snapshot);
+	gtk_widget_show(bc->image);
+	gtk_widget_hide(scrolled);
+}
+
+static void
+bfcache_status_cb(WebKitWebView *webview, GParamSpec *pspec,
+		struct bfcache *bc)
+{
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_PROVISIONAL:
+			/* Back and forward store the page before showing a snapshot,
+			 * the page left now if they did not load anything */
+			if (g_strcmp0(bc->stored, webkit_web_view_get_uri(webview)))
+				bfcache_store(bc);
+			g_free(bc->stored);
+			bc->stored = NULL;
+			break;
+
+		case WEBKIT_LOAD_FINISHED:
+		case WEBKIT_LOAD_FAILED:
+			if (bc->restore)
+				bfcache_reveal(bc);
+			break;
+
+		default:
+			break;
+	}
+}
+
+void
+bfcache_attach(WebKitWebView *webview)
+{
+	struct bfcache *bc;
+
+	bc = g_new0(struct bfcache, 1);
+	bc->webview = webview;
+	g_object_set_data_full(G_OBJECT(webview), "bfcache", bc,
+		(GDestroyNotify)bfcache_free);
+	g_signal_connect(webview, "notify::load-status",
+		G_CALLBACK(bfcache_status_cb), bc);
+}
+
+/* Back (-1) or forward (1), through the snapshot when there is one */
+void
+bfcache_go(WebKitWebView *webview, gint step)
+{
+	WebKitWebBackForwardList *list;
+	WebKitWebHistoryItem *item;
+	struct bfcache *bc;
+
+	bc = g_object_get_data(G_OBJECT(webview), "bfcache");
+	list = webkit_web_view_get_back_forward_list(webview);
+	item = step < 0 ? webkit_web_back_forward_list_get_back_item(list)
+		: webkit_web_back_forward_list_get_forward_item(list);
+
+	if (bc && item && ! bc->restore) {
+		bfcache_store(bc);
+		g_free(bc->stored);
+		bc->stored = g_strdup(webkit_web_view_get_uri(webview));
+		if ((bc->restore = bfcache_take(bc,
+				webkit_web_history_item_get_uri(item)))) {
+			bfcache_show(bc);
+			bc->timeout_id = g_timeout_add_seconds(BFCACHE_TIMEOUT,
+				bfcache_timeout_cb, bc);
+		}
+	}
+
+	if (step < 0)
+		webkit_web_view_go_back(webview);
+	else
+		webkit_web_view_go_forward(webview);
+}
+
@@ -0,0 +1,270 @@
+/*
+ * Bookmarks store of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Bookmarks store
+ *
+ * bookmarks.txt is used as an append-only journal of title|url lines,
+ * loaded once and indexed in memory by URL. The journal is compacted
+ * when it holds too many duplicate or empty lines. Processes append to
+ * it under a shared flock() on bookmarks.lock, a compaction holds it
+ * exclusive and reads the journal again before it rewrites it.
+ *
+ */
+
+#define BOOKMARKS_LOCK		g_strdup_printf("%s/bookmarks.lock", CONFIG)
+#define BOOKMARKS_STALE		64
+
+GPtrArray				*bookmarks;
+static GHashTable		*bookmarks_index;
+static time_t			bookmarks_mtime;
+static off_t			bookmarks_size;
+static guint			bookmarks_stale;
+static guint			bookmarks_compact_id;
+
+static int
+bookmarks_lock(int operation)
+{
+	gchar *file;
+	int fd;
+
+	file = BOOKMARKS_LOCK;
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd >= 0)
+		flock(fd, operation);
+	g_free(file);
+	return fd;
+}
+
+static void
+bookmark_free(struct bookmark *bm)
+{
+	g_free(bm->title);
+	g_free(bm->url);
+	g_free(bm);
+}
+
+/* Index a bookmark, return FALSE if the URL is already known */
+static gboolean
+bookmarks_insert(const gchar *title, const gchar *url)
+{
+	struct bookmark *bm;
+
+	completion_add(url, title, 0, 0, TRUE);
+	if ((bm = g_hash_table_lookup(bookmarks_index, url))) {
+		g_free(bm->title);
+		bm->title = g_strdup(title);
+		return FALSE;
+	}
+	bm = g_new0(struct bookmark, 1);
+	bm->title = g_strdup(title);
+	bm->url = g_strdup(url);
+	g_ptr_array_add(bookmarks, bm);
+	g_hash_table_insert(bookmarks_index, bm->url, bm);
+	return TRUE;
+}
+
+/* (Re)load the journal, only if it was changed behind our back */
+void
+bookmarks_load(void)
+{
+	struct stat st;
+	gchar *file, *data, *line, *next, *url, *end;
+
+	file = BOOKMARKS;
+	if (g_stat(file, &st) < 0)
+		st.st_mtime = st.st_size = 0;
+	if (bookmarks && st.st_mtime == bookmarks_mtime
+			&& st.st_size == bookmarks_size) {
+		g_free(file);
+		return;
+	}
+
+	if (bookmarks) {
+		g_hash_table_destroy(bookmarks_index);
+		g_ptr_array_free(bookmarks, TRUE);
+	}
+	bookmarks = g_ptr_array_new_with_free_func((GDestroyNotify)bookmark_free);
+	bookmarks_index = g_hash_table_new(g_str_hash, g_str_equal);
+	bookmarks_mtime = st.st_mtime;
+	bookmarks_size = st.st_size;
+	bookmarks_stale = 0;
+
+	if (g_file_get_contents(file, &data, NULL, NULL)) {
+		for (line = data; line && *line; line = next) {
+			if ((next = strchr(line, '\n')))
+				*next++ = '\0';
+			/* Same fields as: IFS="|" read title url null */
+			if (! (url = strchr(line, '|')) || ! url[1]) {
+				bookmarks_stale++;
+				continue;
+			}
+			*url++ = '\0';
+			if ((end = strchr(url, '|')))
+				*end = '\0';
+			if (! bookmarks_insert(line, url))
+				bookmarks_stale++;
+		}
+		g_free(data);
+	}
+	g_free(file);
+}
+
+/* Rewrite the journal without duplicates */
+static gboolean
+bookmarks_compact(gpointer data)
+{
+	struct bookmark *bm;
+	struct stat st;
+	GString *string;
+	gchar *file;
+	guint i;
+	int lock;
+
+	/* Lines appended by other processes since are kept */
+	bookmarks_compact_id = 0;
+	lock = bookmarks_lock(LOCK_EX);
+	bookmarks_size = -1;
+	bookmarks_load();
+
+	string = g_string_new(NULL);
+	for (i = 0; i < bookmarks->len; i++) {
+		bm = g_ptr_array_index(bookmarks, i);
+		g_string_append_printf(string, "%s|%s\n", bm->title, bm->url);
+	}
+
+	file = BOOKMARKS;
+	if (g_file_set_contents(file, string->str, string->len, NULL)) {
+		/* Security fix from old cgi-bin bookmarks.cgi */
+		g_chmod(file, 0600);
+		if (g_stat(file, &st) == 0) {
+			bookmarks_mtime = st.st_mtime;
+			bookmarks_size = st.st_size;
+		}
+		bookmarks_stale = 0;
+	}
+	if (lock >= 0)
+		close(lock);
+	g_string_free(string, TRUE);
+	g_free(file);
+	return FALSE;
+}
+
+static void
+bookmarks_check(void)
+{
+	if (bookmarks_stale > BOOKMARKS_STALE && ! bookmarks_compact_id)
+		bookmarks_compact_id = g_idle_add(bookmarks_compact, NULL);
+}
+
+/* Append a bookmark to the journal, duplicated URLs are skipped */
+void
+bookmarks_add(const gchar *title, const gchar *url)
+{
+	struct stat st;
+	gchar *file, *line, *name;
+	int fd, lock;
+
+	if (! url)
+		return;
+	lock = bookmarks_lock(LOCK_SH);
+	bookmarks_load();
+
+	/* Keep the journal format: no field separator in the title */
+	name = g_strdelimit(g_strdup(title ? title : url), "|\r\n", ' ');
+	if (! bookmarks_insert(name, url)) {
+		if (lock >= 0)
+			close(lock);
+		g_free(name);
+		return;
+	}
+
+	file = BOOKMARKS;
+	line = g_strdup_printf("%s|%s\n", name, url);
+	fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if (fd >= 0) {
+		if (write(fd, line, strlen(line)) < 0)
+			g_warning("Can't write: %s", file);
+		close(fd);
+		if (g_stat(file, &st) == 0) {
+			bookmarks_mtime = st.st_mtime;
+			bookmarks_size = st.st_size;
+		}
+	}
+	if (lock >= 0)
+		close(lock);
+	g_free(line);
+	g_free(name);
+	g_free(file);
+	bookmarks_check();
+}
+
+/* HTML 5 header like html_header in helper.sh, the style is compiled in */
+void
+html_header(GString *string, const gchar *title)
+{
+	g_string_append_printf(string, "<!DOCTYPE html>\n<html lang=\"en\">\n"
+		"<head>\n\t<meta charset=\"UTF-8\">\n\t<title>%s</title>\n"
+		"\t<link rel=\"stylesheet\" href=\"style.css\">\n"
+		"</head>\n<body>\n\t<header>\n\t\t<h1>%s</h1>\n\t</header>\n"
+		"\t<main>\n", title, title);
+}
+
+/* HTML 5 footer: counter and date */
+void
+html_footer(GString *string, const gchar *counter)
+{
+	GDateTime *now;
+	gchar *date;
+
+	now = g_date_time_new_now_local();
+	date = g_date_time_format(now, "%c");
+	g_string_append_printf(string, "\t</main>\n\t<footer>\n\t\t%s - %s\n"
+		"\t</footer>\n</body>\n</html>\n", counter, date);
+	g_free(date);
+	g_date_time_unref(now);
+}
+
+/* Render bookmarks.html in memory, same markup as helper.sh */
+gchar*
+bookmarks_html(void)
+{
+	struct bookmark *bm;
+	GString *string;
+	gchar *title, *url, *counter;
+	guint i;
+
+	bookmarks_load();
+	bookmarks_check();
+
+	string = g_string_new(NULL);
+	html_header(string, _("Bookmarks"));
+	g_string_append(string, "<ul id=\"bookmarks\">\n");
+
+	for (i = 0; i < bookmarks->len; i++) {
+		bm = g_ptr_array_index(bookmarks, i);
+		title = g_markup_escape_text(bm->title, -1);
+		url = g_markup_escape_text(bm->url, -1);
+		g_string_append_printf(string,
+			"<li><a href=\"%s\">%s</a></li>\n", url, title);
+		g_free(title);
+		g_free(url);
+	}
+	g_string_append(string, "</ul>\n");
+
+	counter = g_strdup_printf(ngettext("%d bookmark", "%d bookmarks",
+		bookmarks->len), bookmarks->len);
+	html_footer(string, counter);
+	g_free(counter);
+
+	return g_string_free(string, FALSE);
+}
+
@@ -0,0 +1,133 @@
+/*
+ * Disk cache of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * HTTP cache
+ *
+ * Responses are kept on disk by a SoupCache on the shared session, capped
+ * in size, the least used entries are evicted first. Its index is loaded
+ * at startup and saved on exit and every few minutes. A SoupCache belongs
+ * to one process: each process takes the first free of CACHE_SLOTS cache
+ * directories under a lock, further processes run without a disk cache.
+ * A process alone has the whole size, it is split evenly between the
+ * slots in use and checked again every CACHE_DUMP seconds, so the total
+ * stays in the cap. A slot is free again when its process exits.
+ *
+ */
+
+#define CACHE_SIZE		50
+#define CACHE_SLOTS		4
+#define CACHE_DUMP		300
+
+static SoupCache		*cache;
+gchar					*cache_path;
+static guint			cache_index;
+gint					cache_size		= CACHE_SIZE;
+
+/* Slots locked by this process and the others */
+static guint
+cache_users(void)
+{
+	gchar *dir, *file;
+	guint slot, n = 1;
+	int fd;
+
+	dir = CACHE_DIR;
+	for (slot = 0; slot < CACHE_SLOTS; slot++) {
+		if (slot == cache_index)
+			continue;
+		file = g_strdup_printf("%s/http-%u.lock", dir, slot);
+		fd = open(file, O_RDONLY | O_CLOEXEC);
+		g_free(file);
+		if (fd < 0)
+			continue;
+		if (flock(fd, LOCK_SH | LOCK_NB) < 0)
+			n++;
+		close(fd);
+	}
+	g_free(dir);
+	return n;
+}
+
+/* The share of the size for this process */
+static void
+cache_resize(void)
+{
+	soup_cache_set_max_size(cache,
+		(guint)((guint64)cache_size * 1024 * 1024 / cache_users()));
+}
+
+static gboolean
+cache_dump_cb(gpointer data)
+{
+	cache_resize();
+	soup_cache_dump(cache);
+	return TRUE;
+}
+
+/* The lock is held as long as the process lives */
+static gchar*
+cache_slot(const gchar *dir)
+{
+	gchar *file;
+	guint slot;
+	int fd;
+
+	for (slot = 0; slot < CACHE_SLOTS; slot++) {
+		file = g_strdup_printf("%s/http-%u.lock", dir, slot);
+		fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		g_free(file);
+		if (fd < 0)
+			continue;
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			cache_index = slot;
+			return g_strdup_printf("%s/http-%u", dir, slot);
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+void
+cache_setup(void)
+{
+	gchar *dir, *path;
+
+	if (cache_size <= 0)
+		return;
+
+	dir = CACHE_DIR;
+	if (g_mkdir_with_parents(dir, 0700) < 0 || ! (path = cache_slot(dir))) {
+		g_debug("No free cache slot, running without disk cache");
+		g_free(dir);
+		return;
+	}
+
+	cache_path = path;
+	cache = soup_cache_new(path, SOUP_CACHE_SINGLE_USER);
+	cache_resize();
+	soup_cache_load(cache);
+	soup_session_add_feature(session, SOUP_SESSION_FEATURE(cache));
+	g_timeout_add_seconds(CACHE_DUMP, cache_dump_cb, NULL);
+
+	g_free(dir);
+}
+
+/* Write pending entries and the index */
+void
+cache_save(void)
+{
+	if (! cache)
+		return;
+	soup_cache_flush(cache);
+	soup_cache_dump(cache);
+}
+
@@ -0,0 +1,530 @@
+/*
+ * URL completion of the TazWeb and TazWeb NG entries.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * URL completion
+ *
+ * Visited urls and bookmarks are indexed by lowercase keys: the url
+ * without scheme and www. and each word of the title. Urls, titles and
+ * keys are kept in one string pool and referred to by offset. Keys are
+ * searched by prefix in a sorted array, new keys go to a small unsorted
+ * delta which is merged into the sorted array once it is full. Matches
+ * are ranked by frecency and by the kind of match. A title key refers
+ * to the title it was cut from, it is ignored and dropped at the next
+ * merge once the title changed. A prefix shared by too many keys to be
+ * scanned, as one or two letters are, walks the entries by frecency
+ * instead until no match left can make it to the top.
+ *
+ */
+
+#define COMPLETION_MAX		8
+#define COMPLETION_SCAN		4096
+#define COMPLETION_DELTA	1024
+#define COMPLETION_WORD		3
+#define COMPLETION_URL		0x80000000
+#define COMPLETION_RANK		3600
+#define COMPLETION_SPLIT	" \t-_|:,.;/()[]\"'"
+
+struct completion_entry {
+	guint32			url;
+	guint32			title;
+	guint32			visits;
+	guint32			last;
+	guint32			query;
+	guint16			quality;
+	guint16			bookmark;
+};
+
+struct completion_key {
+	guint32			text;
+	guint32			entry;
+	guint32			title;
+};
+
+static GString			*completion_pool;
+static GArray			*completion_entries;
+static GHashTable		*completion_index;
+static GArray			*completion_keys;
+static GArray			*completion_delta;
+static GArray			*completion_ranked;
+static gint64			completion_ranked_at;
+static guint32			completion_query;
+static GtkListStore		*completion_store;
+
+#define completion_text(offset)	(completion_pool->str + (offset))
+#define completion_entry(i)	(&g_array_index(completion_entries, \
+	struct completion_entry, (i)))
+
+/* Index keys are pool offsets + 1 so 0 is never a key */
+static guint
+completion_url_hash(gconstpointer key)
+{
+	return g_str_hash(completion_text(GPOINTER_TO_UINT(key) - 1));
+}
+
+static gboolean
+completion_url_equal(gconstpointer a, gconstpointer b)
+{
+	return ! strcmp(completion_text(GPOINTER_TO_UINT(a) - 1),
+		completion_text(GPOINTER_TO_UINT(b) - 1));
+}
+
+static gint
+completion_key_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(completion_text(((struct completion_key *)a)->text),
+		completion_text(((struct completion_key *)b)->text));
+}
+
+static guint32
+completion_intern(const gchar *text)
+{
+	guint32 offset = completion_pool->len;
+
+	g_string_append_len(completion_pool, text, strlen(text) + 1);
+	return offset;
+}
+
+/* A title key of an entry which got another title since */
+static gboolean
+completion_stale(struct completion_key *k)
+{
+	return ! (k->entry & COMPLETION_URL)
+		&& completion_entry(k->entry)->title != k->title;
+}
+
+/* Sort the delta and merge it with the sorted keys in one pass */
+static void
+completion_merge(void)
+{
+	struct completion_key *a, *b;
+	GArray *keys;
+	guint i = 0, j = 0;
+
+	g_array_sort(completion_delta, completion_key_compare);
+	keys = g_array_sized_new(FALSE, FALSE, sizeof(struct completion_key),
+		completion_keys->len + completion_delta->len);
+	while (i < completion_keys->len || j < completion_delta->len) {
+		a = i < completion_keys->len ? &g_array_index(completion_keys,
+			struct completion_key, i) : NULL;
+		b = j < completion_delta->len ? &g_array_index(completion_delta,
+			struct completion_key, j) : NULL;
+		if (a && completion_stale(a)) {
+			i++;
+		} else if (b && completion_stale(b)) {
+			j++;
+		} else if (a && (! b || completion_key_compare(a, b) <= 0)) {
+			g_array_append_val(keys, *a);
+			i++;
+		} else {
+			g_array_append_val(keys, *b);
+			j++;
+		}
+	}
+	g_array_free(completion_keys, TRUE);
+	completion_keys = keys;
+	g_array_set_size(completion_delta, 0);
+}
+
+static void
+completion_add_key(const gchar *text, guint32 entry, guint32 title)
+{
+	struct completion_key key;
+	gchar *lower;
+
+	lower = g_utf8_strdown(text, -1);
+	key.text = completion_intern(lower);
+	key.entry = entry;
+	key.title = title;
+	g_array_append_val(completion_delta, key);
+	g_free(lower);
+
+	if (completion_delta->len >= COMPLETION_DELTA)
+		completion_merge();
+}
+
+/* Url as typed: no scheme and no www. */
+static const gchar*
+completion_strip(const gchar *url)
+{
+	const gchar *p;
+
+	if ((p = strstr(url, "://")))
+		url = p + 3;
+	if (! g_ascii_strncasecmp(url, "www.", 4))
+		url += 4;
+	return url;
+}
+
+/* Keys of the current title of an entry */
+static void
+completion_add_title(const gchar *title, guint32 entry)
+{
+	gchar **words;
+	guint32 offset;
+	guint i;
+
+	offset = completion_entry(entry)->title;
+	words = g_strsplit_set(title, COMPLETION_SPLIT, -1);
+	for (i = 0; words[i]; i++)
+		if (g_utf8_strlen(words[i], -1) >= COMPLETION_WORD)
+			completion_add_key(words[i], entry, offset);
+	g_strfreev(words);
+}
+
+/* Index an url or add visits to it */
+void
+completion_add(const gchar *url, const gchar *title, guint visits,
+		gint64 last, gboolean bookmark)
+{
+	struct completion_entry *e, new = { 0 };
+	gpointer value;
+	guint32 offset;
+
+	if (! url || g_ascii_strncasecmp(url, "http", 4))
+		return;
+	if (! completion_pool) {
+		completion_pool = g_string_sized_new(4096);
+		completion_entries = g_array_new(FALSE, FALSE,
+			sizeof(struct completion_entry));
+		completion_keys = g_array_new(FALSE, FALSE,
+			sizeof(struct completion_key));
+		completion_delta = g_array_new(FALSE, FALSE,
+			sizeof(struct completion_key));
+		completion_index = g_hash_table_new(completion_url_hash,
+			completion_url_equal);
+	}
+
+	/* The url is interned to look it up and dropped if already known */
+	offset = completion_intern(url);
+	if ((value = g_hash_table_lookup(completion_index,
+			GUINT_TO_POINTER(offset + 1)))) {
+		g_string_truncate(completion_pool, offset);
+		e = completion_entry(GPOINTER_TO_UINT(value) - 1);
+		if (title && *title && strcmp(completion_text(e->title), title)) {
+			e->title = completion_intern(title);
+			completion_add_title(title, GPOINTER_TO_UINT(value) - 1);
+		}
+	} else {
+		new.url = offset;
+		new.title = completion_intern(title ? title : "");
+		g_array_append_val(completion_entries, new);
+		value = GUINT_TO_POINTER(completion_entries->len);
+		g_hash_table_insert(completion_index, GUINT_TO_POINTER(offset + 1),
+			value);
+		completion_add_key(completion_strip(url),
+			(GPOINTER_TO_UINT(value) - 1) | COMPLETION_URL, 0);
+		if (title)
+			completion_add_title(title, GPOINTER_TO_UINT(value) - 1);
+		e = completion_entry(GPOINTER_TO_UINT(value) - 1);
+	}
+
+	e->visits += visits;
+	if (last / G_USEC_PER_SEC > e->last)
+		e->last = last / G_USEC_PER_SEC;
+	if (bookmark)
+		e->bookmark = TRUE;
+	completion_ranked_at = 0;
+}
+
+/* Visits weighted by age buckets, a bookmark is worth a few visits */
+static guint
+completion_frecency(struct completion_entry *e, gint64 now)
+{
+	gint64 days = (now - e->last) / (24 * 3600);
+	guint weight;
+
+	if (days < 4)
+		weight = 100;
+	else if (days < 14)
+		weight = 70;
+	else if (days < 31)
+		weight = 50;
+	else if (days < 90)
+		weight = 30;
+	else
+		weight = 10;
+	return (e->visits + (e->bookmark ? 5 : 0)) * weight + 1;
+}
+
+static void
+completion_consider(struct completion_key *k, const gchar *prefix,
+		GPtrArray *found)
+{
+	struct completion_entry *e;
+	guint quality;
+
+	if (completion_stale(k))
+		return;
+	e = completion_entry(k->entry & ~COMPLETION_URL);
+	quality = k->entry & COMPLETION_URL ? 2 : 1;
+	if (quality == 2 && ! strcmp(completion_text(k->text), prefix))
+		quality = 4;
+
+	if (e->query != completion_query) {
+		e->query = completion_query;
+		e->quality = quality;
+		g_ptr_array_add(found, e);
+	} else if (quality > e->quality) {
+		e->quality = quality;
+	}
+}
+
+/* Insert a match in the top if it scores well enough */
+static void
+completion_keep(struct completion_entry **top, guint *score, guint *n,
+		struct completion_entry *e, guint s)
+{
+	guint j;
+
+	if (*n == COMPLETION_MAX && s <= score[*n - 1])
+		return;
+	j = *n < COMPLETION_MAX ? (*n)++ : *n - 1;
+	for (; j > 0 && score[j - 1] < s; j--) {
+		score[j] = score[j - 1];
+		top[j] = top[j - 1];
+	}
+	score[j] = s;
+	top[j] = e;
+}
+
+static gint
+completion_rank_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	gint64 now = *(gint64 *)data;
+	guint fa, fb;
+
+	fa = completion_frecency(completion_entry(*(guint32 *)a), now);
+	fb = completion_frecency(completion_entry(*(guint32 *)b), now);
+	return fa < fb ? 1 : fa > fb ? -1 : 0;
+}
+
+/* Entries by frecency, sorted again after a change or once an hour */
+static void
+completion_rank(gint64 now)
+{
+	guint32 i;
+
+	if (completion_ranked && now - completion_ranked_at < COMPLETION_RANK)
+		return;
+	if (! completion_ranked)
+		completion_ranked = g_array_new(FALSE, FALSE, sizeof(guint32));
+	g_array_set_size(completion_ranked, 0);
+	for (i = 0; i < completion_entries->len; i++)
+		g_array_append_val(completion_ranked, i);
+	g_array_sort_with_data(completion_ranked, completion_rank_compare, &now);
+	completion_ranked_at = now;
+}
+
+/* A word of a lowercase title starting with the prefix */
+static gboolean
+completion_title_match(const gchar *title, const gchar *prefix, gsize len)
+{
+	gsize word;
+
+	while (*title) {
+		word = strcspn(title, COMPLETION_SPLIT);
+		if (word >= len && ! strncmp(title, prefix, len)
+				&& g_utf8_strlen(title, word) >= COMPLETION_WORD)
+			return TRUE;
+		title += word;
+		title += strspn(title, COMPLETION_SPLIT);
+	}
+	return FALSE;
+}
+
+/* Too many keys to scan: the best entries first, until no match left
+ * can make it to the top even as an exact url */
+static guint
+completion_walk(const gchar *prefix, gsize len, gint64 now,
+		struct completion_entry **top)
+{
+	struct completion_entry *e;
+	guint i, n = 0, score[COMPLETION_MAX], f, quality;
+	gchar *text;
+
+	completion_rank(now);
+	for (i = 0; i < completion_ranked->len; i++) {
+		e = completion_entry(g_array_index(completion_ranked, guint32, i));
+		f = completion_frecency(e, now);
+		if (n == COMPLETION_MAX && f * 4 <= score[n - 1])
+			break;
+
+		text = g_utf8_strdown(completion_strip(completion_text(e->url)), -1);
+		if (! strncmp(text, prefix, len))
+			quality = text[len] ? 2 : 4;
+		else
+			quality = 0;
+		g_free(text);
+		if (! quality) {
+			text = g_utf8_strdown(completion_text(e->title), -1);
+			quality = completion_title_match(text, prefix, len);
+			g_free(text);
+		}
+		if (quality)
+			completion_keep(top, score, &n, e, f * quality);
+	}
+	return n;
+}
+
+/* Best matches of a typed text, returns their number */
+static guint
+completion_lookup(const gchar *text, struct completion_entry **top)
+{
+	static GPtrArray *found;
+	struct completion_entry *e;
+	struct completion_key *k;
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	guint lo, hi, mid, i, n = 0, score[COMPLETION_MAX];
+	gchar *prefix;
+	gsize len;
+
+	if (! completion_pool)
+		return 0;
+	prefix = g_utf8_strdown(completion_strip(text), -1);
+	if (! (len = strlen(prefix))) {
+		g_free(prefix);
+		return 0;
+	}
+
+	if (! found)
+		found = g_ptr_array_new();
+	g_ptr_array_set_size(found, 0);
+	completion_query++;
+
+	/* First key with the prefix, then all keys with it */
+	lo = 0;
+	hi = completion_keys->len;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		k = &g_array_index(completion_keys, struct completion_key, mid);
+		if (strcmp(completion_text(k->text), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (i = lo; i < completion_keys->len && i - lo < COMPLETION_SCAN; i++) {
+		k = &g_array_index(completion_keys, struct completion_key, i);
+		if (strncmp(completion_text(k->text), prefix, len))
+			break;
+		completion_consider(k, prefix, found);
+	}
+	if (i - lo == COMPLETION_SCAN) {
+		n = completion_walk(prefix, len, now, top);
+		g_free(prefix);
+		return n;
+	}
+	for (i = 0; i < completion_delta->len; i++) {
+		k = &g_array_index(completion_delta, struct completion_key, i);
+		if (! strncmp(completion_text(k->text), prefix, len))
+			completion_consider(k, prefix, found);
+	}
+
+	/* Keep the best ones, best first */
+	for (i = 0; i < found->len; i++) {
+		e = g_ptr_array_index(found, i);
+		completion_keep(top, score, &n, e,
+			completion_frecency(e, now) * e->quality);
+	}
+	g_free(prefix);
+	return n;
+}
+
+/* Url of the best completion of a text, NULL if none */
+const gchar*
+completion_best(const gchar *text)
+{
+	struct completion_entry *top[COMPLETION_MAX];
+
+	if (! completion_lookup(text, top))
+		return NULL;
+	return completion_text(top[0]->url);
+}
+
+/* Matches are filtered by the index, not by GtkEntryCompletion */
+static gboolean
+completion_match_cb(GtkEntryCompletion *completion, const gchar *key,
+		GtkTreeIter *iter, gpointer data)
+{
+	return TRUE;
+}
+
+static void
+completion_changed_cb(GtkWidget *entry, gpointer data)
+{
+	struct completion_entry *top[COMPLETION_MAX];
+	guint i, n;
+
+	if (! gtk_widget_has_focus(entry))
+		return;
+
+	gtk_list_store_clear(completion_store);
+	n = completion_lookup(gtk_entry_get_text(GTK_ENTRY(entry)), top);
+	for (i = 0; i < n; i++)
+		gtk_list_store_insert_with_values(completion_store, NULL, -1,
+			0, completion_text(top[i]->url),
+			1, completion_text(top[i]->title), -1);
+}
+
+static gboolean
+completion_selected_cb(GtkEntryCompletion *completion, GtkTreeModel *model,
+		GtkTreeIter *iter, GtkWidget *entry)
+{
+	gchar *url;
+
+	gtk_tree_model_get(model, iter, 0, &url, -1);
+	gtk_entry_set_text(GTK_ENTRY(entry), url);
+	g_signal_emit_by_name(entry, "activate");
+	g_free(url);
+	return TRUE;
+}
+
+/* Url and title popup under an URL entry */
+void
+completion_attach(GtkWidget *entry)
+{
+	GtkEntryCompletion *completion;
+	GtkCellRenderer *cell;
+
+	if (! completion_store)
+		completion_store = gtk_list_store_new(2, G_TYPE_STRING,
+			G_TYPE_STRING);
+
+	/* Before the completion handler so it shows the new matches */
+	g_signal_connect(entry, "changed",
+		G_CALLBACK(completion_changed_cb), NULL);
+
+	completion = gtk_entry_completion_new();
+	gtk_entry_completion_set_model(completion,
+		GTK_TREE_MODEL(completion_store));
+	gtk_entry_completion_set_match_func(completion, completion_match_cb,
+		NULL, NULL);
+	gtk_entry_completion_set_text_column(completion, 0);
+	cell = gtk_cell_renderer_text_new();
+	g_object_set(cell, "foreground", "gray", "ellipsize",
+		PANGO_ELLIPSIZE_END, NULL);
+	gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(completion), cell, TRUE);
+	gtk_cell_layout_add_attribute(GTK_CELL_LAYOUT(completion), cell,
+		"text", 1);
+	g_signal_connect(completion, "match-selected",
+		G_CALLBACK(completion_selected_cb), entry);
+	gtk_entry_set_completion(GTK_ENTRY(entry), completion);
+	g_object_unref(completion);
+}
+
+/* Bookmarks are indexed as bookmarks_insert() sees them */
+gboolean
+completion_init_cb(gpointer data)
+{
+	bookmarks_load();
+	return FALSE;
+}
+
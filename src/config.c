@@ -0,0 +1,213 @@
+/*
+ * Configuration file of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Configuration
+ *
+ * ~/.config/tazweb/tazweb.conf is a key file read once at startup into a
+ * struct config. The [default] section is applied first, then the built-in
+ * profile and the section of the selected profile (--profile or the
+ * profile key of [default]). Options on the command line win. A value of
+ * -1 leaves the TazWeb or WebKit default.
+ *
+ *   [default]
+ *   profile = lowmem
+ *
+ *   [lowmem]
+ *   images = false
+ *   pool = 0
+ *
+ */
+
+#define CONFIG_FILE		g_strdup_printf("%s/tazweb.conf", CONFIG)
+
+static const struct {
+	const gchar		*name;
+	struct config	config;
+} config_profiles[] = {
+	/*                 model  page img  js plug conns host width height
+	 *                 pool cache bfcache MB kiosk bar menu download */
+	{ "lowmem",     { WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER, 0, 1, 1, 0, 6, 2,
+		640, 480, 0, 10, 2, 4, -1, -1, -1, -1 } },
+	{ "kiosk",      { WEBKIT_CACHE_MODEL_WEB_BROWSER, 1, 1, 1, 0, -1, -1,
+		-1, -1, 0, -1, 4, -1, 1, 0, 0, -1 } },
+	{ "throughput", { WEBKIT_CACHE_MODEL_WEB_BROWSER, 1, 1, 1, 1, 32, 8,
+		-1, -1, 2, 200, 16, 64, -1, -1, -1, -1 } },
+};
+
+static const struct {
+	const gchar		*key;
+	gsize			offset;
+	gboolean		boolean;
+} config_keys[] = {
+	{ "page-cache",			G_STRUCT_OFFSET(struct config, page_cache),	TRUE },
+	{ "images",				G_STRUCT_OFFSET(struct config, images),		TRUE },
+	{ "scripts",			G_STRUCT_OFFSET(struct config, scripts),	TRUE },
+	{ "plugins",			G_STRUCT_OFFSET(struct config, plugins),	TRUE },
+	{ "connections",		G_STRUCT_OFFSET(struct config, conns),		FALSE },
+	{ "connections-per-host", G_STRUCT_OFFSET(struct config, conns_host), FALSE },
+	{ "width",				G_STRUCT_OFFSET(struct config, width),		FALSE },
+	{ "height",				G_STRUCT_OFFSET(struct config, height),		FALSE },
+	{ "pool",				G_STRUCT_OFFSET(struct config, pool),		FALSE },
+	{ "cache",				G_STRUCT_OFFSET(struct config, cache),		FALSE },
+	{ "bfcache",			G_STRUCT_OFFSET(struct config, bfcache),	FALSE },
+	{ "bfcache-size",		G_STRUCT_OFFSET(struct config, bfcache_size), FALSE },
+	{ "kiosk",				G_STRUCT_OFFSET(struct config, kiosk),		TRUE },
+	{ "toolbar",			G_STRUCT_OFFSET(struct config, toolbar),	TRUE },
+	{ "menu",				G_STRUCT_OFFSET(struct config, menu),		TRUE },
+	{ "download-rate",		G_STRUCT_OFFSET(struct config, download_rate), FALSE },
+};
+
+struct config			config;
+gchar					*config_profile;
+/* A profile or option of this process only: no handoff */
+gboolean			config_option;
+
+static void
+config_merge(struct config *to, const struct config *from)
+{
+	const gint *src = (const gint *)from;
+	gint *dst = (gint *)to;
+	guint i;
+
+	for (i = 0; i < sizeof(struct config) / sizeof(gint); i++)
+		if (src[i] >= 0)
+			dst[i] = src[i];
+}
+
+/* A section of the file over the config */
+static void
+config_section(GKeyFile *file, const gchar *group)
+{
+	GError *error = NULL;
+	gchar *model;
+	gint value;
+	guint i;
+
+	if (! g_key_file_has_group(file, group))
+		return;
+	for (i = 0; i < G_N_ELEMENTS(config_keys); i++) {
+		if (config_keys[i].boolean)
+			value = g_key_file_get_boolean(file, group, config_keys[i].key,
+				&error);
+		else
+			value = g_key_file_get_integer(file, group, config_keys[i].key,
+				&error);
+		if (error)
+			g_clear_error(&error);
+		else
+			G_STRUCT_MEMBER(gint, &config, config_keys[i].offset) = value;
+	}
+
+	if ((model = g_key_file_get_string(file, group, "cache-model", NULL))) {
+		if (! strcmp(model, "viewer"))
+			config.cache_model = WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER;
+		else if (! strcmp(model, "document-browser"))
+			config.cache_model = WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER;
+		else if (! strcmp(model, "browser"))
+			config.cache_model = WEBKIT_CACHE_MODEL_WEB_BROWSER;
+		g_free(model);
+	}
+}
+
+/* --profile is looked up before the options are parsed, so they win.
+ * All the forms getopt takes: --profile name, --profile=name, -P name
+ * and -Pname */
+void
+config_load(int argc, char *argv[])
+{
+	GKeyFile *file;
+	const gchar *name;
+	gchar *path;
+	guint i;
+
+	memset(&config, -1, sizeof(config));
+	for (i = 1; i < (guint)argc && strcmp(argv[i], "--"); i++) {
+		name = NULL;
+		if ((! strcmp(argv[i], "--profile") || ! strcmp(argv[i], "-P"))
+				&& i + 1 < (guint)argc)
+			name = argv[++i];
+		else if (g_str_has_prefix(argv[i], "--profile="))
+			name = argv[i] + 10;
+		else if (g_str_has_prefix(argv[i], "-P"))
+			name = argv[i] + 2;
+		if (name) {
+			g_free(config_profile);
+			config_profile = g_strdup(name);
+		}
+	}
+	config_option = config_profile != NULL;
+
+	file = g_key_file_new();
+	path = CONFIG_FILE;
+	if (! g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL)) {
+		g_key_file_free(file);
+		file = NULL;
+	}
+	g_free(path);
+
+	if (file) {
+		config_section(file, "default");
+		if (! config_profile)
+			config_profile = g_key_file_get_string(file, "default",
+				"profile", NULL);
+	}
+	if (config_profile) {
+		for (i = 0; i < G_N_ELEMENTS(config_profiles); i++)
+			if (! strcmp(config_profiles[i].name, config_profile))
+				break;
+		if (i < G_N_ELEMENTS(config_profiles))
+			config_merge(&config, &config_profiles[i].config);
+		else if (! file || ! g_key_file_has_group(file, config_profile))
+			g_warning("Unknown profile: %s", config_profile);
+		if (file)
+			config_section(file, config_profile);
+	}
+	if (file)
+		g_key_file_free(file);
+}
+
+/* WebKit settings of a new webview */
+void
+config_settings(WebKitWebSettings *settings)
+{
+	/* The back/forward cache relies on the page cache */
+	g_object_set(G_OBJECT(settings), "enable-page-cache",
+		config.page_cache != 0, NULL);
+	if (config.images >= 0)
+		g_object_set(G_OBJECT(settings), "auto-load-images",
+			config.images, NULL);
+	if (config.scripts >= 0)
+		g_object_set(G_OBJECT(settings), "enable-scripts",
+			config.scripts, NULL);
+	if (config.plugins >= 0)
+		g_object_set(G_OBJECT(settings), "enable-plugins",
+			config.plugins, NULL);
+}
+
+/* Process wide settings, before the first webview */
+void
+config_webkit(void)
+{
+	if (config.cache_model >= 0)
+		webkit_set_cache_model(config.cache_model);
+}
+
+void
+config_session(SoupSession *session)
+{
+	if (config.conns > 0)
+		g_object_set(G_OBJECT(session), "max-conns", config.conns, NULL);
+	if (config.conns_host > 0)
+		g_object_set(G_OBJECT(session), "max-conns-per-host",
+			config.conns_host, NULL);
+}
+
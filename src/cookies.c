@@ -0,0 +1,412 @@
+/*
+ * Cookies journal of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Cookies
+ *
+ * The live jar is a plain SoupCookieJar. Persistent cookies are kept in
+ * cookies.log, a journal of "+" (set) and "-" (delete) lines indexed in
+ * memory by domain/path/name. Changes are coalesced and appended a few
+ * seconds later. All processes share the journal under a flock() on
+ * cookies.lock and replay each other's appended lines. The journal is
+ * compacted once it holds many more lines than the jar has persistent
+ * cookies, counted as the jar changes.
+ *
+ */
+
+#define COOKIES_LOG		g_strdup_printf("%s/cookies.log", CONFIG)
+#define COOKIES_LOCK	g_strdup_printf("%s/cookies.lock", CONFIG)
+#define COOKIES_FLUSH	3
+#define COOKIES_SYNC	30
+#define COOKIES_STALE	256
+
+static GHashTable		*cookies_pending;
+static off_t			cookies_offset;
+static ino_t			cookies_inode;
+static guint			cookies_lines;
+static guint			cookies_live;
+static gboolean		cookies_loading;
+static guint			cookies_flush_id;
+
+static gchar*
+cookie_key(SoupCookie *cookie)
+{
+	return g_strdup_printf("%s\t%s\t%s", cookie->domain, cookie->path,
+		cookie->name);
+}
+
+static int
+cookies_lock(int operation)
+{
+	gchar *file;
+	int fd;
+
+	file = COOKIES_LOCK;
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd >= 0)
+		flock(fd, operation);
+	g_free(file);
+	return fd;
+}
+
+static void
+cookies_unlock(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+/* Replay one journal line in the live jar */
+static void
+cookies_apply(gchar *line)
+{
+	SoupCookie *cookie;
+	SoupDate *date;
+	gchar **f, *key;
+	gboolean local;
+
+	if (! line[0])
+		return;
+	f = g_strsplit(line + 1, "\t", 7);
+	if (g_strv_length(f) < 3) {
+		g_strfreev(f);
+		return;
+	}
+
+	/* Our own change waiting for a flush wins */
+	key = g_strdup_printf("%s\t%s\t%s", f[0], f[1], f[2]);
+	local = g_hash_table_lookup(cookies_pending, key) != NULL;
+	g_free(key);
+
+	if (! local && line[0] == '+' && g_strv_length(f) == 7) {
+		cookie = soup_cookie_new(f[2], f[3], f[0], f[1], -1);
+		date = soup_date_new_from_time_t(g_ascii_strtoll(f[4], NULL, 10));
+		soup_cookie_set_expires(cookie, date);
+		soup_cookie_set_secure(cookie, f[5][0] == '1');
+		soup_cookie_set_http_only(cookie, f[6][0] == '1');
+		soup_cookie_jar_add_cookie(cookiejar, cookie);
+		soup_date_free(date);
+	} else if (! local && line[0] == '-') {
+		/* An expired cookie removes the one in the jar */
+		cookie = soup_cookie_new(f[2], "", f[0], f[1], 0);
+		soup_cookie_jar_add_cookie(cookiejar, cookie);
+	}
+	g_strfreev(f);
+}
+
+/* Read journal lines appended by any process since last time. Must be
+ * called with the lock held. */
+static void
+cookies_read(gboolean reset)
+{
+	SoupCookie *cookie;
+	struct stat st;
+	GSList *list, *l;
+	gchar *file, *data, *line, *next, *key;
+	gssize len;
+	int fd;
+
+	file = COOKIES_LOG;
+	fd = open(file, O_RDONLY);
+	g_free(file);
+	if (fd < 0)
+		return;
+
+	fstat(fd, &st);
+	cookies_loading = TRUE;
+
+	/* Compacted or cleaned by another process: start over */
+	if (reset || st.st_ino != cookies_inode || st.st_size < cookies_offset) {
+		list = soup_cookie_jar_all_cookies(cookiejar);
+		for (l = list; l; l = l->next) {
+			cookie = l->data;
+			key = cookie_key(cookie);
+			if (cookie->expires && ! g_hash_table_lookup(cookies_pending, key))
+				soup_cookie_jar_delete_cookie(cookiejar, cookie);
+			soup_cookie_free(cookie);
+			g_free(key);
+		}
+		g_slist_free(list);
+		cookies_inode = st.st_ino;
+		cookies_offset = 0;
+		cookies_lines = 0;
+	}
+
+	if (st.st_size > cookies_offset) {
+		data = g_malloc(st.st_size - cookies_offset + 1);
+		len = pread(fd, data, st.st_size - cookies_offset, cookies_offset);
+		data[len > 0 ? len : 0] = '\0';
+
+		/* Only complete lines, a writer may be in the middle of one */
+		for (line = data; (next = strchr(line, '\n')); line = next) {
+			*next++ = '\0';
+			cookies_apply(line);
+			cookies_lines++;
+		}
+		cookies_offset += line - data;
+		g_free(data);
+	}
+
+	cookies_loading = FALSE;
+	close(fd);
+}
+
+/* Rewrite the journal with only live cookies, lock held */
+static void
+cookies_compact(void)
+{
+	SoupCookie *cookie;
+	struct stat st;
+	GSList *list, *l;
+	GString *string;
+	gchar *file;
+
+	string = g_string_new(NULL);
+	cookies_lines = 0;
+	list = soup_cookie_jar_all_cookies(cookiejar);
+	for (l = list; l; l = l->next) {
+		cookie = l->data;
+		if (cookie->expires) {
+			g_string_append_printf(string, "+%s\t%s\t%s\t%s\t%ld\t%d\t%d\n",
+				cookie->domain, cookie->path, cookie->name, cookie->value,
+				(long)soup_date_to_time_t(cookie->expires),
+				cookie->secure, cookie->http_only);
+			cookies_lines++;
+		}
+		soup_cookie_free(cookie);
+	}
+	g_slist_free(list);
+	cookies_live = cookies_lines;
+
+	file = COOKIES_LOG;
+	if (g_file_set_contents(file, string->str, string->len, NULL)) {
+		g_chmod(file, 0600);
+		if (g_stat(file, &st) == 0) {
+			cookies_inode = st.st_ino;
+			cookies_offset = st.st_size;
+		}
+	}
+	g_string_free(string, TRUE);
+	g_free(file);
+}
+
+/* Write-behind: append coalesced changes in one write */
+gboolean
+cookies_flush(gpointer data)
+{
+	GHashTableIter iter;
+	struct stat st;
+	GString *string;
+	gpointer line;
+	gchar *file;
+	int lock, fd;
+
+	cookies_flush_id = 0;
+	if (! cookiejar)
+		return FALSE;
+
+	lock = cookies_lock(LOCK_EX);
+	cookies_read(FALSE);
+
+	if (g_hash_table_size(cookies_pending)) {
+		string = g_string_new(NULL);
+		g_hash_table_iter_init(&iter, cookies_pending);
+		while (g_hash_table_iter_next(&iter, NULL, &line)) {
+			g_string_append(string, line);
+			cookies_lines++;
+		}
+		g_hash_table_remove_all(cookies_pending);
+
+		file = COOKIES_LOG;
+		fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+		if (fd >= 0) {
+			if (write(fd, string->str, string->len) == string->len)
+				cookies_offset += string->len;
+			if (fstat(fd, &st) == 0)
+				cookies_inode = st.st_ino;
+			close(fd);
+		}
+		g_string_free(string, TRUE);
+		g_free(file);
+
+		if (cookies_lines > 2 * cookies_live + COOKIES_STALE)
+			cookies_compact();
+	}
+	cookies_unlock(lock);
+	return FALSE;
+}
+
+static void
+cookies_changed_cb(SoupCookieJar *jar, SoupCookie *old, SoupCookie *new,
+		gpointer data)
+{
+	SoupCookie *cookie;
+
+	/* Persistent cookies in the jar, the replayed ones too */
+	if (new && new->expires)
+		cookies_live++;
+	if (old && old->expires && cookies_live)
+		cookies_live--;
+	if (cookies_loading)
+		return;
+
+	/* Session cookies are never written, like the text jar */
+	if (new && new->expires) {
+		cookie = new;
+		g_hash_table_replace(cookies_pending, cookie_key(cookie),
+			g_strdup_printf("+%s\t%s\t%s\t%s\t%ld\t%d\t%d\n",
+				cookie->domain, cookie->path, cookie->name, cookie->value,
+				(long)soup_date_to_time_t(cookie->expires),
+				cookie->secure, cookie->http_only));
+	} else if (old && old->expires) {
+		cookie = old;
+		g_hash_table_replace(cookies_pending, cookie_key(cookie),
+			g_strdup_printf("-%s\t%s\t%s\n",
+				cookie->domain, cookie->path, cookie->name));
+	} else {
+		return;
+	}
+
+	if (! cookies_flush_id)
+		cookies_flush_id = g_timeout_add_seconds(COOKIES_FLUSH,
+			cookies_flush, NULL);
+}
+
+/* Pick up changes from other processes */
+static gboolean
+cookies_sync(gpointer data)
+{
+	int lock;
+
+	if (! cookiejar)
+		return FALSE;
+	lock = cookies_lock(LOCK_SH);
+	cookies_read(FALSE);
+	cookies_unlock(lock);
+	return TRUE;
+}
+
+/* Setup session cookies */
+void
+cookies_setup(void)
+{
+	SoupCookieJar *text;
+	GSList *list, *l;
+	gchar *file;
+	int lock, fd;
+
+	if (cookiejar) {
+		soup_session_remove_feature(session,
+			(SoupSessionFeature*)cookiejar);
+		g_object_unref(cookiejar);
+		cookiejar = NULL;
+	}
+
+	cookiejar = soup_cookie_jar_new();
+	cookies_live = 0;
+	if (! cookies_pending) {
+		cookies_pending = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+		g_timeout_add_seconds(COOKIES_SYNC, cookies_sync, NULL);
+	}
+	g_signal_connect(cookiejar, "changed",
+		G_CALLBACK(cookies_changed_cb), NULL);
+
+	lock = cookies_lock(LOCK_SH);
+	cookies_read(TRUE);
+	cookies_unlock(lock);
+
+	/* Import cookies.txt from older TazWeb once */
+	file = COOKIES_LOG;
+	if (! g_file_test(file, G_FILE_TEST_EXISTS)) {
+		text = soup_cookie_jar_text_new(COOKIES, TRUE);
+		list = soup_cookie_jar_all_cookies(text);
+		for (l = list; l; l = l->next)
+			soup_cookie_jar_add_cookie(cookiejar, l->data);
+		g_slist_free(list);
+		g_object_unref(text);
+		cookies_flush(NULL);
+		if ((fd = open(file, O_WRONLY | O_CREAT, 0600)) >= 0)
+			close(fd);
+	}
+	g_free(file);
+
+	soup_session_add_feature(session, (SoupSessionFeature*)cookiejar);
+}
+
+/* Render cookies.html from the live jar */
+gchar*
+cookies_html(void)
+{
+	SoupCookie *cookie;
+	GSList *list, *l;
+	GString *string;
+	gchar *line, *counter;
+	guint num = 0;
+
+	cookies_sync(NULL);
+	string = g_string_new(NULL);
+	html_header(string, _("Cookies"));
+	g_string_append(string, "<pre style=\"overflow: auto;\">\n");
+
+	list = cookiejar ? soup_cookie_jar_all_cookies(cookiejar) : NULL;
+	for (l = list; l; l = l->next) {
+		cookie = l->data;
+		line = g_markup_printf_escaped("%s\t%s\t%s\t%s\t%s\n",
+			cookie->domain, cookie->path, cookie->secure ? "TRUE" : "FALSE",
+			cookie->name, cookie->value);
+		g_string_append(string, line);
+		g_free(line);
+		soup_cookie_free(cookie);
+		num++;
+	}
+	g_slist_free(list);
+	g_string_append(string, "</pre>\n");
+
+	counter = g_strdup_printf(ngettext("%d cookie", "%d cookies", num), num);
+	html_footer(string, counter);
+	g_free(counter);
+
+	return g_string_free(string, FALSE);
+}
+
+/* Clean all cookies of the live jar and the journal */
+void
+cookies_clean(void)
+{
+	GSList *list, *l;
+	gchar *file;
+	int lock, fd;
+
+	if (! cookiejar)
+		return;
+
+	lock = cookies_lock(LOCK_EX);
+	cookies_loading = TRUE;
+	list = soup_cookie_jar_all_cookies(cookiejar);
+	for (l = list; l; l = l->next) {
+		soup_cookie_jar_delete_cookie(cookiejar, l->data);
+		soup_cookie_free(l->data);
+	}
+	g_slist_free(list);
+	g_hash_table_remove_all(cookies_pending);
+	cookies_loading = FALSE;
+
+	file = COOKIES_LOG;
+	fd = open(file, O_WRONLY | O_TRUNC | O_CREAT, 0600);
+	if (fd >= 0)
+		close(fd);
+	cookies_offset = 0;
+	cookies_lines = cookies_live = 0;
+	g_free(file);
+	cookies_unlock(lock);
+}
+
@@ -0,0 +1,757 @@
+/*
+ * Content filter of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Content filter
+ *
+ * Requests are checked against the lists found in ~/.config/tazweb/filters,
+ * hosts files or EasyList style lists. Domain rules (||host^ and hosts
+ * entries) go to a hashed set looked up with the request host and each
+ * of its parents. Other rules go to a multi-pattern matcher: a rule is
+ * filed under the hash of FILTER_GRAM bytes of its literal text, the url
+ * is scanned with a window of the same size and only the rules of the
+ * buckets hit are tried. Shorter rules go the same way to a second table
+ * of FILTER_SHORT bytes, only the few left are tried on every url.
+ * Element hiding, regexps and rules with $options are left out,
+ * @@||host^ exceptions are supported.
+ *
+ * The lists are compiled to filters.bin in the cache directory which is
+ * mapped as is, they are only parsed again when one of them changes.
+ * filters.bin keeps the path, size and modification time to the
+ * nanosecond of each list, a list renamed, added or removed is a change.
+ *
+ */
+
+#define FILTER_DIR		g_strdup_printf("%s/filters", CONFIG)
+#define FILTER_CACHE	g_strdup_printf("%s/filters.bin", CACHE_DIR)
+#define FILTER_MAGIC	0x4657545a
+#define FILTER_VERSION	3
+#define FILTER_GRAM		6
+#define FILTER_SHORT	3
+
+/* filters.bin: header, sources, domains, exceptions, buckets + 1 offsets
+ * in the patterns array, patterns, grams + 1 offsets in the shorts array,
+ * short patterns, other patterns, then the string pool. Slots and
+ * patterns are pool offsets, + 1 for slots where 0 is empty. Sources
+ * are the lines of filter_source() padded to 4 bytes */
+struct filter_header {
+	guint32			magic;
+	guint32			version;
+	guint32			sources;
+	guint32			domains;
+	guint32			exceptions;
+	guint32			buckets;
+	guint32			patterns;
+	guint32			grams;
+	guint32			shorts;
+	guint32			others;
+	guint32			pool;
+};
+
+/* Requests of the page loaded in a webview */
+struct filter_page {
+	guint			blocked;
+	guint			loaded;
+	guint64			bytes;
+};
+
+static const struct filter_header	*filter;
+static gsize			filter_length;
+static const guint32	*filter_domains, *filter_exceptions;
+static const guint32	*filter_buckets, *filter_patterns, *filter_grams;
+static const guint32	*filter_shorts, *filter_others;
+static const gchar		*filter_pool;
+guint					filter_blocked;
+static guint64			filter_saved;
+
+guint32
+filter_hash(const gchar *text, gsize length)
+{
+	guint32 h = 2166136261u;
+
+	while (length--)
+		h = (h ^ (guchar)*text++) * 16777619u;
+	return h;
+}
+
+static gboolean
+filter_literal(gchar c)
+{
+	return c && c != '*' && c != '^' && c != '|';
+}
+
+/* Offset of the first run of size literal bytes, -1 if none */
+static gint
+filter_gram(const gchar *pattern, gint size)
+{
+	const gchar *p, *run = pattern;
+
+	for (p = pattern; *p; p++) {
+		if (! filter_literal(*p))
+			run = p + 1;
+		else if (p + 1 - run == size)
+			return run - pattern;
+	}
+	return -1;
+}
+
+/* A separator is anything but a letter, a digit or _-.% and the end */
+static gboolean
+filter_separator(gchar c)
+{
+	return ! c || ! (g_ascii_isalnum(c) || strchr("_-.%", c));
+}
+
+/* Pattern at this position of the url */
+static gboolean
+filter_here(const gchar *p, const gchar *s)
+{
+	for (; *p; p++, s++) {
+		switch (*p) {
+			case '*':
+				for (p++; ; s++) {
+					if (filter_here(p, s))
+						return TRUE;
+					if (! *s)
+						return FALSE;
+				}
+			case '^':
+				if (! filter_separator(*s))
+					return FALSE;
+				/* The end is matched without moving on */
+				if (! *s)
+					s--;
+				break;
+			case '|':
+				if (! p[1])
+					return ! *s;
+				/* Fall through */
+			default:
+				if (*p != *s)
+					return FALSE;
+				break;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean
+filter_match(const gchar *pattern, const gchar *url, const gchar *host)
+{
+	const gchar *s;
+
+	/* ||: at the start of the host or of one of its labels */
+	if (pattern[0] == '|' && pattern[1] == '|') {
+		for (s = host; *s && *s != '/' && *s != ':'; s++)
+			if ((s == host || s[-1] == '.') && filter_here(pattern + 2, s))
+				return TRUE;
+		return FALSE;
+	}
+	if (pattern[0] == '|')
+		return filter_here(pattern + 1, url);
+	for (s = url; ; s++) {
+		if (filter_here(pattern, s))
+			return TRUE;
+		if (! *s)
+			return FALSE;
+	}
+}
+
+/* Host or one of its parents in a domain set */
+static gboolean
+filter_domain(const guint32 *slots, guint32 size, const gchar *host,
+		gsize length)
+{
+	const gchar *name;
+	guint32 i, slot;
+	gsize n;
+
+	if (! size)
+		return FALSE;
+	for (name = host, n = length; n; ) {
+		for (i = filter_hash(name, n) & (size - 1); (slot = slots[i]);
+				i = (i + 1) & (size - 1))
+			if (! strncmp(filter_pool + slot - 1, name, n)
+					&& ! filter_pool[slot - 1 + n])
+				return TRUE;
+		while (n && *name != '.')
+			name++, n--;
+		if (n)
+			name++, n--;
+	}
+	return FALSE;
+}
+
+/* Rules of the buckets hit by a window of size bytes over the url */
+static gboolean
+filter_scan(const gchar *url, gsize length, const gchar *host,
+		const guint32 *buckets, const guint32 *patterns, guint32 size,
+		gsize gram)
+{
+	const gchar *s;
+	guint32 b, i;
+
+	for (s = url; s + gram <= url + length; s++) {
+		b = filter_hash(s, gram) & (size - 1);
+		for (i = buckets[b]; i < buckets[b + 1]; i++)
+			if (filter_match(filter_pool + patterns[i], url, host))
+				return TRUE;
+	}
+	return FALSE;
+}
+
+/* An url of the request to block, lower case */
+static gboolean
+filter_url(const gchar *url)
+{
+	const gchar *host, *end;
+	guint32 i;
+	gsize length;
+
+	if (! filter || ! (host = strstr(url, "://")))
+		return FALSE;
+	host += 3;
+	for (end = host; *end && ! strchr("/:?#", *end); end++)
+		if (*end == '@')
+			host = end + 1;
+
+	if (filter_domain(filter_exceptions, filter->exceptions, host,
+			end - host))
+		return FALSE;
+	if (filter_domain(filter_domains, filter->domains, host, end - host))
+		return TRUE;
+
+	length = strlen(url);
+	if (filter_scan(url, length, host, filter_buckets, filter_patterns,
+			filter->buckets, FILTER_GRAM)
+			|| filter_scan(url, length, host, filter_grams, filter_shorts,
+				filter->grams, FILTER_SHORT))
+		return TRUE;
+	for (i = 0; i < filter->others; i++)
+		if (filter_match(filter_pool + filter_others[i], url, host))
+			return TRUE;
+	return FALSE;
+}
+
+/* Line of a source file in a compiled header */
+void
+filter_source(GString *sources, const gchar *file, const GStatBuf *st)
+{
+	g_string_append_printf(sources, "%s\t%" G_GUINT64_FORMAT "\t%ld.%09ld\n",
+		file, (guint64)st->st_size, (glong)st->st_mtime,
+		(glong)st->st_mtim.tv_nsec);
+}
+
+void
+filter_pad(GString *sources)
+{
+	while (sources->len % sizeof(guint32))
+		g_string_append_c(sources, '\0');
+}
+
+static gint
+filter_name_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* Lists by name and their sources, NULL without any list */
+static GString*
+filter_sources(GPtrArray *files)
+{
+	GStatBuf st;
+	GString *sources;
+	const gchar *name;
+	gchar *dir, *file;
+	GDir *gdir;
+	guint i;
+
+	dir = FILTER_DIR;
+	if ((gdir = g_dir_open(dir, 0, NULL))) {
+		while ((name = g_dir_read_name(gdir)))
+			g_ptr_array_add(files, g_build_filename(dir, name, NULL));
+		g_dir_close(gdir);
+	}
+	g_free(dir);
+
+	g_ptr_array_sort(files, filter_name_compare);
+	sources = g_string_new(NULL);
+	for (i = 0; i < files->len; ) {
+		file = g_ptr_array_index(files, i);
+		if (g_stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+			filter_source(sources, file, &st);
+			i++;
+		} else {
+			g_ptr_array_remove_index(files, i);
+		}
+	}
+	if (! files->len) {
+		g_string_free(sources, TRUE);
+		return NULL;
+	}
+	filter_pad(sources);
+	return sources;
+}
+
+/* A hosts file line: address and names */
+static void
+filter_parse_hosts(gchar **words, GHashTable *domains)
+{
+	guint i;
+
+	for (i = 1; words[i] && words[i][0] != '#'; i++)
+		if (*words[i] && strchr(words[i], '.')
+				&& strcmp(words[i], "0.0.0.0")
+				&& ! g_str_has_prefix(words[i], "localhost"))
+			g_hash_table_add(domains, g_ascii_strdown(words[i], -1));
+}
+
+/* ||host^ with nothing else */
+static gchar*
+filter_parse_domain(const gchar *rule)
+{
+	const gchar *p;
+
+	if (strncmp(rule, "||", 2))
+		return NULL;
+	for (p = rule + 2; g_ascii_isalnum(*p) || *p == '.' || *p == '-'; p++);
+	if (p == rule + 2 || (*p && strcmp(p, "^") && strcmp(p, "^|")))
+		return NULL;
+	return g_ascii_strdown(rule + 2, p - rule - 2);
+}
+
+static void
+filter_parse(const gchar *line, GHashTable *domains, GHashTable *exceptions,
+		GHashTable *patterns)
+{
+	gchar *rule, *text, **words;
+	gsize n;
+
+	rule = g_strstrip(g_strdup(line));
+	if (! *rule || strchr("![#", *rule) || strstr(rule, "##")
+			|| strstr(rule, "#@#") || strstr(rule, "#?#")) {
+		g_free(rule);
+		return;
+	}
+
+	/* Hosts file: an address first */
+	if (g_ascii_isdigit(*rule) || *rule == ':') {
+		words = g_strsplit_set(rule, " \t", -1);
+		if (words[1] && strspn(words[0], "0123456789.:abcdef")
+				== strlen(words[0]))
+			filter_parse_hosts(words, domains);
+		g_strfreev(words);
+		if (strpbrk(rule, " \t")) {
+			g_free(rule);
+			return;
+		}
+	}
+
+	if (g_str_has_prefix(rule, "@@")) {
+		if ((text = filter_parse_domain(rule + 2)))
+			g_hash_table_add(exceptions, text);
+	} else if ((text = filter_parse_domain(rule))) {
+		g_hash_table_add(domains, text);
+	} else if (! strchr(rule, '$') && *rule != '/') {
+		/* Leading and trailing * match anyway */
+		for (n = strlen(rule); n && rule[n - 1] == '*'; n--)
+			rule[n - 1] = '\0';
+		text = rule + strspn(rule, "*");
+		if (*text && strcmp(text, "|") && strcmp(text, "||"))
+			g_hash_table_add(patterns, g_ascii_strdown(text, -1));
+	}
+	g_free(rule);
+}
+
+guint32
+filter_pow2(guint n)
+{
+	guint32 size = 16;
+
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+/* Open addressed set of pool offsets + 1 */
+static void
+filter_write_set(GString *out, GString *pool, GHashTable *set, guint32 size)
+{
+	GHashTableIter iter;
+	guint32 *slots, i;
+	gpointer name;
+
+	slots = g_new0(guint32, size);
+	g_hash_table_iter_init(&iter, set);
+	while (g_hash_table_iter_next(&iter, &name, NULL)) {
+		for (i = filter_hash(name, strlen(name)) & (size - 1); slots[i];
+				i = (i + 1) & (size - 1));
+		slots[i] = pool->len + 1;
+		g_string_append_len(pool, name, strlen(name) + 1);
+	}
+	g_string_append_len(out, (gchar *)slots, size * sizeof(guint32));
+	g_free(slots);
+}
+
+/* Offsets of the buckets + 1 then the patterns sorted by bucket, from
+ * hash and pool offset pairs */
+static void
+filter_write_buckets(GString *out, GArray *entries, guint32 size)
+{
+	guint32 *count, *slots, *entry, i;
+
+	count = g_new0(guint32, size + 1);
+	for (i = 0; i < entries->len; i++)
+		count[(g_array_index(entries, guint32, i * 2) & (size - 1)) + 1]++;
+	for (i = 0; i < size; i++)
+		count[i + 1] += count[i];
+	g_string_append_len(out, (gchar *)count, (size + 1) * sizeof(guint32));
+
+	slots = g_new(guint32, entries->len);
+	for (i = 0; i < entries->len; i++) {
+		entry = &g_array_index(entries, guint32, i * 2);
+		slots[count[entry[0] & (size - 1)]++] = entry[1];
+	}
+	g_string_append_len(out, (gchar *)slots, entries->len * sizeof(guint32));
+	g_free(slots);
+	g_free(count);
+}
+
+/* Parse the lists and write filters.bin */
+static gboolean
+filter_compile(const gchar *cache, GString *sources, GPtrArray *files)
+{
+	struct filter_header header = { 0 };
+	GHashTable *domains, *exceptions, *patterns;
+	GHashTableIter iter;
+	GArray *buckets, *shorts, *others;
+	GString *out, *pool;
+	gchar *data, **lines;
+	gpointer text;
+	guint32 offset;
+	gboolean done;
+	guint i, j;
+	gint gram;
+
+	domains = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	exceptions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	patterns = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < files->len; i++) {
+		if (! g_file_get_contents(g_ptr_array_index(files, i), &data,
+				NULL, NULL))
+			continue;
+		lines = g_strsplit(data, "\n", -1);
+		for (j = 0; lines[j]; j++)
+			filter_parse(lines[j], domains, exceptions, patterns);
+		g_strfreev(lines);
+		g_free(data);
+	}
+
+	header.magic = FILTER_MAGIC;
+	header.version = FILTER_VERSION;
+	header.sources = sources->len;
+	header.domains = g_hash_table_size(domains) ?
+		filter_pow2(g_hash_table_size(domains) * 2) : 0;
+	header.exceptions = g_hash_table_size(exceptions) ?
+		filter_pow2(g_hash_table_size(exceptions) * 2) : 0;
+
+	/* Patterns are filed by the hash of their first long enough run */
+	pool = g_string_new(NULL);
+	buckets = g_array_new(FALSE, FALSE, sizeof(guint32[2]));
+	shorts = g_array_new(FALSE, FALSE, sizeof(guint32[2]));
+	others = g_array_new(FALSE, FALSE, sizeof(guint32));
+	g_hash_table_iter_init(&iter, patterns);
+	while (g_hash_table_iter_next(&iter, &text, NULL)) {
+		offset = pool->len;
+		g_string_append_len(pool, text, strlen(text) + 1);
+		if ((gram = filter_gram(text, FILTER_GRAM)) >= 0) {
+			guint32 entry[2] = { filter_hash((gchar *)text + gram,
+				FILTER_GRAM), offset };
+			g_array_append_val(buckets, entry);
+		} else if ((gram = filter_gram(text, FILTER_SHORT)) >= 0) {
+			guint32 entry[2] = { filter_hash((gchar *)text + gram,
+				FILTER_SHORT), offset };
+			g_array_append_val(shorts, entry);
+		} else {
+			g_array_append_val(others, offset);
+		}
+	}
+	header.buckets = filter_pow2(buckets->len);
+	header.patterns = buckets->len;
+	header.grams = filter_pow2(shorts->len);
+	header.shorts = shorts->len;
+	header.others = others->len;
+
+	/* Strings of the sets follow the patterns in the pool */
+	out = g_string_new(NULL);
+	g_string_append_len(out, (gchar *)&header, sizeof(header));
+	g_string_append_len(out, sources->str, sources->len);
+	filter_write_set(out, pool, domains, header.domains);
+	filter_write_set(out, pool, exceptions, header.exceptions);
+	filter_write_buckets(out, buckets, header.buckets);
+	filter_write_buckets(out, shorts, header.grams);
+	g_string_append_len(out, others->data, others->len * sizeof(guint32));
+
+	/* Pool size is only known now */
+	((struct filter_header *)out->str)->pool = pool->len;
+	g_string_append_len(out, pool->str, pool->len);
+	done = g_file_set_contents(cache, out->str, out->len, NULL);
+	if (! done)
+		g_warning("Can't write: %s", cache);
+
+	g_array_free(buckets, TRUE);
+	g_array_free(shorts, TRUE);
+	g_array_free(others, TRUE);
+	g_string_free(pool, TRUE);
+	g_string_free(out, TRUE);
+	g_hash_table_destroy(domains);
+	g_hash_table_destroy(exceptions);
+	g_hash_table_destroy(patterns);
+	return done;
+}
+
+/* Map filters.bin, NULL if it is not there or not valid */
+static const struct filter_header*
+filter_map(const gchar *cache, GString *sources, gsize *length)
+{
+	const struct filter_header *header;
+	struct stat st;
+	gsize size;
+	void *map;
+	int fd;
+
+	if ((fd = open(cache, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (gsize)st.st_size < sizeof(*header)
+			|| (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+				== MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	header = map;
+	size = sizeof(*header) + header->sources
+		+ ((gsize)header->domains + header->exceptions
+		+ header->buckets + 1 + header->patterns + header->grams + 1
+		+ header->shorts + header->others) * sizeof(guint32) + header->pool;
+	if (header->magic != FILTER_MAGIC || header->version != FILTER_VERSION
+			|| size != (gsize)st.st_size
+			|| ! header->buckets || header->buckets & (header->buckets - 1)
+			|| ! header->grams || header->grams & (header->grams - 1)
+			|| header->domains & (header->domains - 1)
+			|| header->exceptions & (header->exceptions - 1)
+			|| header->sources != sources->len
+			|| memcmp(header + 1, sources->str, sources->len)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	*length = st.st_size;
+	return header;
+}
+
+/* Lists are compiled again only when they changed */
+void
+filter_load(void)
+{
+	GPtrArray *files;
+	GString *sources;
+	gchar *cache, *dir;
+
+	files = g_ptr_array_new_with_free_func(g_free);
+	if (! (sources = filter_sources(files))) {
+		g_ptr_array_free(files, TRUE);
+		return;
+	}
+
+	cache = FILTER_CACHE;
+	if (! (filter = filter_map(cache, sources, &filter_length))) {
+		dir = CACHE_DIR;
+		g_mkdir_with_parents(dir, 0700);
+		if (filter_compile(cache, sources, files))
+			filter = filter_map(cache, sources, &filter_length);
+		g_free(dir);
+	}
+	if (filter) {
+		filter_domains = (const guint32 *)((const gchar *)(filter + 1)
+			+ filter->sources);
+		filter_exceptions = filter_domains + filter->domains;
+		filter_buckets = filter_exceptions + filter->exceptions;
+		filter_patterns = filter_buckets + filter->buckets + 1;
+		filter_grams = filter_patterns + filter->patterns;
+		filter_shorts = filter_grams + filter->grams + 1;
+		filter_others = filter_shorts + filter->shorts;
+		filter_pool = (const gchar *)(filter_others + filter->others);
+	}
+	g_free(cache);
+	g_string_free(sources, TRUE);
+	g_ptr_array_free(files, TRUE);
+}
+
+static void
+filter_request_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, WebKitNetworkRequest *request,
+		WebKitNetworkResponse *response, struct filter_page *fp)
+{
+	const gchar *uri = webkit_network_request_get_uri(request);
+	gchar *url;
+
+	/* The page itself is not blocked */
+	if (! uri || g_ascii_strncasecmp(uri, "http", 4)
+			|| (frame == webkit_web_view_get_main_frame(webview)
+				&& webkit_web_frame_get_provisional_data_source(frame)))
+		return;
+
+	url = g_ascii_strdown(uri, -1);
+	if (filter_url(url)) {
+		webkit_network_request_set_uri(request, "about:blank");
+		fp->blocked++;
+	}
+	g_free(url);
+}
+
+static void
+filter_length_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, gint length, struct filter_page *fp)
+{
+	fp->bytes += length;
+}
+
+static void
+filter_finished_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, struct filter_page *fp)
+{
+	fp->loaded++;
+}
+
+/* Counters start with each page, bytes saved are estimated with the
+ * mean size of the resources loaded */
+static void
+filter_status_cb(WebKitWebView *webview, GParamSpec *pspec,
+		struct filter_page *fp)
+{
+	guint64 saved;
+
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_PROVISIONAL:
+			memset(fp, 0, sizeof(*fp));
+			break;
+
+		case WEBKIT_LOAD_FINISHED:
+			if (! fp->blocked)
+				break;
+			saved = fp->loaded ? fp->blocked * fp->bytes / fp->loaded : 0;
+			filter_blocked += fp->blocked;
+			filter_saved += saved;
+			g_debug("Filter: %u requests blocked, ~%" G_GUINT64_FORMAT
+				" KB saved: %s", fp->blocked, saved / 1024,
+				webkit_web_view_get_uri(webview));
+			break;
+
+		default:
+			break;
+	}
+}
+
+void
+filter_attach(WebKitWebView *webview)
+{
+	struct filter_page *fp;
+
+	if (! filter)
+		return;
+	fp = g_new0(struct filter_page, 1);
+	g_object_set_data_full(G_OBJECT(webview), "filter", fp, g_free);
+	g_signal_connect(webview, "resource-request-starting",
+		G_CALLBACK(filter_request_cb), fp);
+	g_signal_connect(webview, "resource-content-length-received",
+		G_CALLBACK(filter_length_cb), fp);
+	g_signal_connect(webview, "resource-load-finished",
+		G_CALLBACK(filter_finished_cb), fp);
+	g_signal_connect(webview, "notify::load-status",
+		G_CALLBACK(filter_status_cb), fp);
+}
+
+void
+filter_report(void)
+{
+	if (filter)
+		g_debug("Filter: %u requests blocked, ~%" G_GUINT64_FORMAT
+			" KB saved", filter_blocked, filter_saved / 1024);
+}
+
+/* --filter-bench: compile, map and match times of the lists with a list
+ * of urls */
+int
+filter_bench(GPtrArray *urls)
+{
+	GPtrArray *files;
+	gint64 start, compiled, mapped, elapsed;
+	guint64 count = 0, blocked = 0;
+	GString *sources;
+	gchar *cache, *dir, *url;
+	guint i, domains = 0;
+
+	files = g_ptr_array_new_with_free_func(g_free);
+	if (! (sources = filter_sources(files))) {
+		dir = FILTER_DIR;
+		fprintf(stderr, "No lists in: %s\n", dir);
+		g_free(dir);
+		return 1;
+	}
+	for (i = 0; i < urls->len; i++) {
+		url = g_ptr_array_index(urls, i);
+		g_ptr_array_index(urls, i) = g_ascii_strdown(url, -1);
+		g_free(url);
+	}
+
+	cache = FILTER_CACHE;
+	dir = CACHE_DIR;
+	g_mkdir_with_parents(dir, 0700);
+	start = g_get_monotonic_time();
+	if (! filter_compile(cache, sources, files))
+		return 1;
+	compiled = g_get_monotonic_time();
+	filter_load();
+	mapped = g_get_monotonic_time();
+	if (! filter)
+		return 1;
+
+	/* Whole list passes for at least a second */
+	do {
+		for (i = 0; i < urls->len; i++)
+			blocked += filter_url(g_ptr_array_index(urls, i));
+		count += urls->len;
+		elapsed = g_get_monotonic_time() - mapped;
+	} while (elapsed < G_USEC_PER_SEC);
+
+	for (i = 0; i < filter->domains; i++)
+		domains += filter_domains[i] != 0;
+	printf("Lists:    %u files, %u domains, %u patterns, %lu KB compiled\n",
+		files->len, domains,
+		filter->patterns + filter->shorts + filter->others,
+		(gulong)filter_length / 1024);
+	printf("Patterns: %u by %d bytes, %u by %d bytes, %u on every url\n",
+		filter->patterns, FILTER_GRAM, filter->shorts, FILTER_SHORT,
+		filter->others);
+	printf("Compile:  %.1f ms\n", (compiled - start) / 1000.0);
+	printf("Map:      %.1f ms\n", (mapped - compiled) / 1000.0);
+	printf("Match:    %.0f urls/s, %.2f us/url, %" G_GUINT64_FORMAT
+		"%% blocked\n", count * (gdouble)G_USEC_PER_SEC / elapsed,
+		(gdouble)elapsed / count, blocked * 100 / count);
+
+	g_free(dir);
+	g_free(cache);
+	g_string_free(sources, TRUE);
+	g_ptr_array_free(files, TRUE);
+	return 0;
+}
+
@@ -0,0 +1,447 @@
+/*
+ * HAR capture of the pages loaded by TazWeb.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Resource timing recorder
+ *
+ * With --har or --trace-events, each page load is recorded from the
+ * webview resource signals and the SoupMessage events, then written to
+ * the given directory as a HAR file or a Chrome trace-event file once
+ * the page is loaded. DNS and connect times are only known when the
+ * request opened a new connection, they are -1 otherwise.
+ *
+ */
+
+struct har_entry {
+	SoupMessage		*msg;
+	gchar			*url;
+	gchar			*method;
+	gchar			*mime;
+	guint			status;
+	gboolean		failed;
+	gint64			wall;
+	gint64			start;
+	gint64			dns;
+	gint64			dns_end;
+	gint64			connect;
+	gint64			connect_end;
+	gint64			sent;
+	gint64			response;
+	gint64			end;
+	gint64			bytes;
+};
+
+struct har_page {
+	gchar			*url;
+	gint64			wall;
+	gint64			start;
+	gint64			content;
+	gint64			end;
+	GHashTable		*resources;
+	GPtrArray		*entries;
+};
+
+gchar					*har_dir;
+gint					har_format;
+static guint			har_count;
+
+static void
+har_entry_free(struct har_entry *he)
+{
+	if (he->msg) {
+		g_signal_handlers_disconnect_matched(he->msg, G_SIGNAL_MATCH_DATA,
+			0, 0, NULL, NULL, he);
+		g_object_unref(he->msg);
+	}
+	g_free(he->url);
+	g_free(he->method);
+	g_free(he->mime);
+	g_free(he);
+}
+
+static struct har_page*
+har_page_new(const gchar *url)
+{
+	struct har_page *hp;
+
+	hp = g_new0(struct har_page, 1);
+	hp->url = g_strdup(url);
+	hp->wall = g_get_real_time();
+	hp->start = g_get_monotonic_time();
+	hp->resources = g_hash_table_new(NULL, NULL);
+	hp->entries = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)har_entry_free);
+	return hp;
+}
+
+static void
+har_page_free(struct har_page *hp)
+{
+	g_hash_table_destroy(hp->resources);
+	g_ptr_array_free(hp->entries, TRUE);
+	g_free(hp->url);
+	g_free(hp);
+}
+
+/* Soup connection events, only sent for a new connection */
+static void
+har_network_event_cb(SoupMessage *msg, GSocketClientEvent event,
+		GIOStream *connection, struct har_entry *he)
+{
+	gint64 now = g_get_monotonic_time();
+
+	switch (event) {
+		case G_SOCKET_CLIENT_RESOLVING:
+			he->dns = now;
+			break;
+		case G_SOCKET_CLIENT_RESOLVED:
+			he->dns_end = now;
+			break;
+		case G_SOCKET_CLIENT_CONNECTING:
+			if (! he->connect)
+				he->connect = now;
+			break;
+		case G_SOCKET_CLIENT_COMPLETE:
+			he->connect_end = now;
+			break;
+		default:
+			break;
+	}
+}
+
+static void
+har_wrote_body_cb(SoupMessage *msg, struct har_entry *he)
+{
+	he->sent = g_get_monotonic_time();
+}
+
+static void
+har_request_starting_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, WebKitNetworkRequest *request,
+		WebKitNetworkResponse *response, gpointer data)
+{
+	struct har_page *hp;
+	struct har_entry *he;
+	SoupMessage *msg;
+
+	if (! (hp = g_object_get_data(G_OBJECT(webview), "har")))
+		return;
+
+	he = g_new0(struct har_entry, 1);
+	he->url = g_strdup(webkit_network_request_get_uri(request));
+	he->wall = g_get_real_time();
+	he->start = g_get_monotonic_time();
+	msg = webkit_network_request_get_message(request);
+	he->method = g_strdup(msg ? msg->method : "GET");
+
+	if (msg) {
+		he->msg = g_object_ref(msg);
+		g_signal_connect(msg, "network-event",
+			G_CALLBACK(har_network_event_cb), he);
+		g_signal_connect(msg, "wrote-body",
+			G_CALLBACK(har_wrote_body_cb), he);
+	}
+	g_hash_table_replace(hp->resources, resource, he);
+	g_ptr_array_add(hp->entries, he);
+}
+
+static void
+har_response_received_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, WebKitNetworkResponse *response,
+		gpointer data)
+{
+	struct har_page *hp;
+	struct har_entry *he;
+	SoupMessage *msg;
+
+	if (! (hp = g_object_get_data(G_OBJECT(webview), "har"))
+			|| ! (he = g_hash_table_lookup(hp->resources, resource)))
+		return;
+
+	he->response = g_get_monotonic_time();
+	if ((msg = webkit_network_response_get_message(response)))
+		he->status = msg->status_code;
+}
+
+static void
+har_length_received_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, gint length, gpointer data)
+{
+	struct har_page *hp;
+	struct har_entry *he;
+
+	if ((hp = g_object_get_data(G_OBJECT(webview), "har"))
+			&& (he = g_hash_table_lookup(hp->resources, resource)))
+		he->bytes += length;
+}
+
+static void
+har_load_end(WebKitWebView *webview, WebKitWebResource *resource,
+		gboolean failed)
+{
+	struct har_page *hp;
+	struct har_entry *he;
+
+	if (! (hp = g_object_get_data(G_OBJECT(webview), "har"))
+			|| ! (he = g_hash_table_lookup(hp->resources, resource)))
+		return;
+
+	he->end = g_get_monotonic_time();
+	he->failed = failed;
+	if (! he->response)
+		he->response = he->end;
+	he->mime = g_strdup(webkit_web_resource_get_mime_type(resource));
+	g_hash_table_remove(hp->resources, resource);
+}
+
+static void
+har_load_finished_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, gpointer data)
+{
+	har_load_end(webview, resource, FALSE);
+}
+
+static void
+har_load_failed_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, GError *error, gpointer data)
+{
+	har_load_end(webview, resource, TRUE);
+}
+
+/* JSON string with quotes */
+static void
+json_string(GString *string, const gchar *text)
+{
+	const gchar *p;
+
+	g_string_append_c(string, '"');
+	for (p = text ? text : ""; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			g_string_append_printf(string, "\\%c", *p);
+		else if ((guchar)*p < 0x20)
+			g_string_append_printf(string, "\\u%04x", (guchar)*p);
+		else
+			g_string_append_c(string, *p);
+	}
+	g_string_append_c(string, '"');
+}
+
+/* ISO 8601 date of a g_get_real_time() value */
+static void
+json_date(GString *string, gint64 wall)
+{
+	GDateTime *date;
+	gchar *text;
+
+	date = g_date_time_new_from_unix_utc(wall / G_USEC_PER_SEC);
+	text = g_date_time_format(date, "%Y-%m-%dT%H:%M:%S");
+	g_string_append_printf(string, "\"%s.%03dZ\"", text,
+		(int)(wall % G_USEC_PER_SEC / 1000));
+	g_free(text);
+	g_date_time_unref(date);
+}
+
+/* Milliseconds between two timestamps, -1 if one is unknown */
+static gdouble
+har_ms(gint64 from, gint64 to)
+{
+	if (! from || ! to || to < from)
+		return -1;
+	return (to - from) / 1000.0;
+}
+
+static void
+har_write_entry(GString *string, struct har_entry *he)
+{
+	gint64 ready;
+
+	/* Ready to send: after the connection or at once on a kept one */
+	ready = he->connect_end ? he->connect_end : he->start;
+
+	g_string_append(string, "{\"pageref\":\"page_1\",\"startedDateTime\":");
+	json_date(string, he->wall);
+	g_string_append_printf(string, ",\"time\":%.3f,\"request\":{\"method\":",
+		har_ms(he->start, he->end));
+	json_string(string, he->method);
+	g_string_append(string, ",\"url\":");
+	json_string(string, he->url);
+	g_string_append_printf(string, ",\"httpVersion\":\"HTTP/1.1\","
+		"\"cookies\":[],\"headers\":[],\"queryString\":[],"
+		"\"headersSize\":-1,\"bodySize\":-1},\"response\":{\"status\":%u,"
+		"\"statusText\":\"%s\",\"httpVersion\":\"HTTP/1.1\",\"cookies\":[],"
+		"\"headers\":[],\"content\":{\"size\":%" G_GINT64_FORMAT
+		",\"mimeType\":", he->status, he->failed ? "Failed" : "",
+		he->bytes);
+	json_string(string, he->mime);
+	g_string_append_printf(string, "},\"redirectURL\":\"\",\"headersSize\":-1,"
+		"\"bodySize\":%" G_GINT64_FORMAT "},\"cache\":{},\"timings\":{"
+		"\"blocked\":%.3f,\"dns\":%.3f,\"connect\":%.3f,\"send\":%.3f,"
+		"\"wait\":%.3f,\"receive\":%.3f,\"ssl\":-1}}",
+		he->bytes, har_ms(he->start, he->dns ? he->dns : he->connect),
+		har_ms(he->dns, he->dns_end), har_ms(he->connect, he->connect_end),
+		he->sent ? har_ms(ready, he->sent) : 0,
+		har_ms(he->sent ? he->sent : ready, he->response),
+		har_ms(he->response, he->end));
+}
+
+static void
+har_write_trace_entry(GString *string, struct har_page *hp,
+		struct har_entry *he)
+{
+	g_string_append(string, "{\"name\":");
+	json_string(string, he->url);
+	g_string_append_printf(string, ",\"cat\":\"resource\",\"ph\":\"X\","
+		"\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,"
+		"\"tid\":1,\"args\":{\"status\":%u,\"bytes\":%" G_GINT64_FORMAT
+		",\"dns\":%.3f,\"connect\":%.3f,\"wait\":%.3f,\"receive\":%.3f,"
+		"\"mime\":", he->start - hp->start,
+		(he->end ? he->end : hp->end) - he->start, getpid(), he->status,
+		he->bytes, har_ms(he->dns, he->dns_end),
+		har_ms(he->connect, he->connect_end),
+		har_ms(he->sent ? he->sent : he->start, he->response),
+		har_ms(he->response, he->end));
+	json_string(string, he->mime);
+	g_string_append(string, "}}");
+}
+
+/* Write the page to the record directory */
+static void
+har_write(struct har_page *hp, const gchar *title)
+{
+	struct har_entry *he;
+	GDateTime *date;
+	SoupURI *suri;
+	GString *string;
+	gchar *stamp, *file;
+	guint i;
+
+	string = g_string_new(NULL);
+	if (har_format == HAR_TRACE) {
+		g_string_append(string, "{\"traceEvents\":[{\"name\":");
+		json_string(string, hp->url);
+		g_string_append_printf(string, ",\"cat\":\"page\",\"ph\":\"X\","
+			"\"ts\":0,\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":0}",
+			hp->end - hp->start, getpid());
+		for (i = 0; i < hp->entries->len; i++) {
+			g_string_append_c(string, ',');
+			har_write_trace_entry(string, hp,
+				g_ptr_array_index(hp->entries, i));
+		}
+		g_string_append(string, "]}\n");
+	} else {
+		g_string_append_printf(string, "{\"log\":{\"version\":\"1.2\","
+			"\"creator\":{\"name\":\"TazWeb\",\"version\":\"%s\"},"
+			"\"pages\":[{\"startedDateTime\":", tazweb_version);
+		json_date(string, hp->wall);
+		g_string_append(string, ",\"id\":\"page_1\",\"title\":");
+		json_string(string, title ? title : hp->url);
+		g_string_append_printf(string, ",\"pageTimings\":{"
+			"\"onContentLoad\":%.3f,\"onLoad\":%.3f}}],\"entries\":[",
+			har_ms(hp->start, hp->content), har_ms(hp->start, hp->end));
+		for (i = 0; i < hp->entries->len; i++) {
+			he = g_ptr_array_index(hp->entries, i);
+			if (i)
+				g_string_append_c(string, ',');
+			har_write_entry(string, he);
+		}
+		g_string_append(string, "]}}\n");
+	}
+
+	/* date-host-n.har or .json */
+	date = g_date_time_new_now_local();
+	stamp = g_date_time_format(date, "%Y%m%d-%H%M%S");
+	suri = soup_uri_new(hp->url);
+	file = g_strdup_printf("%s/%s-%s-%u.%s", har_dir, stamp,
+		suri && suri->host ? suri->host : "local", ++har_count,
+		har_format == HAR_TRACE ? "json" : "har");
+	if (! g_file_set_contents(file, string->str, string->len, NULL))
+		g_warning("Can't write: %s", file);
+
+	if (suri)
+		soup_uri_free(suri);
+	g_free(file);
+	g_free(stamp);
+	g_date_time_unref(date);
+	g_string_free(string, TRUE);
+}
+
+/* A page starts with a main frame provisional load and is written
+ * when it is loaded, then dropped with its requests */
+static void
+har_load_status_cb(WebKitWebView *webview, GParamSpec *pspec, gpointer data)
+{
+	struct har_page *hp;
+	WebKitWebDataSource *source;
+
+	hp = g_object_get_data(G_OBJECT(webview), "har");
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_PROVISIONAL:
+			source = webkit_web_frame_get_provisional_data_source(
+				webkit_web_view_get_main_frame(webview));
+			hp = har_page_new(source ? webkit_network_request_get_uri(
+				webkit_web_data_source_get_request(source)) : NULL);
+			g_object_set_data_full(G_OBJECT(webview), "har", hp,
+				(GDestroyNotify)har_page_free);
+			break;
+
+		case WEBKIT_LOAD_FINISHED:
+		case WEBKIT_LOAD_FAILED:
+			if (hp) {
+				hp->end = g_get_monotonic_time();
+				/* Named after the page once redirects are followed */
+				if (webkit_web_view_get_uri(webview)) {
+					g_free(hp->url);
+					hp->url = g_strdup(webkit_web_view_get_uri(webview));
+				}
+				har_write(hp, webkit_web_view_get_title(webview));
+				/* Later requests belong to no page */
+				g_object_set_data(G_OBJECT(webview), "har", NULL);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* The main frame document is parsed: onContentLoad */
+static void
+har_document_loaded_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		gpointer data)
+{
+	struct har_page *hp;
+
+	if (frame == webkit_web_view_get_main_frame(webview)
+			&& (hp = g_object_get_data(G_OBJECT(webview), "har"))
+			&& ! hp->content)
+		hp->content = g_get_monotonic_time();
+}
+
+/* Record the resources of a webview */
+void
+har_attach(WebKitWebView *webview)
+{
+	g_signal_connect(webview, "notify::load-status",
+		G_CALLBACK(har_load_status_cb), NULL);
+	g_signal_connect(webview, "document-load-finished",
+		G_CALLBACK(har_document_loaded_cb), NULL);
+	g_signal_connect(webview, "resource-request-starting",
+		G_CALLBACK(har_request_starting_cb), NULL);
+	g_signal_connect(webview, "resource-response-received",
+		G_CALLBACK(har_response_received_cb), NULL);
+	g_signal_connect(webview, "resource-content-length-received",
+		G_CALLBACK(har_length_received_cb), NULL);
+	g_signal_connect(webview, "resource-load-finished",
+		G_CALLBACK(har_load_finished_cb), NULL);
+	g_signal_connect(webview, "resource-load-failed",
+		G_CALLBACK(har_load_failed_cb), NULL);
+}
+
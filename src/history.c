@@ -0,0 +1,361 @@
+/*
+ * History journal of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * History
+ *
+ * Main frame navigations are recorded in history.log, an append-only
+ * journal indexed in memory by url with visit counts and times for the
+ * frecency of the URL completion. Lines are buffered and appended every
+ * few seconds by one write, the journal is rewritten once stale lines
+ * pile up. Reading and rewriting it run in a worker thread, the table
+ * it builds is merged back on the main loop and no journal write is
+ * made meanwhile. Processes share it under a flock() on history.lock.
+ * Nothing is recorded in private mode.
+ *
+ *   v TAB time TAB url                     visit
+ *   t TAB url TAB title                    title
+ *   h TAB visits TAB first TAB last TAB url TAB title    compacted entry
+ *
+ */
+
+#define HISTORY_LOG		g_strdup_printf("%s/history.log", CONFIG)
+#define HISTORY_LOCK	g_strdup_printf("%s/history.lock", CONFIG)
+#define HISTORY_FLUSH	2
+#define HISTORY_STALE	1024
+
+struct history_entry {
+	gchar			*title;
+	guint			visits;
+	gint64			first;
+	gint64			last;
+};
+
+GHashTable				*history;
+static GString			*history_pending;
+static guint			history_flush_id;
+static guint			history_lines;
+static gboolean		history_loaded;
+static gboolean		history_busy;
+
+/* One read, or rewrite, of the journal by the worker thread */
+struct history_job {
+	GHashTable		*table;
+	guint			lines;
+	gboolean		compact;
+	gboolean		written;
+};
+
+static void
+history_entry_free(struct history_entry *he)
+{
+	g_free(he->title);
+	g_free(he);
+}
+
+static GHashTable*
+history_new(void)
+{
+	return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		(GDestroyNotify)history_entry_free);
+}
+
+static int
+history_lock(int operation)
+{
+	gchar *file;
+	int fd;
+
+	file = HISTORY_LOCK;
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd >= 0)
+		flock(fd, operation);
+	g_free(file);
+	return fd;
+}
+
+static struct history_entry*
+history_get(GHashTable *table, const gchar *url)
+{
+	struct history_entry *he;
+
+	if (! (he = g_hash_table_lookup(table, url))) {
+		he = g_new0(struct history_entry, 1);
+		g_hash_table_insert(table, g_strdup(url), he);
+	}
+	return he;
+}
+
+static void
+history_visited(struct history_entry *he, gint64 time)
+{
+	he->visits++;
+	if (! he->first || time < he->first)
+		he->first = time;
+	if (time > he->last)
+		he->last = time;
+}
+
+/* Replay one journal line */
+static void
+history_apply(GHashTable *table, gchar *line)
+{
+	struct history_entry *he;
+	gchar **f;
+
+	f = g_strsplit(line, "\t", 6);
+	if (! strcmp(f[0], "v") && g_strv_length(f) == 3) {
+		history_visited(history_get(table, f[2]),
+			g_ascii_strtoll(f[1], NULL, 10));
+	} else if (! strcmp(f[0], "t") && g_strv_length(f) == 3) {
+		he = history_get(table, f[1]);
+		g_free(he->title);
+		he->title = g_strdup(f[2]);
+	} else if (! strcmp(f[0], "h") && g_strv_length(f) == 6) {
+		he = history_get(table, f[4]);
+		he->visits += strtoul(f[1], NULL, 10);
+		he->first = g_ascii_strtoll(f[2], NULL, 10);
+		he->last = MAX(he->last, g_ascii_strtoll(f[3], NULL, 10));
+		g_free(he->title);
+		he->title = g_strdup(f[5]);
+	}
+	g_strfreev(f);
+}
+
+/* Lines not written yet, they stay pending */
+static void
+history_replay(GHashTable *table)
+{
+	gchar **lines;
+	guint i;
+
+	lines = g_strsplit(history_pending->str, "\n", -1);
+	for (i = 0; lines[i]; i++)
+		if (*lines[i])
+			history_apply(table, lines[i]);
+	g_strfreev(lines);
+}
+
+/* Journal into a table, returns the number of lines */
+static guint
+history_read(GHashTable *table)
+{
+	gchar *file, *data, **lines;
+	guint i, n = 0;
+
+	file = HISTORY_LOG;
+	if (g_file_get_contents(file, &data, NULL, NULL)) {
+		lines = g_strsplit(data, "\n", -1);
+		for (i = 0; lines[i]; i++) {
+			if (*lines[i]) {
+				history_apply(table, lines[i]);
+				n++;
+			}
+		}
+		g_strfreev(lines);
+		g_free(data);
+	}
+	g_free(file);
+	return n;
+}
+
+/* Rewrite the journal as one line per url */
+static gboolean
+history_write(GHashTable *table)
+{
+	struct history_entry *he;
+	GHashTableIter iter;
+	GString *string;
+	gpointer url;
+	gchar *file;
+	gboolean done;
+
+	string = g_string_new(NULL);
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, &url, (gpointer *)&he))
+		g_string_append_printf(string, "h\t%u\t%" G_GINT64_FORMAT "\t%"
+			G_GINT64_FORMAT "\t%s\t%s\n", he->visits, he->first, he->last,
+			(gchar *)url, he->title ? he->title : "");
+
+	file = HISTORY_LOG;
+	if ((done = g_file_set_contents(file, string->str, string->len, NULL)))
+		g_chmod(file, 0600);
+
+	g_string_free(string, TRUE);
+	g_free(file);
+	return done;
+}
+
+/* Worker thread, it touches nothing but its job */
+static gpointer
+history_worker(gpointer data)
+{
+	struct history_job *job = data;
+	int lock;
+
+	lock = history_lock(job->compact ? LOCK_EX : LOCK_SH);
+	job->lines = history_read(job->table);
+	if (job->compact)
+		job->written = history_write(job->table);
+	if (lock >= 0)
+		close(lock);
+
+	g_idle_add(history_merge_cb, job);
+	return NULL;
+}
+
+static void
+history_start(gboolean compact)
+{
+	struct history_job *job;
+
+	if (history_busy)
+		return;
+	job = g_new0(struct history_job, 1);
+	job->table = history_new();
+	job->compact = compact;
+	history_busy = TRUE;
+	g_thread_unref(g_thread_new("history", history_worker, job));
+}
+
+static gboolean
+history_compact(gpointer data)
+{
+	history_start(TRUE);
+	return FALSE;
+}
+
+gboolean
+history_flush(gpointer data)
+{
+	gchar *file;
+	int lock, fd;
+
+	history_flush_id = 0;
+	if (! history_pending || ! history_pending->len)
+		return FALSE;
+
+	/* Not before the journal is read, nor while the worker has it, the
+	 * lines would count twice. At exit they are written anyway. */
+	if ((! history_loaded || history_busy) && ! data) {
+		history_flush_id = g_timeout_add_seconds(HISTORY_FLUSH,
+			history_flush, NULL);
+		return FALSE;
+	}
+
+	file = HISTORY_LOG;
+	lock = history_lock(LOCK_SH);
+	fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if (fd >= 0) {
+		if (write(fd, history_pending->str, history_pending->len) < 0)
+			g_warning("Can't write: %s", file);
+		close(fd);
+	}
+	if (lock >= 0)
+		close(lock);
+	g_free(file);
+
+	g_string_truncate(history_pending, 0);
+	if (! data
+			&& history_lines > 2 * g_hash_table_size(history) + HISTORY_STALE)
+		g_idle_add_full(G_PRIORITY_LOW, history_compact, NULL, NULL);
+	return FALSE;
+}
+
+static void
+history_log(const gchar *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	g_string_append_vprintf(history_pending, format, args);
+	va_end(args);
+	history_lines++;
+
+	if (! history_flush_id)
+		history_flush_id = g_timeout_add_seconds(HISTORY_FLUSH,
+			history_flush, NULL);
+}
+
+/* A committed main frame navigation */
+void
+history_visit(const gchar *url)
+{
+	gint64 now = g_get_real_time();
+
+	if (! history || ! url || ! g_str_has_prefix(url, "http"))
+		return;
+
+	history_visited(history_get(history, url), now / G_USEC_PER_SEC);
+	history_log("v\t%" G_GINT64_FORMAT "\t%s\n", now / G_USEC_PER_SEC, url);
+	completion_add(url, NULL, 1, now, FALSE);
+}
+
+void
+history_title(const gchar *url, const gchar *title)
+{
+	struct history_entry *he;
+	gchar *text;
+
+	if (! history || ! url || ! title
+			|| ! (he = g_hash_table_lookup(history, url))
+			|| ! g_strcmp0(he->title, title))
+		return;
+
+	text = g_strdelimit(g_strdup(title), "\t\r\n", ' ');
+	g_free(he->title);
+	he->title = text;
+	history_log("t\t%s\t%s\n", url, text);
+	completion_add(url, text, 0, 0, FALSE);
+}
+
+/* Back on the main loop: swap the index and offer it to the URL completion */
+gboolean
+history_merge_cb(gpointer data)
+{
+	struct history_job *job = data;
+	struct history_entry *he;
+	GHashTableIter iter;
+	gpointer url;
+
+	if (job->compact) {
+		if (job->written)
+			history_lines = g_hash_table_size(job->table);
+	} else {
+		history_lines += job->lines;
+		g_hash_table_iter_init(&iter, job->table);
+		while (g_hash_table_iter_next(&iter, &url, (gpointer *)&he))
+			completion_add(url, he->title, he->visits,
+				he->last * G_USEC_PER_SEC, FALSE);
+	}
+
+	/* Visits made meanwhile are pending, they are already offered */
+	history_replay(job->table);
+	g_hash_table_destroy(history);
+	history = job->table;
+	history_loaded = TRUE;
+	history_busy = FALSE;
+	g_free(job);
+
+	if (history_pending->len && ! history_flush_id)
+		history_flush_id = g_timeout_add_seconds(HISTORY_FLUSH,
+			history_flush, NULL);
+	return FALSE;
+}
+
+void
+history_open(void)
+{
+	history = history_new();
+	history_pending = g_string_new(NULL);
+	history_start(FALSE);
+}
+
@@ -0,0 +1,206 @@
+/*
+ * Single instance socket of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tazweb.h"
+
+/*
+ *
+ * Single instance
+ *
+ * The first TazWeb of a user listens on a Unix socket, TazWeb NG on one
+ * of its own. Next invocations connect, send "options TAB uri" lines and
+ * exit as soon as the running instance answers "ok", without initializing
+ * GTK or WebKit. Each line is opened by the front-end, the first one gets
+ * the focus.
+ * An instance that does not answer in time keeps its socket, the new
+ * one then runs on its own.
+ *
+ */
+
+#define INSTANCE_SOCKET(name)	g_strdup_printf("%s/%s.sock", \
+									g_get_user_runtime_dir(), name)
+#define INSTANCE_WAIT	2000
+#define INSTANCE_MAX	8192
+#define INSTANCE_DONE	1
+#define INSTANCE_NONE	0
+#define INSTANCE_BUSY	-1
+
+static int				instance_fd		= -1;
+static gchar			*instance_path;
+static dev_t			instance_dev;
+static ino_t			instance_ino;
+
+static void
+instance_address(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	g_strlcpy(addr->sun_path, instance_path, sizeof(addr->sun_path));
+}
+
+/* Read a request until the client shuts down its side, then answer */
+static gboolean
+instance_read_cb(GIOChannel *io, GIOCondition condition, GString *request)
+{
+	gchar buf[1024], **lines;
+	gssize len;
+	guint i;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(io);
+	len = read(fd, buf, sizeof(buf));
+	if (len < 0 && errno == EAGAIN)
+		return TRUE;
+	if (len > 0 && request->len + len <= INSTANCE_MAX) {
+		g_string_append_len(request, buf, len);
+		return TRUE;
+	}
+
+	if (len == 0) {
+		lines = g_strsplit(request->str, "\n", -1);
+		for (i = 0; lines[i]; i++)
+			instance_open(lines[i], i == 0);
+		g_strfreev(lines);
+		if (write(fd, "ok\n", 3) < 0)
+			g_warning("Can't answer: %s", instance_path);
+	}
+	close(fd);
+	g_string_free(request, TRUE);
+	return FALSE;
+}
+
+static gboolean
+instance_accept_cb(GIOChannel *io, GIOCondition condition, gpointer data)
+{
+	GIOChannel *client;
+	int fd;
+
+	if ((fd = accept(instance_fd, NULL, NULL)) < 0)
+		return TRUE;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	client = g_io_channel_unix_new(fd);
+	g_io_add_watch(client, G_IO_IN | G_IO_HUP | G_IO_ERR,
+		(GIOFunc)instance_read_cb, g_string_new(NULL));
+	g_io_channel_unref(client);
+	return TRUE;
+}
+
+/* Send a request to the running instance: INSTANCE_DONE once it is
+ * handled, INSTANCE_NONE when nobody listens, INSTANCE_BUSY when an
+ * instance is there but did not answer in time */
+static gint
+instance_send(const gchar *request)
+{
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	gchar reply[4];
+	gint state = INSTANCE_BUSY;
+	gssize len = strlen(request);
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return INSTANCE_BUSY;
+
+	instance_address(&addr);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		if (errno == ECONNREFUSED || errno == ENOENT)
+			state = INSTANCE_NONE;
+	} else if (write(fd, request, len) == len
+			&& shutdown(fd, SHUT_WR) == 0) {
+		/* A hung instance does not keep us waiting */
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, INSTANCE_WAIT) > 0
+				&& read(fd, reply, sizeof(reply)) >= 2
+				&& strncmp(reply, "ok", 2) == 0)
+			state = INSTANCE_DONE;
+	}
+	close(fd);
+	return state;
+}
+
+/* Become the running instance */
+static void
+instance_listen(void)
+{
+	struct sockaddr_un addr;
+	GStatBuf st;
+	GIOChannel *io;
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return;
+
+	/* Connection refused: the socket is stale */
+	instance_address(&addr);
+	unlink(instance_path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+			|| listen(fd, 8) < 0 || g_stat(instance_path, &st) < 0) {
+		close(fd);
+		return;
+	}
+	g_chmod(instance_path, 0600);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	instance_fd = fd;
+	instance_dev = st.st_dev;
+	instance_ino = st.st_ino;
+
+	io = g_io_channel_unix_new(fd);
+	g_io_add_watch(io, G_IO_IN, instance_accept_cb, NULL);
+	g_io_channel_unref(io);
+}
+
+/* Hand the request over to a running instance or become the running one.
+ * The check and the bind are done under a lock so two TazWeb started
+ * at once do not both listen. */
+gboolean
+instance_handoff(const gchar *name, const gchar *request)
+{
+	gchar *file;
+	gboolean done;
+	gint state;
+	int lock;
+
+	instance_path = INSTANCE_SOCKET(name);
+	file = g_strdup_printf("%s.lock", instance_path);
+	lock = open(file, O_RDWR | O_CREAT, 0600);
+	g_free(file);
+	if (lock >= 0)
+		flock(lock, LOCK_EX);
+
+	/* A busy instance keeps its socket, this one runs on its own */
+	state = instance_send(request);
+	if (state == INSTANCE_NONE)
+		instance_listen();
+	done = state == INSTANCE_DONE;
+
+	if (lock >= 0)
+		close(lock);
+	return done;
+}
+
+void
+instance_close(void)
+{
+	GStatBuf st;
+
+	if (instance_fd < 0)
+		return;
+	close(instance_fd);
+	/* A newer instance may have taken the path over */
+	if (g_stat(instance_path, &st) == 0 && st.st_dev == instance_dev
+			&& st.st_ino == instance_ino)
+		unlink(instance_path);
+	instance_fd = -1;
+}
+
@@ -0,0 +1,144 @@
+/*
+ * Webview pool of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Webview pool
+ *
+ * A few webviews with TazWeb settings are built at idle time, so a new
+ * window or tab takes one at once instead of building it on the click
+ * path. Pooled webviews are dropped when the system runs low on memory
+ * or the process is over its memory budget.
+ *
+ */
+
+#define POOL_SIZE		1
+#define POOL_LOWMEM		(64 * 1024)
+
+GQueue					pool			= G_QUEUE_INIT;
+gint					pool_size		= POOL_SIZE;
+static guint			pool_fill_id;
+
+/* Memory budget of the process in MB, 0 is off */
+gint				memory_budget;
+
+/* Available system memory in KB, -1 if unknown */
+glong
+memory_available(void)
+{
+	gchar line[128];
+	glong avail = -1;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/meminfo", "r"))) {
+		while (fgets(line, sizeof(line), fp))
+			if (sscanf(line, "MemAvailable: %ld", &avail) == 1)
+				break;
+		fclose(fp);
+	}
+	return avail;
+}
+
+/* Resident memory of the process in MB */
+glong
+memory_rss(void)
+{
+	glong size, rss = 0;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(fp, "%ld %ld", &size, &rss) != 2)
+			rss = 0;
+		fclose(fp);
+	}
+	return rss * (sysconf(_SC_PAGESIZE) / 1024) / 1024;
+}
+
+static gboolean
+pool_tight(void)
+{
+	glong avail = memory_available();
+
+	if (memory_budget > 0 && memory_rss() > memory_budget)
+		return TRUE;
+	return avail >= 0 && avail < POOL_LOWMEM;
+}
+
+/* A new webview with TazWeb settings, owned by the caller */
+WebKitWebView*
+webview_new(void)
+{
+	WebKitWebView *view;
+	WebKitWebSettings *settings;
+
+	view = WEBKIT_WEB_VIEW(webkit_web_view_new());
+	g_object_ref_sink(view);
+
+	/* Webkit settings */
+	settings = webkit_web_view_get_settings(view);
+	if (! useragent)
+		useragent = g_strdup_printf("%s", UA);
+	g_object_set(G_OBJECT(settings), "user-agent", useragent, NULL);
+	config_settings(settings);
+
+	if (private)
+		g_object_set(G_OBJECT(settings), "enable-private-browsing", TRUE,
+			NULL);
+	return view;
+}
+
+/* One webview per idle call so the main loop stays responsive */
+static gboolean
+pool_fill_cb(gpointer data)
+{
+	if (g_queue_get_length(&pool) < pool_size && ! pool_tight()) {
+		g_queue_push_tail(&pool, webview_new());
+		if (g_queue_get_length(&pool) < pool_size)
+			return TRUE;
+	}
+	pool_fill_id = 0;
+	return FALSE;
+}
+
+void
+pool_fill(void)
+{
+	if (pool_size > 0 && ! pool_fill_id)
+		pool_fill_id = g_idle_add_full(G_PRIORITY_LOW, pool_fill_cb,
+			NULL, NULL);
+}
+
+/* Drop pooled webviews when memory is tight */
+gboolean
+pool_check_cb(gpointer data)
+{
+	WebKitWebView *view;
+
+	if (pool_tight()) {
+		while ((view = g_queue_pop_head(&pool))) {
+			gtk_widget_destroy(GTK_WIDGET(view));
+			g_object_unref(view);
+		}
+	}
+	return TRUE;
+}
+
+/* Take a ready webview or build one, the caller owns a reference */
+WebKitWebView*
+pool_take(void)
+{
+	WebKitWebView *view;
+
+	if (! (view = g_queue_pop_head(&pool)))
+		view = webview_new();
+	pool_fill();
+	return view;
+}
+
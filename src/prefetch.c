@@ -0,0 +1,222 @@
+/*
+ * DNS prefetch of the hosts TazWeb is about to load.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * DNS prefetch
+ *
+ * While a url is typed the host of its best completion, a visited or
+ * bookmarked url, is resolved in the background, never the typed text
+ * itself. So is the search engine while a search is typed, and the most
+ * bookmarked hosts at startup. Nothing is sent to the hosts: a request
+ * made ahead would carry cookies and skip the filter and site rules.
+ * A typed url or search loading a host resolved in the last minute
+ * counts as a hit.
+ * Hosts are forgotten after PREFETCH_TTL, at most PREFETCH_HOSTS are
+ * known at a time.
+ *
+ */
+
+#define PREFETCH_DELAY	150
+#define PREFETCH_TTL	60
+#define PREFETCH_TOP	4
+#define PREFETCH_HOSTS	64
+
+struct prefetch {
+	gint64			dns;
+};
+
+static GHashTable		*prefetch_hosts;
+static guint			prefetch_id;
+static gchar			*prefetch_text;
+guint					prefetch_dns;
+guint					prefetch_hits;
+static guint			prefetch_misses;
+
+/* Host of an http url or of what is being typed, NULL if unlikely */
+static SoupURI*
+prefetch_parse(const gchar *text)
+{
+	SoupURI *suri;
+	gchar *url;
+
+	url = g_strrstr(text, "://") ? g_strdup(text)
+		: g_strdup_printf("http://%s", text);
+	suri = soup_uri_new(url);
+	g_free(url);
+
+	if (suri && suri->host && strchr(suri->host, '.')
+			&& (suri->scheme == SOUP_URI_SCHEME_HTTP
+			|| suri->scheme == SOUP_URI_SCHEME_HTTPS))
+		return suri;
+	if (suri)
+		soup_uri_free(suri);
+	return NULL;
+}
+
+static gboolean
+prefetch_fresh(gint64 time)
+{
+	return time && g_get_monotonic_time() - time
+		< PREFETCH_TTL * G_USEC_PER_SEC;
+}
+
+static gboolean
+prefetch_stale(gpointer host, gpointer value, gpointer data)
+{
+	struct prefetch *pf = value;
+
+	return ! prefetch_fresh(pf->dns);
+}
+
+/* Resolve the host */
+static void
+prefetch_uri(const gchar *text)
+{
+	struct prefetch *pf;
+	SoupURI *suri;
+
+	if (private || ! session || ! (suri = prefetch_parse(text)))
+		return;
+
+	if (! prefetch_hosts)
+		prefetch_hosts = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	if (! (pf = g_hash_table_lookup(prefetch_hosts, suri->host))) {
+		if (g_hash_table_size(prefetch_hosts) >= PREFETCH_HOSTS)
+			g_hash_table_foreach_remove(prefetch_hosts, prefetch_stale,
+				NULL);
+		if (g_hash_table_size(prefetch_hosts) >= PREFETCH_HOSTS) {
+			soup_uri_free(suri);
+			return;
+		}
+		pf = g_new0(struct prefetch, 1);
+		g_hash_table_insert(prefetch_hosts, g_strdup(suri->host), pf);
+	}
+
+	if (! prefetch_fresh(pf->dns)) {
+		pf->dns = g_get_monotonic_time();
+		soup_session_prefetch_dns(session, suri->host, NULL, NULL, NULL);
+		prefetch_dns++;
+	}
+	soup_uri_free(suri);
+}
+
+/* A typed load: was its host prepared? */
+void
+prefetch_count(const gchar *text)
+{
+	struct prefetch *pf = NULL;
+	SoupURI *suri;
+
+	if (! (suri = prefetch_parse(text)))
+		return;
+	if (prefetch_hosts)
+		pf = g_hash_table_lookup(prefetch_hosts, suri->host);
+	if (pf && prefetch_fresh(pf->dns))
+		prefetch_hits++;
+	else
+		prefetch_misses++;
+	soup_uri_free(suri);
+}
+
+/* The url the typed text will most likely complete to */
+static gboolean
+prefetch_typed_cb(gpointer data)
+{
+	const gchar *url;
+
+	prefetch_id = 0;
+	if ((url = completion_best(prefetch_text)))
+		prefetch_uri(url);
+	return FALSE;
+}
+
+/* URL entry "changed", only while the user types in it */
+void
+prefetch_entry_cb(GtkWidget *entry, gpointer data)
+{
+	if (! gtk_widget_has_focus(entry))
+		return;
+
+	g_free(prefetch_text);
+	prefetch_text = g_strdup(gtk_entry_get_text(GTK_ENTRY(entry)));
+	if (prefetch_id)
+		g_source_remove(prefetch_id);
+	prefetch_id = g_timeout_add(PREFETCH_DELAY, prefetch_typed_cb, NULL);
+}
+
+/* Search entry "changed": the search engine is about to be used */
+void
+prefetch_search_cb(GtkWidget *entry, gpointer data)
+{
+	gchar *url;
+
+	if (! gtk_widget_has_focus(entry))
+		return;
+
+	url = g_strdup_printf(SEARCH, "");
+	prefetch_uri(url);
+	g_free(url);
+}
+
+static gint
+prefetch_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+	return GPOINTER_TO_INT(g_hash_table_lookup(data, *(gchar**)b))
+		- GPOINTER_TO_INT(g_hash_table_lookup(data, *(gchar**)a));
+}
+
+/* Resolve ahead the hosts with the most bookmarks */
+gboolean
+prefetch_bookmarks_cb(gpointer data)
+{
+	struct bookmark *bm;
+	GHashTable *counts;
+	GPtrArray *urls;
+	SoupURI *suri;
+	gchar *root;
+	guint i;
+
+	bookmarks_load();
+	counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	urls = g_ptr_array_new_with_free_func(g_free);
+	for (i = 0; i < bookmarks->len; i++) {
+		bm = g_ptr_array_index(bookmarks, i);
+		if (! (suri = prefetch_parse(bm->url)))
+			continue;
+		root = g_strdup_printf("%s://%s:%u/", suri->scheme, suri->host,
+			suri->port);
+		if (! g_hash_table_lookup(counts, root))
+			g_ptr_array_add(urls, g_strdup(root));
+		g_hash_table_replace(counts, root, GINT_TO_POINTER(
+			GPOINTER_TO_INT(g_hash_table_lookup(counts, root)) + 1));
+		soup_uri_free(suri);
+	}
+
+	g_ptr_array_sort_with_data(urls, prefetch_compare, counts);
+	for (i = 0; i < urls->len && i < PREFETCH_TOP; i++)
+		prefetch_uri(g_ptr_array_index(urls, i));
+
+	g_ptr_array_free(urls, TRUE);
+	g_hash_table_destroy(counts);
+	return FALSE;
+}
+
+/* Hit rate of the session, with G_MESSAGES_DEBUG=all */
+void
+prefetch_report(void)
+{
+	guint loads = prefetch_hits + prefetch_misses;
+
+	g_debug("Prefetch: %u dns, %u/%u typed loads hit (%u%%)", prefetch_dns,
+		prefetch_hits, loads, loads ? prefetch_hits * 100 / loads : 0);
+}
+
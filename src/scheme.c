@@ -0,0 +1,273 @@
+/*
+ * Internal tazweb: pages of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Internal pages
+ *
+ * The tazweb: scheme serves pages built in memory: home, bookmarks,
+ * cookies, doc and stats. A main frame navigation to the scheme is
+ * ignored by the policy hook and the page is loaded as a string with
+ * its tazweb: uri as base, so it keeps its place in the history and is
+ * rebuilt on reload. Subresources, like the style sheet, are rewritten
+ * to data: uris when their request starts. The style and the manual are
+ * compiled in from doc/ by lib/assets.sh: no fork, no file is read.
+ * Only the user opens them: loads made by scheme_load(), back/forward,
+ * reload and links of an internal page. A web page can't navigate to
+ * them nor frame them.
+ *
+ */
+
+#define SCHEME_BOOKMARKS	16
+
+struct asset {
+	const gchar		*name;
+	const gchar		*mime;
+	const gchar		*data;
+	gsize			length;
+};
+
+/* Generated by make from the files of doc/ */
+#include "assets.h"
+
+static const struct asset*
+scheme_asset(const gchar *name)
+{
+	const struct asset *a;
+
+	for (a = assets; a->name; a++)
+		if (! strcmp(a->name, name))
+			return a;
+	return NULL;
+}
+
+/* Manual in the first language of the locale we have, else English */
+static gchar*
+scheme_doc(void)
+{
+	const gchar * const *langs;
+	const struct asset *a = NULL;
+	gchar *name;
+	guint i;
+
+	langs = g_get_language_names();
+	for (i = 0; langs[i] && ! a; i++) {
+		name = g_strdup_printf("tazweb.%s.html", langs[i]);
+		a = scheme_asset(name);
+		g_free(name);
+	}
+	if (! a)
+		a = scheme_asset("tazweb.en.html");
+	return a ? g_strndup(a->data, a->length) : NULL;
+}
+
+/* Start page: a search form, the first bookmarks and the other pages */
+static gchar*
+scheme_home(void)
+{
+	struct bookmark *bm;
+	GString *string;
+	gchar *title, *url, *counter;
+	guint i;
+
+	bookmarks_load();
+	string = g_string_new(NULL);
+	html_header(string, "TazWeb");
+	g_string_append_printf(string, "<form action=\"%ssearch\">\n"
+		"\t<input type=\"search\" name=\"q\" placeholder=\"%s\" autofocus>\n"
+		"</form>\n<ul id=\"bookmarks\">\n", SCHEME, _("Search the web"));
+
+	for (i = 0; i < bookmarks->len && i < SCHEME_BOOKMARKS; i++) {
+		bm = g_ptr_array_index(bookmarks, i);
+		title = g_markup_escape_text(bm->title, -1);
+		url = g_markup_escape_text(bm->url, -1);
+		g_string_append_printf(string,
+			"<li><a href=\"%s\">%s</a></li>\n", url, title);
+		g_free(title);
+		g_free(url);
+	}
+	g_string_append_printf(string, "</ul>\n<p>\n"
+		"\t<a href=\"%sbookmarks\">%s</a> -\n"
+		"\t<a href=\"%scookies\">%s</a> -\n"
+		"\t<a href=\"%sdoc\">%s</a>\n</p>\n",
+		SCHEME, _("Bookmarks"), SCHEME, _("Cookies"),
+		SCHEME, _("Documentation"));
+
+	counter = g_strdup_printf("TazWeb %s", tazweb_version);
+	html_footer(string, counter);
+	g_free(counter);
+	return g_string_free(string, FALSE);
+}
+
+static const struct {
+	const gchar		*name;
+	gchar			*(*html)(void);
+} scheme_pages[] = {
+	{ "home",		scheme_home },
+	{ "bookmarks",	bookmarks_html },
+	{ "cookies",	cookies_html },
+	{ "doc",		scheme_doc },
+	{ "stats",		stats_html },
+	{ NULL,			NULL }
+};
+
+/* Page name of a tazweb: uri: what comes before the path or query */
+static gchar*
+scheme_page(const gchar *uri)
+{
+	return g_strndup(uri + strlen(SCHEME),
+		strcspn(uri + strlen(SCHEME), "/?#"));
+}
+
+/* Web search of the home page form: tazweb://search?q=... */
+static gchar*
+scheme_search(const gchar *uri)
+{
+	GHashTable *form;
+	const gchar *query;
+	gchar *text, *search = NULL;
+
+	query = strchr(uri, '?');
+	if (! query)
+		return NULL;
+	form = soup_form_decode(query + 1);
+	text = g_hash_table_lookup(form, "q");
+	if (text && *text) {
+		text = g_uri_escape_string(text, NULL, TRUE);
+		search = g_strdup_printf(SEARCH, text);
+		g_free(text);
+	}
+	g_hash_table_destroy(form);
+	return search;
+}
+
+/* Serve tazweb: navigations, the load we start is marked on the frame */
+static gboolean		scheme_user;
+
+/* A load asked by the user, the only one to open an internal page. The
+ * policy is decided within webkit_web_view_load_uri() */
+void
+scheme_load(WebKitWebView *webview, const gchar *uri)
+{
+	scheme_user = TRUE;
+	webkit_web_view_load_uri(webview, uri);
+	scheme_user = FALSE;
+}
+
+/* Navigations of a web page are not, nor frames, nor redirects */
+static gboolean
+scheme_allowed(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebNavigationAction *action)
+{
+	const gchar *current;
+
+	if (frame != webkit_web_view_get_main_frame(webview))
+		return FALSE;
+	if (scheme_user)
+		return TRUE;
+	switch (webkit_web_navigation_action_get_reason(action)) {
+		case WEBKIT_WEB_NAVIGATION_REASON_BACK_FORWARD:
+		case WEBKIT_WEB_NAVIGATION_REASON_RELOAD:
+			return TRUE;
+		case WEBKIT_WEB_NAVIGATION_REASON_LINK_CLICKED:
+		case WEBKIT_WEB_NAVIGATION_REASON_FORM_SUBMITTED:
+			current = webkit_web_frame_get_uri(frame);
+			return current && g_str_has_prefix(current, SCHEME);
+		default:
+			return FALSE;
+	}
+}
+
+static gboolean
+scheme_navigation_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitNetworkRequest *request, WebKitWebNavigationAction *action,
+		WebKitWebPolicyDecision *decision, gpointer data)
+{
+	const gchar *uri, *serving;
+	gchar *name, *html = NULL;
+	guint i;
+
+	uri = webkit_network_request_get_uri(request);
+	if (! g_str_has_prefix(uri, SCHEME))
+		return FALSE;
+
+	name = scheme_page(uri);
+	serving = g_object_get_data(G_OBJECT(frame), "scheme-serving");
+	if (serving && ! strcmp(serving, name)) {
+		g_object_set_data(G_OBJECT(frame), "scheme-serving", NULL);
+		g_free(name);
+		return FALSE;
+	}
+
+	if (! scheme_allowed(webview, frame, action)) {
+		g_warning("Refused: %s", uri);
+		webkit_web_policy_decision_ignore(decision);
+		g_free(name);
+		return TRUE;
+	}
+
+	if (! strcmp(name, "search")) {
+		html = scheme_search(uri);
+		webkit_web_policy_decision_ignore(decision);
+		if (html)
+			webkit_web_frame_load_uri(frame, html);
+		g_free(html);
+		g_free(name);
+		return TRUE;
+	}
+
+	for (i = 0; scheme_pages[i].name; i++)
+		if (! strcmp(scheme_pages[i].name, name))
+			html = scheme_pages[i].html();
+	if (! html) {
+		g_free(name);
+		return FALSE;
+	}
+
+	webkit_web_policy_decision_ignore(decision);
+	g_object_set_data_full(G_OBJECT(frame), "scheme-serving", name, g_free);
+	webkit_web_frame_load_string(frame, html, "text/html", "UTF-8", uri);
+	g_free(html);
+	return TRUE;
+}
+
+/* Subresources of internal pages are the compiled in assets */
+static void
+scheme_request_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitWebResource *resource, WebKitNetworkRequest *request,
+		WebKitNetworkResponse *response, gpointer data)
+{
+	const struct asset *a;
+	const gchar *uri;
+	gchar *base64, *url;
+
+	uri = webkit_network_request_get_uri(request);
+	if (! g_str_has_prefix(uri, SCHEME))
+		return;
+	a = scheme_asset(strrchr(uri, '/') + 1);
+	if (! a)
+		return;
+
+	base64 = g_base64_encode((const guchar*)a->data, a->length);
+	url = g_strdup_printf("data:%s;base64,%s", a->mime, base64);
+	webkit_network_request_set_uri(request, url);
+	g_free(base64);
+	g_free(url);
+}
+
+void
+scheme_attach(WebKitWebView *webview)
+{
+	g_signal_connect(webview, "navigation-policy-decision-requested",
+		G_CALLBACK(scheme_navigation_cb), NULL);
+	g_signal_connect(webview, "resource-request-starting",
+		G_CALLBACK(scheme_request_cb), NULL);
+}
+
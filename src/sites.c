@@ -0,0 +1,385 @@
+/*
+ * Per-site settings of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Site settings
+ *
+ * ~/.config/tazweb/sites.conf gives settings by host, one rule a line:
+ *
+ *   # host              settings
+ *   news.example.com    images=false
+ *   intranet.lan        scripts=false plugins=false
+ *   example.org         useragent=Mozilla/5.0 (X11; Linux x86_64)
+ *
+ * A rule applies to the host and its subdomains, the closest one wins
+ * and * is for all other hosts. Keys are scripts, images and plugins,
+ * true or false, and useragent which takes the rest of the line. Rules
+ * are compiled to sites.bin in the cache directory, mapped as is and
+ * checked against sites.conf like filters.bin: a hashed set of hosts to
+ * fixed size rules. Before each main frame navigation the rule of the
+ * host is applied to the settings of the webview, what it leaves is set
+ * back as it was.
+ *
+ */
+
+#define SITE_CONF		g_strdup_printf("%s/sites.conf", CONFIG)
+#define SITE_CACHE		g_strdup_printf("%s/sites.bin", CACHE_DIR)
+#define SITE_MAGIC		0x5357545a
+#define SITE_VERSION	2
+
+/* sites.bin: header, source, slots of rule index + 1, rules, then the
+ * string pool. Hosts are pool offsets, user agents offsets + 1 */
+struct site_header {
+	guint32			magic;
+	guint32			version;
+	guint32			sources;
+	guint32			slots;
+	guint32			rules;
+	guint32			pool;
+};
+
+/* A setting is -1 when the rule leaves it */
+struct site_rule {
+	guint32			host;
+	guint32			useragent;
+	gint8			scripts;
+	gint8			images;
+	gint8			plugins;
+	gint8			pad;
+};
+
+/* Settings of a webview without rule and the rule applied */
+struct site_base {
+	gboolean		scripts;
+	gboolean		images;
+	gboolean		plugins;
+	gchar			*useragent;
+	const struct site_rule *rule;
+};
+
+static const struct site_header	*site;
+static const guint32	*site_slots;
+static const struct site_rule	*site_rules;
+static const gchar		*site_pool;
+
+static gint
+site_bool(const gchar *value)
+{
+	if (! strcmp(value, "true") || ! strcmp(value, "1"))
+		return 1;
+	if (! strcmp(value, "false") || ! strcmp(value, "0"))
+		return 0;
+	return -1;
+}
+
+/* A rule line: the host, lower case, and its settings */
+static gchar*
+site_parse(gchar *line, struct site_rule *rule, gchar **useragent)
+{
+	gchar *host, *p, *key, *value;
+
+	line = g_strstrip(line);
+	if (! *line || *line == '#')
+		return NULL;
+
+	p = line + strcspn(line, " \t");
+	key = line + strspn(line, "*.");
+	host = g_ascii_strdown(p > key ? key : line, p > key ? p - key : p - line);
+	rule->scripts = rule->images = rule->plugins = -1;
+	*useragent = NULL;
+
+	for (p += strspn(p, " \t"); *p; p += strspn(p, " \t")) {
+		if (g_str_has_prefix(p, "useragent=")) {
+			*useragent = g_strdup(p + strlen("useragent="));
+			break;
+		}
+		key = p;
+		p += strcspn(p, " \t");
+		if (*p)
+			*p++ = '\0';
+		if (! (value = strchr(key, '=')))
+			continue;
+		*value++ = '\0';
+		if (! strcmp(key, "scripts"))
+			rule->scripts = site_bool(value);
+		else if (! strcmp(key, "images"))
+			rule->images = site_bool(value);
+		else if (! strcmp(key, "plugins"))
+			rule->plugins = site_bool(value);
+		else
+			g_warning("Unknown site setting: %s", key);
+	}
+	return host;
+}
+
+/* Parse sites.conf and write sites.bin, the last rule of a host wins */
+static gboolean
+site_compile(const gchar *cache, GString *sources, const gchar *conf)
+{
+	struct site_header header = { 0 };
+	struct site_rule rule, *r;
+	GHashTable *hosts;
+	GArray *rules;
+	GString *out, *pool;
+	gchar *data, **lines, *host, *useragent;
+	guint32 *slots, i, j;
+	gpointer index;
+	gboolean done;
+
+	if (! g_file_get_contents(conf, &data, NULL, NULL))
+		return FALSE;
+	hosts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	rules = g_array_new(FALSE, FALSE, sizeof(struct site_rule));
+	pool = g_string_new(NULL);
+	lines = g_strsplit(data, "\n", -1);
+	for (i = 0; lines[i]; i++) {
+		if (! (host = site_parse(lines[i], &rule, &useragent)))
+			continue;
+		rule.pad = 0;
+		rule.useragent = 0;
+		if (useragent) {
+			rule.useragent = pool->len + 1;
+			g_string_append_len(pool, useragent, strlen(useragent) + 1);
+		}
+		if (g_hash_table_lookup_extended(hosts, host, NULL, &index)) {
+			r = &g_array_index(rules, struct site_rule, GPOINTER_TO_UINT(index));
+			rule.host = r->host;
+			*r = rule;
+		} else {
+			rule.host = pool->len;
+			g_string_append_len(pool, host, strlen(host) + 1);
+			g_hash_table_insert(hosts, host, GUINT_TO_POINTER(rules->len));
+			g_array_append_val(rules, rule);
+			host = NULL;
+		}
+		g_free(useragent);
+		g_free(host);
+	}
+	g_strfreev(lines);
+	g_free(data);
+	g_hash_table_destroy(hosts);
+
+	header.magic = SITE_MAGIC;
+	header.version = SITE_VERSION;
+	header.sources = sources->len;
+	header.slots = filter_pow2(rules->len * 2);
+	header.rules = rules->len;
+	header.pool = pool->len;
+
+	slots = g_new0(guint32, header.slots);
+	for (i = 0; i < rules->len; i++) {
+		host = pool->str + g_array_index(rules, struct site_rule, i).host;
+		for (j = filter_hash(host, strlen(host)) & (header.slots - 1);
+				slots[j]; j = (j + 1) & (header.slots - 1));
+		slots[j] = i + 1;
+	}
+
+	out = g_string_new(NULL);
+	g_string_append_len(out, (gchar *)&header, sizeof(header));
+	g_string_append_len(out, sources->str, sources->len);
+	g_string_append_len(out, (gchar *)slots, header.slots * sizeof(guint32));
+	g_string_append_len(out, rules->data,
+		rules->len * sizeof(struct site_rule));
+	g_string_append_len(out, pool->str, pool->len);
+	done = g_file_set_contents(cache, out->str, out->len, NULL);
+	if (! done)
+		g_warning("Can't write: %s", cache);
+
+	g_free(slots);
+	g_array_free(rules, TRUE);
+	g_string_free(pool, TRUE);
+	g_string_free(out, TRUE);
+	return done;
+}
+
+/* Map sites.bin, NULL if it is not there or not valid */
+static const struct site_header*
+site_map(const gchar *cache, GString *sources)
+{
+	const struct site_header *header;
+	struct stat st;
+	gsize size;
+	void *map;
+	int fd;
+
+	if ((fd = open(cache, O_RDONLY | O_CLOEXEC)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (gsize)st.st_size < sizeof(*header)
+			|| (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))
+				== MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	header = map;
+	size = sizeof(*header) + header->sources
+		+ (gsize)header->slots * sizeof(guint32)
+		+ (gsize)header->rules * sizeof(struct site_rule) + header->pool;
+	if (header->magic != SITE_MAGIC || header->version != SITE_VERSION
+			|| size != (gsize)st.st_size
+			|| ! header->slots || header->slots & (header->slots - 1)
+			|| header->sources != sources->len
+			|| memcmp(header + 1, sources->str, sources->len)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	return header;
+}
+
+/* Rules are compiled again only when sites.conf changed */
+void
+site_load(void)
+{
+	GStatBuf st;
+	GString *sources;
+	gchar *conf, *cache, *dir;
+
+	conf = SITE_CONF;
+	if (g_stat(conf, &st) < 0) {
+		g_free(conf);
+		return;
+	}
+
+	sources = g_string_new(NULL);
+	filter_source(sources, conf, &st);
+	filter_pad(sources);
+	cache = SITE_CACHE;
+	if (! (site = site_map(cache, sources))) {
+		dir = CACHE_DIR;
+		g_mkdir_with_parents(dir, 0700);
+		if (site_compile(cache, sources, conf))
+			site = site_map(cache, sources);
+		g_free(dir);
+	}
+	if (site) {
+		site_slots = (const guint32 *)((const gchar *)(site + 1)
+			+ site->sources);
+		site_rules = (const struct site_rule *)(site_slots + site->slots);
+		site_pool = (const gchar *)(site_rules + site->rules);
+	}
+	g_string_free(sources, TRUE);
+	g_free(cache);
+	g_free(conf);
+}
+
+static const struct site_rule*
+site_find(const gchar *name, gsize length)
+{
+	const struct site_rule *rule;
+	guint32 i, slot, mask = site->slots - 1;
+
+	for (i = filter_hash(name, length) & mask; (slot = site_slots[i]);
+			i = (i + 1) & mask) {
+		rule = &site_rules[slot - 1];
+		if (! strncmp(site_pool + rule->host, name, length)
+				&& ! site_pool[rule->host + length])
+			return rule;
+	}
+	return NULL;
+}
+
+/* Rule of the host or of its closest parent, else the * rule */
+static const struct site_rule*
+site_lookup(const gchar *host)
+{
+	const struct site_rule *rule;
+	gsize n = strlen(host);
+
+	while (n) {
+		if ((rule = site_find(host, n)))
+			return rule;
+		while (n && *host != '.')
+			host++, n--;
+		if (n)
+			host++, n--;
+	}
+	return site_find("*", 1);
+}
+
+/* Settings of the rule, the webview ones for what it leaves */
+static void
+site_apply(WebKitWebView *webview, struct site_base *base,
+		const struct site_rule *rule)
+{
+	WebKitWebSettings *settings;
+
+	settings = webkit_web_view_get_settings(webview);
+	g_object_set(G_OBJECT(settings),
+		"enable-scripts", rule && rule->scripts >= 0 ?
+			(gboolean)rule->scripts : base->scripts,
+		"auto-load-images", rule && rule->images >= 0 ?
+			(gboolean)rule->images : base->images,
+		"enable-plugins", rule && rule->plugins >= 0 ?
+			(gboolean)rule->plugins : base->plugins,
+		"user-agent", rule && rule->useragent ?
+			site_pool + rule->useragent - 1 : base->useragent,
+		NULL);
+	base->rule = rule;
+}
+
+/* Main frame navigation: settings are set before the page is loaded */
+static gboolean
+site_navigation_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		WebKitNetworkRequest *request, WebKitWebNavigationAction *action,
+		WebKitWebPolicyDecision *decision, struct site_base *base)
+{
+	const struct site_rule *rule = NULL;
+	SoupURI *suri;
+	gchar *host;
+
+	if (frame != webkit_web_view_get_main_frame(webview))
+		return FALSE;
+
+	/* Rules are for web sites, not for local or internal pages */
+	suri = soup_uri_new(webkit_network_request_get_uri(request));
+	if (suri && suri->host && *suri->host
+			&& (suri->scheme == SOUP_URI_SCHEME_HTTP
+			|| suri->scheme == SOUP_URI_SCHEME_HTTPS)) {
+		host = g_ascii_strdown(suri->host, -1);
+		rule = site_lookup(host);
+		g_free(host);
+	}
+	if (suri)
+		soup_uri_free(suri);
+
+	/* Most navigations stay on the same site */
+	if (rule != base->rule)
+		site_apply(webview, base, rule);
+	return FALSE;
+}
+
+static void
+site_base_free(struct site_base *base)
+{
+	g_free(base->useragent);
+	g_free(base);
+}
+
+void
+site_attach(WebKitWebView *webview)
+{
+	WebKitWebSettings *settings;
+	struct site_base *base;
+
+	if (! site)
+		return;
+	base = g_new0(struct site_base, 1);
+	settings = webkit_web_view_get_settings(webview);
+	g_object_get(G_OBJECT(settings), "enable-scripts", &base->scripts,
+		"auto-load-images", &base->images, "enable-plugins", &base->plugins,
+		"user-agent", &base->useragent, NULL);
+	g_object_set_data_full(G_OBJECT(webview), "site-base", base,
+		(GDestroyNotify)site_base_free);
+	g_signal_connect(webview, "navigation-policy-decision-requested",
+		G_CALLBACK(site_navigation_cb), base);
+}
+
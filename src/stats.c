@@ -0,0 +1,167 @@
+/*
+ * Memory and resource statistics of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include "tazweb.h"
+
+/*
+ *
+ * Statistics
+ *
+ * Memory and resource counters of the process: RSS and PSS from /proc,
+ * disk cache usage, cookies and the history, prefetch and filter
+ * counters, then the counters of the front-end: windows and downloads,
+ * or tabs, renderers and throttling. With --stats file a sample is
+ * appended as a JSON line every STATS_INTERVAL seconds, the
+ * tazweb://stats page shows one. A sample reads a few small /proc files
+ * and stats the cache files, it is cheap enough to be left on.
+ *
+ */
+
+#define STATS_MAX		32
+
+static const gchar		*stats_names[] = {
+	"rss_kb", "pss_kb", "cache_kb", "cookies", "history", "prefetch_dns",
+	"prefetch_hits", "blocked", NULL
+};
+
+gchar					*stats_file;
+
+/* A "Name: value kB" line of a /proc file, -1 if not there */
+static glong
+stats_proc(const gchar *file, const gchar *name)
+{
+	gchar line[256];
+	glong value = -1;
+	gsize length = strlen(name);
+	FILE *fp;
+
+	if (! (fp = fopen(file, "r")))
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (! strncmp(line, name, length) && line[length] == ':') {
+			value = atol(line + length + 1);
+			break;
+		}
+	}
+	fclose(fp);
+	return value;
+}
+
+/* Disk cache usage in kB, SoupCache files are in a single directory */
+static gint64
+stats_cache(void)
+{
+	GStatBuf st;
+	const gchar *name;
+	gint64 size = 0;
+	gchar *file;
+	GDir *dir;
+
+	if (! cache_path || ! (dir = g_dir_open(cache_path, 0, NULL)))
+		return 0;
+	while ((name = g_dir_read_name(dir))) {
+		file = g_build_filename(cache_path, name, NULL);
+		if (g_stat(file, &st) == 0)
+			size += (gint64)st.st_blocks * 512;
+		g_free(file);
+	}
+	g_dir_close(dir);
+	return size / 1024;
+}
+
+static gint64
+stats_cookies(void)
+{
+	GSList *list;
+	gint64 n;
+
+	if (! cookiejar)
+		return 0;
+	list = soup_cookie_jar_all_cookies(cookiejar);
+	n = g_slist_length(list);
+	g_slist_free_full(list, (GDestroyNotify)soup_cookie_free);
+	return n;
+}
+
+/* Name of a value, those of the front-end come last */
+static const gchar*
+stats_name(guint i)
+{
+	guint n = G_N_ELEMENTS(stats_names) - 1;
+
+	return i < n ? stats_names[i] : stats_front_names[i - n];
+}
+
+/* Values in the order of stats_name() */
+static void
+stats_sample(gint64 *values)
+{
+	gint64 *v = values;
+
+	*v++ = stats_proc("/proc/self/status", "VmRSS");
+	*v++ = stats_proc("/proc/self/smaps_rollup", "Pss");
+	*v++ = stats_cache();
+	*v++ = stats_cookies();
+	*v++ = history ? g_hash_table_size(history) : 0;
+	*v++ = prefetch_dns;
+	*v++ = prefetch_hits;
+	*v++ = filter_blocked;
+	stats_front_sample(v);
+}
+
+gboolean
+stats_write_cb(gpointer data)
+{
+	gint64 values[STATS_MAX];
+	GString *line;
+	guint i;
+	int fd;
+
+	stats_sample(values);
+	line = g_string_new(NULL);
+	g_string_append_printf(line, "{\"time\":%" G_GINT64_FORMAT,
+		g_get_real_time() / G_USEC_PER_SEC);
+	for (i = 0; stats_name(i); i++)
+		g_string_append_printf(line, ",\"%s\":%" G_GINT64_FORMAT,
+			stats_name(i), values[i]);
+	g_string_append(line, "}\n");
+
+	/* One write per line, several processes can share the file */
+	if ((fd = open(stats_file, O_WRONLY | O_APPEND | O_CREAT, 0600)) >= 0) {
+		if (write(fd, line->str, line->len) < 0)
+			g_warning("Can't write: %s", stats_file);
+		close(fd);
+	}
+	g_string_free(line, TRUE);
+	return TRUE;
+}
+
+/* Stats page of the current sample */
+gchar*
+stats_html(void)
+{
+	gint64 values[STATS_MAX];
+	GString *html;
+	guint i;
+
+	stats_sample(values);
+	html = g_string_new("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">"
+		"<title>TazWeb stats</title><style>body { font-family: sans-serif; }"
+		" td { padding: 2px 12px; } td + td { text-align: right; }</style>"
+		"</head><body>\n<h1>TazWeb stats</h1>\n<table>\n");
+	g_string_append_printf(html, "<tr><td>pid</td><td>%d</td></tr>\n",
+		getpid());
+	for (i = 0; stats_name(i); i++)
+		g_string_append_printf(html, "<tr><td>%s</td><td>%" G_GINT64_FORMAT
+			"</td></tr>\n", stats_name(i), values[i]);
+	g_string_append(html, "</table>\n");
+	stats_front_html(html);
+	g_string_append(html, "</body></html>\n");
+	return g_string_free(html, FALSE);
+}
+
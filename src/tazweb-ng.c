@@ -12,46 +12,63 @@
  *
  */
 
-#include <stdlib.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/queue.h>
 #include <getopt.h>
-#include <glib.h>
-#include <glib/gi18n.h>
+#include <JavaScriptCore/JavaScript.h>
 
-#include <gtk/gtk.h>
-#include <webkit/webkit.h>
-#include <libsoup/soup.h>
+#include "tazweb.h"
 
 #define VERSION			"2.0"
-#define GETTEXT_PACKAGE	"tazweb"
-#define WEBHOME			"file:///usr/share/webhome/index.html"
-#define SEARCH			"http://duckduckgo.com/?q=%s&t=slitaz"
-#define HOME			g_get_home_dir()
-#define CONFIG			g_strdup_printf("%s/.config/tazweb", HOME)
-#define BOOKMARKS		g_strdup_printf("%s/bookmarks.txt", CONFIG)
-#define COOKIES			g_strdup_printf("%s/cookies.txt", CONFIG)
-#define DOWNLOADS		g_strdup_printf("%s/Downloads", HOME)
-
-/* User agent string */
-#define UA_TAZWEB		g_strdup_printf("TazWeb/%s (X11; SliTaz GNU/Linux)", VERSION)
-#define UA_COMPAT		"Mozilla/5.0 AppleWebKit/535.22+"
-#define UA				g_strdup_printf("%s %s", UA_TAZWEB, UA_COMPAT)
+#define STATS_URI		SCHEME "stats"
+
+const gchar		*tazweb_version	= VERSION;
 
 int		width			= 800;
 int		height			= 600;
 int		private			= 0;
 
-static gchar			*useragent;
+gchar					*useragent;
 static gboolean		notoolbar;
 static gboolean		nomenu;
 static gboolean		kiosk;
+static gboolean		nosession;
+static gboolean		newinstance;
+static gboolean		process_tabs;
+static int				renderer_fd = -1;
 
 static GtkWidget		*tazweb_window;
 static GtkNotebook		*notebook;
-static SoupSession		*session;
-static SoupCookieJar	*cookiejar;
+SoupSession				*session;
+SoupCookieJar			*cookiejar;
 const gchar*			uri;
 
+/* Out-of-process tab: the webview lives in a renderer child and its
+ * state is mirrored from the renderer messages */
+struct renderer {
+	GPid			pid;
+	int				fd;
+	GString			*out;
+	GIOChannel		*out_io;
+	guint			out_id;
+	GIOChannel		*io;
+	guint			io_id;
+	guint			child_id;
+	guint			ping_id;
+	gint64			pong;
+	gboolean		hung;
+	gboolean		dead;
+	WebKitLoadStatus status;
+	gint			progress;
+	gboolean		can_back;
+	gboolean		can_forward;
+	gchar			*uri;
+	gchar			*title;
+	GPtrArray		*history;
+	guint			current;
+};
+
 /* Tab structure */
 struct tab {
 	TAILQ_ENTRY(tab) entry;
@@ -68,15 +85,65 @@ struct tab {
 	GtkToolItem		*ttb;
 	GtkWidget		*spinner;
 	guint			tab_id;
+	guint			ui_source;
 	int				focus_wv;
+	int				loading;
+	gchar			*pending;
+	gint64			last_used;
+	GPtrArray		*history;
+	guint			history_current;
+	gdouble			scroll_x;
+	gdouble			scroll_y;
+	gboolean		restore_scroll;
+	gboolean		pinned;
+	gboolean		throttled;
+	guint			sid;
+	struct renderer	*renderer;
 	WebKitWebView	*webview;
 };
 TAILQ_HEAD(tab_list, tab);
 struct tab_list tabs;
 
+/* Background tabs waiting for a load slot */
+#define LOAD_LIMIT		2
+
+static GQueue			load_queue		= G_QUEUE_INIT;
+static gint				load_limit		= LOAD_LIMIT;
+static gint				loads_active;
+
+/* Hibernation of idle tabs over the memory budget */
+#define HIBERNATE_HISTORY	50
+#define HIBERNATE_IDLE		60
+#define HIBERNATE_CHECK		10
+
+/* Session journal */
+#define SESSION_LOG		g_strdup_printf("%s/session.log", CONFIG)
+#define SESSION_LOCK	g_strdup_printf("%s/session.lock", CONFIG)
+#define SESSION_STALE	256
+
+static int				session_fd		= -1;
+static guint			session_next_id	= 1;
+static guint			session_lines;
+static guint			session_base;
+static guint			session_focus;
+static guint			session_compact_id;
+static gboolean		session_restoring;
+
 /* Protocols */
-void create_new_tab(char *, int);
+struct tab *create_new_tab(char *, int);
 void close_tab(struct tab *);
+void tab_realize(struct tab *);
+void tab_load_status(struct tab *, WebKitLoadStatus);
+static void tab_restore_scroll(struct tab *);
+static void session_log(const gchar *, ...) G_GNUC_PRINTF(1, 2);
+static gboolean session_compact(gpointer data);
+static void stats_show(struct tab *);
+static void throttle_attach(WebKitWebView *, gboolean);
+static gboolean throttle_view(WebKitWebView *, gboolean);
+static void throttle_report(gboolean);
+static void renderer_send(struct tab *, const gchar *, ...) G_GNUC_PRINTF(2, 3);
+static void renderer_event(const gchar *, ...) G_GNUC_PRINTF(1, 2);
+static void renderer_restart(struct tab *);
 
 /* Create an icon */
 static GdkPixbuf*
@@ -97,6 +164,12 @@ check_requested_uri()
 
 int destroy_cb()
 {
+	instance_close();
+	cookies_flush(NULL);
+	cache_save();
+	history_flush(GINT_TO_POINTER(TRUE));
+	prefetch_report();
+	filter_report();
 	gtk_main_quit();
 	return (1);
 }
@@ -106,39 +179,152 @@ int focus()
 	return (0);
 }
 
+/* The widget showing the page: webview or renderer socket */
+static GtkWidget*
+tab_view(struct tab *ttb)
+{
+	if (ttb->renderer)
+		return (ttb->browser);
+	return (GTK_WIDGET(ttb->webview));
+}
+
+/* Load a uri in the tab webview or relay it to its renderer */
+static void
+tab_load_uri(struct tab *ttb, const gchar *uri)
+{
+	if (! ttb->renderer) {
+		scheme_load(ttb->webview, uri);
+		return;
+	}
+
+	/* A crashed or hung renderer is restarted on the next navigation */
+	if (ttb->renderer->dead || ttb->renderer->hung)
+		renderer_restart(ttb);
+	renderer_send(ttb, "load\t%s\n", uri);
+}
+
 static void
 uri_entry_cb(GtkWidget* entry, struct tab *ttb)
 {
 	uri = gtk_entry_get_text(GTK_ENTRY(entry));
 	g_assert(uri);
+	/* Stats of this process, not of the renderer */
+	if (ttb->renderer && ! strcmp(uri, STATS_URI)) {
+		stats_show(ttb);
+		return;
+	}
 	check_requested_uri();
-	webkit_web_view_load_uri(ttb->webview, uri);
-	gtk_widget_grab_focus(GTK_WIDGET(ttb->webview));
+	prefetch_count(uri);
+	tab_load_uri(ttb, uri);
+	gtk_widget_grab_focus(tab_view(ttb));
 }
 
-static void
-notify_load_status_cb(WebKitWebView* webview, GParamSpec* pspec,
-	struct tab *ttb)
+/* Tab label and buttons are refreshed at most once per frame */
+#define UI_FRAME		40
+
+static gboolean
+update_tab_cb(struct tab *ttb)
 {
-	GString 		*string;
-	WebKitWebFrame 	*frame;
-	const gchar		*uri, *title;
-	gdouble 		progress;
+	WebKitWebView	*webview = ttb->webview;
+	struct renderer	*r = ttb->renderer;
+	GtkWidget		*widget;
+	gchar			*text = NULL;
+	const gchar		*title;
+	gboolean		sensitive, can_back, can_forward;
+	WebKitLoadStatus status;
+	gint			progress;
+
+	ttb->ui_source = 0;
+
+	if (r) {
+		status = r->status;
+		progress = r->progress;
+		can_back = r->can_back;
+		can_forward = r->can_forward;
+	} else {
+		status = webkit_web_view_get_load_status(webview);
+		progress = webkit_web_view_get_progress(webview) * 100;
+		can_back = webkit_web_view_can_go_back(webview);
+		can_forward = webkit_web_view_can_go_forward(webview);
+	}
 
-	switch (webkit_web_view_get_load_status(webview)) {
+	switch (status) {
 
 	/* Webkit is loading */
+	case WEBKIT_LOAD_PROVISIONAL:
 	case WEBKIT_LOAD_COMMITTED:
-		frame = webkit_web_view_get_main_frame(webview);
-		uri = webkit_web_frame_get_uri(frame);
+		text = g_strdup_printf("Loading (%d%%)", progress);
+		title = text;
+	break;
 
-		string = g_string_new("Loading");
-		progress = webkit_web_view_get_progress(webview) * 100;
-		if (progress < 100)
-			g_string_append_printf(string, " (%f%%)", progress);
+	/* First layout with actual visible content or URL was loaded */
+	case WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT:
+	case WEBKIT_LOAD_FINISHED:
+		title = r ? r->title : webkit_web_view_get_title(webview);
+	break;
 
-		title = g_string_free(string, FALSE);
+	/* URL fail to load */
+	case WEBKIT_LOAD_FAILED:
+		title = "Failed";
+	break;
+
+	default:
+		title = NULL;
+	}
+
+	/* Renderer trouble shows until the next navigation restarts it */
+	if (r && r->dead)
+		title = "Crashed";
+	else if (r && r->hung)
+		title = "Not responding";
+
+	/* Skip widgets when the visible value did not change */
+	if (title && g_strcmp0(gtk_label_get_text(GTK_LABEL(ttb->label)), title))
 		gtk_label_set_text(GTK_LABEL(ttb->label), title);
+	g_free(text);
+
+	widget = GTK_WIDGET(ttb->backward);
+	sensitive = can_back;
+	if (gtk_widget_get_sensitive(widget) != sensitive)
+		gtk_widget_set_sensitive(widget, sensitive);
+
+	widget = GTK_WIDGET(ttb->forward);
+	sensitive = can_forward;
+	if (gtk_widget_get_sensitive(widget) != sensitive)
+		gtk_widget_set_sensitive(widget, sensitive);
+
+	return FALSE;
+}
+
+static void
+queue_tab_update(struct tab *ttb)
+{
+	if (! ttb->ui_source)
+		ttb->ui_source = g_timeout_add(UI_FRAME,
+			(GSourceFunc)update_tab_cb, ttb);
+}
+
+static void
+notify_tab_cb(WebKitWebView* webview, GParamSpec* pspec,
+	struct tab *ttb)
+{
+	queue_tab_update(ttb);
+}
+
+/* Main frame load status of a webview or a renderer */
+static void
+tab_status(struct tab *ttb, WebKitLoadStatus status, const gchar *uri,
+	gint back, const gchar *title)
+{
+	gchar			*text;
+
+	switch (status) {
+
+	/* Webkit is loading */
+	case WEBKIT_LOAD_COMMITTED:
+		/* Journal the navigation at its back/forward position */
+		if (uri)
+			session_log("n%u\t%d\t%s\n", ttb->sid, back, uri);
 
 		/* Start spinner */
 		gtk_widget_show(ttb->spinner);
@@ -147,41 +333,53 @@ notify_load_status_cb(WebKitWebView* webview, GParamSpec* pspec,
 		/* Update URL entry */
 		if (uri)
 			gtk_entry_set_text(GTK_ENTRY(ttb->urientry), uri);
+		history_visit(uri);
 
 		/* Focus */
 		ttb->focus_wv = 1;
 		if (gtk_notebook_get_current_page(notebook) == ttb->tab_id)
-			gtk_widget_grab_focus(GTK_WIDGET(ttb->webview));
-	break;
-
-	/* First layout with actual visible content */
-	case WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT:
-		title = webkit_web_view_get_title(webview);
-		gtk_label_set_text(GTK_LABEL(ttb->label), title);
+			gtk_widget_grab_focus(tab_view(ttb));
 	break;
 
-	/* URL was loaded */
+	/* URL was loaded or fail to load */
 	case WEBKIT_LOAD_FINISHED:
-		title = webkit_web_view_get_title(webview);
-		gtk_label_set_text(GTK_LABEL(ttb->label), title);
-		gtk_spinner_stop(GTK_SPINNER(ttb->spinner));
-		gtk_widget_hide(ttb->spinner);
-	break;
-
-		/* URL fail to load */
 	case WEBKIT_LOAD_FAILED:
-		gtk_label_set_text(GTK_LABEL(ttb->label), "Failed");
 		gtk_spinner_stop(GTK_SPINNER(ttb->spinner));
 		gtk_widget_hide(ttb->spinner);
+		if (ttb->restore_scroll)
+			tab_restore_scroll(ttb);
+
+		/* Visited pages go to the history and the URL completion */
+		if (status == WEBKIT_LOAD_FINISHED)
+			history_title(uri, title);
+
+		if (title) {
+			text = g_strdelimit(g_strdup(title), "\t\r\n", ' ');
+			session_log("t%u\t%s\n", ttb->sid, text);
+			g_free(text);
+		}
 	break;
 
+	default:
+	break;
 	}
 
-	gtk_widget_set_sensitive(GTK_WIDGET(ttb->backward),
-		webkit_web_view_can_go_back(webview));
+	tab_load_status(ttb, status);
+	trace_load_status(status);
+	queue_tab_update(ttb);
+}
 
-	gtk_widget_set_sensitive(GTK_WIDGET(ttb->forward),
-		webkit_web_view_can_go_forward(webview));
+static void
+notify_load_status_cb(WebKitWebView* webview, GParamSpec* pspec,
+	struct tab *ttb)
+{
+	WebKitWebBackForwardList *bfl;
+
+	bfl = webkit_web_view_get_back_forward_list(webview);
+	tab_status(ttb, webkit_web_view_get_load_status(webview),
+		webkit_web_frame_get_uri(webkit_web_view_get_main_frame(webview)),
+		webkit_web_back_forward_list_get_back_length(bfl),
+		webkit_web_view_get_title(webview));
 }
 
 /* Search entry and icon callback function */
@@ -190,7 +388,8 @@ search_entry_cb(GtkWidget* search_entry, struct tab *ttb)
 {
 	uri = g_strdup_printf(SEARCH, gtk_entry_get_text(GTK_ENTRY(search_entry)));
 	g_assert(uri);
-	webkit_web_view_load_uri(ttb->webview, uri);
+	prefetch_count(uri);
+	tab_load_uri(ttb, uri);
 }
 
 static void
@@ -215,10 +414,20 @@ bookmarks_edit_cb()
 static void
 go_bookmarks_cb(GtkWidget* w, struct tab *ttb)
 {
-	system("/usr/lib/tazweb/helper.sh html_bookmarks");
-	uri = g_strdup_printf("file://%s/bookmarks.html", CONFIG);
-	g_assert(uri);
-	webkit_web_view_load_uri(ttb->webview, uri);
+	/* Renderers serve the page from the same bookmarks */
+	uri = SCHEME "bookmarks";
+	tab_load_uri(ttb, uri);
+}
+
+/* Add a bookmark */
+static void
+add_bookmark_cb(GtkWidget *widget, WebKitWebView* webview)
+{
+	const gchar* title;
+
+	title = webkit_web_view_get_title(webview);
+	uri = webkit_web_view_get_uri(webview);
+	bookmarks_add(title, uri);
 }
 
 static void
@@ -226,49 +435,38 @@ go_home_cb(GtkWidget* w, struct tab *ttb)
 {
 	uri = WEBHOME;
 	g_assert(uri);
-	webkit_web_view_load_uri(ttb->webview, uri);
+	tab_load_uri(ttb, uri);
 }
 
 static void
 go_back_cb(GtkWidget *widget, struct tab *ttb)
 {
-	webkit_web_view_go_back(ttb->webview);
+	if (ttb->renderer)
+		renderer_send(ttb, "back\n");
+	else
+		bfcache_go(ttb->webview, -1);
 }
 
 static void
 go_forward_cb(GtkWidget *widget, struct tab *ttb)
 {
-	webkit_web_view_go_forward(ttb->webview);
-}
-
-/* Setup session cookies */
-void
-cookies_setup(void)
-{
-	if (cookiejar) {
-		soup_session_remove_feature(session,
-			(SoupSessionFeature*)cookiejar);
-		g_object_unref(cookiejar);
-		cookiejar = NULL;
-	}
-
-	cookiejar = soup_cookie_jar_text_new(COOKIES, 0);
-	soup_session_add_feature(session, (SoupSessionFeature*)cookiejar);
+	if (ttb->renderer)
+		renderer_send(ttb, "forward\n");
+	else
+		bfcache_go(ttb->webview, 1);
 }
 
 static void
 cookies_view_cb(GtkWidget* widget, WebKitWebView* webview)
 {
-	system("/usr/lib/tazweb/helper.sh html_cookies");
-	uri = g_strdup_printf("file://%s/cookies.html", CONFIG);
-	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	uri = SCHEME "cookies";
+	scheme_load(webview, uri);
 }
 
 static void
 cookies_clean_cb()
 {
-	system("/usr/lib/tazweb/helper.sh clean_cookies");
+	cookies_clean();
 }
 
 /* Add items to WebKit contextual menu */
@@ -289,12 +487,12 @@ populate_menu_cb(WebKitWebView *ttb, GtkMenu *menu, gpointer data)
 	//g_signal_connect(item, "activate", G_CALLBACK(go_bookmarks_cb), webview);
 
 	if (! kiosk) {
-		///* Add a bookmark */
-		//item = gtk_image_menu_item_new_with_label(_("Add a bookmark"));
-		//gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
-		//gtk_image_new_from_stock(GTK_STOCK_ADD, GTK_ICON_SIZE_MENU));
-		//gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-		//g_signal_connect(item, "activate", G_CALLBACK(add_bookmark_cb), webview);
+		/* Add a bookmark */
+		item = gtk_image_menu_item_new_with_label(_("Add a bookmark"));
+		gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
+		gtk_image_new_from_stock(GTK_STOCK_ADD, GTK_ICON_SIZE_MENU));
+		gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+		g_signal_connect(item, "activate", G_CALLBACK(add_bookmark_cb), ttb);
 		
 		/* Edit bookmarks */
 		item = gtk_image_menu_item_new_with_label(_("Edit bookmarks"));
@@ -335,11 +533,11 @@ populate_menu_cb(WebKitWebView *ttb, GtkMenu *menu, gpointer data)
 	
 	/* Cookies */
 	if (! private) {
-		//item = gtk_image_menu_item_new_with_label(_("View cookies"));
-		//gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
-		//gtk_image_new_from_stock(GTK_STOCK_HELP, GTK_ICON_SIZE_MENU));
-		//gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-		//g_signal_connect(item, "activate", G_CALLBACK(cookies_view_cb), webview);
+		item = gtk_image_menu_item_new_with_label(_("View cookies"));
+		gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
+		gtk_image_new_from_stock(GTK_STOCK_HELP, GTK_ICON_SIZE_MENU));
+		gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+		g_signal_connect(item, "activate", G_CALLBACK(cookies_view_cb), ttb);
 
 		item = gtk_image_menu_item_new_with_label(_("Clean all cookies"));
 		gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
@@ -352,21 +550,1016 @@ populate_menu_cb(WebKitWebView *ttb, GtkMenu *menu, gpointer data)
 		gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
 	}
 
-	/* Quit TazWeb */
-	item = gtk_image_menu_item_new_with_label(_("Quit TazWeb"));
-	gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
-	gtk_image_new_from_stock(GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU));
-	gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-	g_signal_connect(item, "activate", G_CALLBACK(destroy_cb), NULL);
+	/* Quit TazWeb */
+	item = gtk_image_menu_item_new_with_label(_("Quit TazWeb"));
+	gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(item),
+	gtk_image_new_from_stock(GTK_STOCK_CLOSE, GTK_ICON_SIZE_MENU));
+	gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+	g_signal_connect(item, "activate", G_CALLBACK(destroy_cb), NULL);
+
+	gtk_widget_show_all(GTK_WIDGET(menu));
+}
+
+/* Create a new tab callback */
+static void
+create_new_tab_cb()
+{
+	create_new_tab(WEBHOME, +1);
+}
+
+/* TazWeb globals, before the options */
+static void
+config_apply(void)
+{
+	if (config.width > 0)
+		width = config.width;
+	if (config.height > 0)
+		height = config.height;
+	if (config.pool >= 0)
+		pool_size = config.pool;
+	if (config.cache >= 0)
+		cache_size = config.cache;
+	if (config.bfcache >= 0)
+		bfcache_entries = config.bfcache;
+	if (config.bfcache_size >= 0)
+		bfcache_size = config.bfcache_size;
+	if (config.kiosk >= 0)
+		kiosk = config.kiosk;
+	if (config.toolbar >= 0)
+		notoolbar = ! config.toolbar;
+	if (config.menu >= 0)
+		nomenu = ! config.menu;
+}
+
+/*
+ *
+ * Out-of-process tabs
+ *
+ * With --process-tabs each tab webview runs in a renderer child, this
+ * same program started with --renderer, and is embedded in the notebook
+ * page with a GtkSocket/GtkPlug. Commands and events are tab separated
+ * lines, commands on the child stdin and events on a pipe of their own
+ * passed with --renderer-fd, out of reach of what a page prints on stdout:
+ *
+ *   load uri, back, forward, item uri title, goto n, hide, show, ping
+ *   plug id, state status progress back can_back can_forward uri title, pong
+ *
+ * A renderer not answering pings is marked as not responding, a crashed
+ * or hung renderer is restarted by the next navigation in its tab.
+ *
+ */
+
+#define RENDERER_PING	2
+#define RENDERER_HANG	10
+#define RENDERER_QUIT	5
+#define RENDERER_QUEUE	65536
+
+/* A renderer left to quit on its own */
+struct renderer_exit {
+	GPid			pid;
+	guint			kill_id;
+};
+
+static gchar			*renderer_exe;
+static WebKitWebView	*renderer_view;
+static GPtrArray		*renderer_items;
+
+/* Write what the pipe takes, the rest waits for it to drain */
+static gboolean
+renderer_flush_cb(GIOChannel *io, GIOCondition condition, struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+	gssize len;
+
+	len = write(r->fd, r->out->str, r->out->len);
+	if (len < 0 && errno != EAGAIN && errno != EINTR) {
+		g_string_truncate(r->out, 0);
+	} else if (len > 0) {
+		g_string_erase(r->out, 0, len);
+	}
+	if (r->out->len && ! (condition & (G_IO_HUP | G_IO_ERR)))
+		return TRUE;
+	g_string_truncate(r->out, 0);
+	r->out_id = 0;
+	return FALSE;
+}
+
+/* Commands are queued whole, a renderer letting RENDERER_QUEUE bytes pile
+ * up is hung and further commands are dropped */
+static void
+renderer_send(struct tab *ttb, const gchar *format, ...)
+{
+	struct renderer *r = ttb->renderer;
+	va_list args;
+
+	if (! r || r->fd < 0)
+		return;
+	if (r->out->len > RENDERER_QUEUE) {
+		g_debug("Renderer %d: command dropped", r->pid);
+		return;
+	}
+
+	va_start(args, format);
+	g_string_append_vprintf(r->out, format, args);
+	va_end(args);
+	if (r->out_id)
+		return;
+	if (renderer_flush_cb(r->out_io, G_IO_OUT, ttb))
+		r->out_id = g_io_add_watch(r->out_io, G_IO_OUT | G_IO_HUP | G_IO_ERR,
+			(GIOFunc)renderer_flush_cb, ttb);
+}
+
+/* Mirror of the renderer back/forward list for the session journal,
+ * uri and title pairs updated like session_navigate() */
+static void
+renderer_history(struct renderer *r, WebKitLoadStatus status, guint back)
+{
+	guint pos = back * 2;
+
+	if (! r->history)
+		r->history = g_ptr_array_new_with_free_func(g_free);
+	if (status == WEBKIT_LOAD_COMMITTED && r->uri) {
+		if (pos + 1 < r->history->len
+				&& ! g_strcmp0(g_ptr_array_index(r->history, pos), r->uri)) {
+			r->current = back;
+			return;
+		}
+		if (pos > r->history->len)
+			pos = r->history->len;
+		g_ptr_array_set_size(r->history, pos);
+		g_ptr_array_add(r->history, g_strdup(r->uri));
+		g_ptr_array_add(r->history, NULL);
+		r->current = pos / 2;
+	} else if (status == WEBKIT_LOAD_FINISHED && r->title
+			&& r->current * 2 + 1 < r->history->len) {
+		g_free(g_ptr_array_index(r->history, r->current * 2 + 1));
+		g_ptr_array_index(r->history, r->current * 2 + 1) =
+			g_strdup(r->title);
+	}
+}
+
+static void
+renderer_read_line(struct tab *ttb, gchar *line)
+{
+	struct renderer *r = ttb->renderer;
+	WebKitLoadStatus status;
+	gchar **f;
+
+	f = g_strsplit(g_strchomp(line), "\t", 8);
+	if (! strcmp(f[0], "plug") && f[1]) {
+		gtk_socket_add_id(GTK_SOCKET(ttb->browser),
+			(GdkNativeWindow)strtoul(f[1], NULL, 10));
+	} else if (! strcmp(f[0], "state") && g_strv_length(f) == 8) {
+		status = atoi(f[1]);
+		r->progress = atoi(f[2]);
+		r->can_back = atoi(f[4]);
+		r->can_forward = atoi(f[5]);
+		g_free(r->uri);
+		r->uri = *f[6] ? g_strdup(f[6]) : NULL;
+		g_free(r->title);
+		r->title = *f[7] ? g_strdup(f[7]) : NULL;
+
+		if (status != r->status) {
+			r->status = status;
+			renderer_history(r, status, atoi(f[3]));
+			tab_status(ttb, status, r->uri, atoi(f[3]), r->title);
+		} else {
+			queue_tab_update(ttb);
+		}
+	} else if (! strcmp(f[0], "throttled") && f[1]) {
+		ttb->throttled = atoi(f[1]);
+	}
+	g_strfreev(f);
+}
+
+static gboolean
+renderer_read_cb(GIOChannel *io, GIOCondition condition, struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+	GIOStatus status;
+	gchar *line;
+
+	while ((status = g_io_channel_read_line(io, &line, NULL, NULL, NULL))
+			== G_IO_STATUS_NORMAL) {
+		/* Any message, pong or not, proves the renderer is alive */
+		r->pong = g_get_monotonic_time();
+		if (r->hung) {
+			r->hung = FALSE;
+			queue_tab_update(ttb);
+		}
+		renderer_read_line(ttb, line);
+		g_free(line);
+	}
+
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+		r->io_id = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+renderer_reap_cb(GPid pid, gint status, struct renderer_exit *re)
+{
+	g_spawn_close_pid(pid);
+	if (re->kill_id)
+		g_source_remove(re->kill_id);
+	g_free(re);
+}
+
+static gboolean
+renderer_kill_cb(struct renderer_exit *re)
+{
+	kill(re->pid, SIGKILL);
+	re->kill_id = 0;
+	return FALSE;
+}
+
+/* Close the renderer pipes: on end of input a healthy renderer flushes
+ * its cookies and cache index and quits, it is killed if it does not
+ * within RENDERER_QUIT seconds. Hung renderers are killed at once. */
+static void
+renderer_stop(struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+	struct renderer_exit *re;
+
+	if (r->io_id)
+		g_source_remove(r->io_id);
+	if (r->io)
+		g_io_channel_unref(r->io);
+	if (r->out_id)
+		g_source_remove(r->out_id);
+	if (r->out_io)
+		g_io_channel_unref(r->out_io);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->io_id = r->out_id = 0;
+	r->io = r->out_io = NULL;
+	r->fd = -1;
+	g_string_truncate(r->out, 0);
+
+	if (r->child_id) {
+		g_source_remove(r->child_id);
+		r->child_id = 0;
+		re = g_new0(struct renderer_exit, 1);
+		re->pid = r->pid;
+		if (r->hung)
+			kill(r->pid, SIGKILL);
+		else
+			re->kill_id = g_timeout_add_seconds(RENDERER_QUIT,
+				(GSourceFunc)renderer_kill_cb, re);
+		g_child_watch_add(r->pid, (GChildWatchFunc)renderer_reap_cb, re);
+	}
+}
+
+/* The renderer is gone: the other tabs go on, this one shows it */
+static void
+renderer_exit_cb(GPid pid, gint status, struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+
+	g_spawn_close_pid(pid);
+	r->child_id = 0;
+	renderer_stop(ttb);
+	r->dead = TRUE;
+	r->status = WEBKIT_LOAD_FAILED;
+	tab_status(ttb, WEBKIT_LOAD_FAILED, NULL, 0, NULL);
+}
+
+/* Child side of the spawn: the event pipe survives the exec */
+static void
+renderer_setup(gpointer data)
+{
+	fcntl(GPOINTER_TO_INT(data), F_SETFD, 0);
+}
+
+static gboolean
+renderer_start(struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+	GPtrArray *args;
+	GError *error = NULL;
+	gchar *cache_arg, *fd_arg;
+	gboolean ok;
+	int in, events[2];
+
+	if (pipe(events) < 0) {
+		g_warning("Can't start renderer: %s", g_strerror(errno));
+		r->dead = TRUE;
+		return (FALSE);
+	}
+	fcntl(events[0], F_SETFD, FD_CLOEXEC);
+	fcntl(events[1], F_SETFD, FD_CLOEXEC);
+
+	/* Same process wide settings as the browser */
+	cache_arg = g_strdup_printf("%d", cache_size);
+	fd_arg = g_strdup_printf("%d", events[1]);
+	args = g_ptr_array_new();
+	g_ptr_array_add(args, renderer_exe);
+	g_ptr_array_add(args, "--renderer-fd");
+	g_ptr_array_add(args, fd_arg);
+	if (private)
+		g_ptr_array_add(args, "--private");
+	if (useragent) {
+		g_ptr_array_add(args, "--useragent");
+		g_ptr_array_add(args, useragent);
+	}
+	g_ptr_array_add(args, "--cache");
+	g_ptr_array_add(args, cache_arg);
+	if (config_profile) {
+		g_ptr_array_add(args, "--profile");
+		g_ptr_array_add(args, config_profile);
+	}
+	if (har_dir) {
+		g_ptr_array_add(args, har_format == HAR_TRACE ?
+			"--trace-events" : "--har");
+		g_ptr_array_add(args, har_dir);
+	}
+	g_ptr_array_add(args, NULL);
+
+	ok = g_spawn_async_with_pipes(NULL, (gchar **)args->pdata, NULL,
+		G_SPAWN_DO_NOT_REAP_CHILD, renderer_setup,
+		GINT_TO_POINTER(events[1]), &r->pid, &in, NULL, NULL, &error);
+	g_ptr_array_free(args, TRUE);
+	g_free(cache_arg);
+	g_free(fd_arg);
+	close(events[1]);
+	if (! ok) {
+		g_warning("Can't start renderer: %s", error->message);
+		g_error_free(error);
+		close(events[0]);
+		r->dead = TRUE;
+		return (FALSE);
+	}
+
+	r->fd = in;
+	fcntl(in, F_SETFL, O_NONBLOCK);
+	r->out_io = g_io_channel_unix_new(in);
+	r->io = g_io_channel_unix_new(events[0]);
+	g_io_channel_set_close_on_unref(r->io, TRUE);
+	g_io_channel_set_encoding(r->io, NULL, NULL);
+	g_io_channel_set_flags(r->io, G_IO_FLAG_NONBLOCK, NULL);
+	r->io_id = g_io_add_watch(r->io, G_IO_IN | G_IO_HUP | G_IO_ERR,
+		(GIOFunc)renderer_read_cb, ttb);
+	r->child_id = g_child_watch_add(r->pid,
+		(GChildWatchFunc)renderer_exit_cb, ttb);
+
+	r->pong = g_get_monotonic_time();
+	r->dead = r->hung = FALSE;
+	r->status = WEBKIT_LOAD_FINISHED;
+
+	/* A background tab starts throttled */
+	if (ttb->throttled)
+		renderer_send(ttb, "hide\n");
+	return (TRUE);
+}
+
+static void
+renderer_restart(struct tab *ttb)
+{
+	renderer_stop(ttb);
+	tab_load_status(ttb, WEBKIT_LOAD_FAILED);
+	renderer_start(ttb);
+	queue_tab_update(ttb);
+}
+
+static gboolean
+renderer_ping_cb(struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+
+	if (r->dead)
+		return TRUE;
+	if (! r->hung && g_get_monotonic_time() - r->pong
+			> RENDERER_HANG * G_USEC_PER_SEC) {
+		r->hung = TRUE;
+		queue_tab_update(ttb);
+	}
+	renderer_send(ttb, "ping\n");
+	return TRUE;
+}
+
+/* Keep the socket when the plug goes, a restarted renderer reuses it */
+static gboolean
+renderer_plug_removed_cb(GtkSocket *socket, gpointer data)
+{
+	return TRUE;
+}
+
+/* Socket of an out-of-process tab, used as its browser widget */
+static GtkWidget*
+renderer_new(struct tab *ttb)
+{
+	GtkWidget *socket;
+
+	socket = gtk_socket_new();
+	g_signal_connect(socket, "plug-removed",
+		G_CALLBACK(renderer_plug_removed_cb), NULL);
+
+	ttb->renderer = g_new0(struct renderer, 1);
+	ttb->renderer->fd = -1;
+	ttb->renderer->out = g_string_new(NULL);
+	renderer_start(ttb);
+	ttb->renderer->ping_id = g_timeout_add_seconds(RENDERER_PING,
+		(GSourceFunc)renderer_ping_cb, ttb);
+	return (socket);
+}
+
+static void
+renderer_free(struct tab *ttb)
+{
+	struct renderer *r = ttb->renderer;
+
+	renderer_stop(ttb);
+	g_source_remove(r->ping_id);
+	if (r->history)
+		g_ptr_array_free(r->history, TRUE);
+	g_free(r->uri);
+	g_free(r->title);
+	g_string_free(r->out, TRUE);
+	g_free(r);
+	ttb->renderer = NULL;
+}
+
+/* Renderer side: one event line on the pipe to the browser, written
+ * whole even when the browser is slow to read */
+static void
+renderer_event(const gchar *format, ...)
+{
+	va_list args;
+	gchar *line;
+	gsize done, len;
+	gssize n;
+
+	va_start(args, format);
+	line = g_strdup_vprintf(format, args);
+	va_end(args);
+	len = strlen(line);
+	for (done = 0; done < len; done += n) {
+		if ((n = write(renderer_fd, line + done, len - done)) < 0) {
+			if (errno != EINTR)
+				break;
+			n = 0;
+		}
+	}
+	g_free(line);
+}
+
+/* Renderer side: report the webview state to the browser */
+static void
+renderer_state_cb(WebKitWebView *webview, GParamSpec *pspec, gpointer data)
+{
+	WebKitWebBackForwardList *bfl;
+	const gchar *uri, *title;
+	gchar *text;
+
+	bfl = webkit_web_view_get_back_forward_list(webview);
+	uri = webkit_web_frame_get_uri(webkit_web_view_get_main_frame(webview));
+	title = webkit_web_view_get_title(webview);
+	text = g_strdelimit(g_strdup(title ? title : ""), "\t\r\n", ' ');
+
+	renderer_event("state\t%d\t%d\t%d\t%d\t%d\t%s\t%s\n",
+		webkit_web_view_get_load_status(webview),
+		(int)(webkit_web_view_get_progress(webview) * 100),
+		webkit_web_back_forward_list_get_back_length(bfl),
+		webkit_web_view_can_go_back(webview),
+		webkit_web_view_can_go_forward(webview), uri ? uri : "", text);
+	g_free(text);
+}
+
+static void
+renderer_command(gchar *line)
+{
+	WebKitWebBackForwardList *bfl;
+	WebKitWebHistoryItem *item;
+	gchar **f;
+	guint n;
+
+	f = g_strsplit(g_strchomp(line), "\t", 3);
+	if (! strcmp(f[0], "ping")) {
+		renderer_event("pong\n");
+	} else if (! strcmp(f[0], "load") && f[1]) {
+		scheme_load(renderer_view, f[1]);
+	} else if (! strcmp(f[0], "back")) {
+		bfcache_go(renderer_view, -1);
+	} else if (! strcmp(f[0], "forward")) {
+		bfcache_go(renderer_view, 1);
+	} else if (! strcmp(f[0], "hide") || ! strcmp(f[0], "show")) {
+		throttle_report(throttle_view(renderer_view, *f[0] == 'h'));
+	} else if (! strcmp(f[0], "item") && f[1]) {
+		bfl = webkit_web_view_get_back_forward_list(renderer_view);
+		item = webkit_web_history_item_new_with_data(f[1],
+			f[2] ? f[2] : "");
+		webkit_web_back_forward_list_add_item(bfl, item);
+		g_ptr_array_add(renderer_items, item);
+	} else if (! strcmp(f[0], "goto") && f[1]) {
+		if ((n = atoi(f[1])) < renderer_items->len)
+			webkit_web_view_go_to_back_forward_item(renderer_view,
+				g_ptr_array_index(renderer_items, n));
+		g_ptr_array_set_size(renderer_items, 0);
+	}
+	g_strfreev(f);
+}
+
+static gboolean
+renderer_command_cb(GIOChannel *io, GIOCondition condition, gpointer data)
+{
+	GIOStatus status;
+	gchar *line;
+
+	while ((status = g_io_channel_read_line(io, &line, NULL, NULL, NULL))
+			== G_IO_STATUS_NORMAL) {
+		renderer_command(line);
+		g_free(line);
+	}
+
+	/* The browser is gone */
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+		gtk_main_quit();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* Renderer process: one webview in a plug, driven from stdin */
+static int
+renderer_main(void)
+{
+	GtkWidget *plug, *box, *window;
+	GIOChannel *io;
+
+	/* The startup trace belongs to the browser process */
+	if (trace && trace != stderr)
+		fclose(trace);
+	trace = NULL;
+
+	gtk_init(NULL, NULL);
+	config_webkit();
+	config_session(webkit_get_default_session());
+	if (! private) {
+		session = webkit_get_default_session();
+		cookies_setup();
+		cache_setup();
+	}
+	filter_load();
+	site_load();
+
+	plug = gtk_plug_new(0);
+	window = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(window),
+		GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	renderer_view = webview_new();
+	gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(renderer_view));
+	g_object_unref(renderer_view);
+	/* In a box where the back/forward snapshots can take its place */
+	box = gtk_vbox_new(FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(box), window, TRUE, TRUE, 0);
+	gtk_container_add(GTK_CONTAINER(plug), box);
+	renderer_items = g_ptr_array_new_with_free_func(g_object_unref);
+
+	if (har_dir)
+		har_attach(renderer_view);
+	filter_attach(renderer_view);
+	site_attach(renderer_view);
+	scheme_attach(renderer_view);
+	throttle_attach(renderer_view, FALSE);
+	bfcache_attach(renderer_view);
+	g_signal_connect(renderer_view, "notify::load-status",
+		G_CALLBACK(renderer_state_cb), NULL);
+	g_signal_connect(renderer_view, "notify::title",
+		G_CALLBACK(renderer_state_cb), NULL);
+	g_signal_connect(renderer_view, "notify::progress",
+		G_CALLBACK(renderer_state_cb), NULL);
+	g_signal_connect(plug, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+
+	io = g_io_channel_unix_new(STDIN_FILENO);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_add_watch(io, G_IO_IN | G_IO_HUP | G_IO_ERR, renderer_command_cb,
+		NULL);
+
+	gtk_widget_show_all(plug);
+	renderer_event("plug\t%lu\n", (gulong)gtk_plug_get_id(GTK_PLUG(plug)));
+
+	gtk_main();
+	if (! private) {
+		cookies_flush(NULL);
+		cache_save();
+	}
+	filter_report();
+	return (0);
+}
+
+/*
+ *
+ * Background tabs
+ *
+ * Tabs that are not shown are throttled when the notebook switches
+ * page. Their timers are clamped to THROTTLE_CLAMP ms, animation frames
+ * wait as long and CSS animations are paused. A hidden page is unmapped
+ * so WebKit paints nothing, and with its timers held it has little left
+ * to lay out. Pinned tabs and pages playing audio or video are exempt:
+ * the script reports play, pause and end of media as a console message
+ * and a hidden page is checked again then. A renderer answers hide and
+ * show with the state it ended in.
+ *
+ * WebKit1 has no page visibility API. A small script wraps the timers of
+ * each frame when its window object is created, and the flag it reads is
+ * set in every frame of the page, intervals are armed again at each run
+ * so a hidden one waits THROTTLE_CLAMP ms too. The script also adds up
+ * the wall time spent in timer and animation callbacks, the timer time of
+ * in-process tabs: it is not their CPU time, that is shared with the
+ * browser. Renderer tabs have their CPU time from /proc.
+ *
+ */
+
+#define THROTTLE_CLAMP	1000
+#define THROTTLE_MEDIA	"__tazweb:media"
+
+static const gchar		throttle_script[] =
+	"(function(w) {\n"
+	"  if (w.__tazweb) return;\n"
+	"  var t = w.__tazweb = { hidden: false, busy: 0 }, clamp = "
+		G_STRINGIFY(THROTTLE_CLAMP) ";\n"
+	"  var st = w.setTimeout, ct = w.clearTimeout, iv = {};\n"
+	"  var raf = w.webkitRequestAnimationFrame;\n"
+	"  var caf = w.webkitCancelAnimationFrame;\n"
+	"  var slice = Array.prototype.slice;\n"
+	"  var log = w.console && w.console.log;\n"
+	"  function note() {\n"
+	"    if (log) log.call(w.console, '" THROTTLE_MEDIA "');\n"
+	"  }\n"
+	"  w.addEventListener('play', note, true);\n"
+	"  w.addEventListener('pause', note, true);\n"
+	"  w.addEventListener('ended', note, true);\n"
+	"  function run(f, a) {\n"
+	"    var s = Date.now();\n"
+	"    try { typeof f == 'function' ? f.apply(w, a) : w.eval(f); }\n"
+	"    finally { t.busy += Date.now() - s; }\n"
+	"  }\n"
+	"  w.setTimeout = function(f, d) {\n"
+	"    var a = slice.call(arguments, 2);\n"
+	"    return st.call(w, function() { run(f, a); },\n"
+	"      t.hidden ? Math.max(d || 0, clamp) : d);\n"
+	"  };\n"
+	"  w.setInterval = function(f, d) {\n"
+	"    var a = slice.call(arguments, 2), id;\n"
+	"    function arm() {\n"
+	"      var n = st.call(w, function() { arm(); run(f, a); },\n"
+	"        t.hidden ? Math.max(d || 0, clamp) : d);\n"
+	"      if (id === undefined) id = n;\n"
+	"      iv[id] = n;\n"
+	"    }\n"
+	"    arm();\n"
+	"    return id;\n"
+	"  };\n"
+	"  w.clearTimeout = w.clearInterval = function(id) {\n"
+	"    if (iv.hasOwnProperty(id)) {\n"
+	"      ct.call(w, iv[id]);\n"
+	"      delete iv[id];\n"
+	"    } else {\n"
+	"      ct.call(w, id);\n"
+	"    }\n"
+	"  };\n"
+	"  if (raf) {\n"
+	"    w.webkitRequestAnimationFrame = function(f) {\n"
+	"      if (! t.hidden)\n"
+	"        return raf.call(w, function(time) { run(f, [time]); });\n"
+	"      return -st.call(w, function() { run(f, [Date.now()]); }, clamp);\n"
+	"    };\n"
+	"    w.webkitCancelAnimationFrame = function(id) {\n"
+	"      return id < 0 ? ct.call(w, -id) : caf.call(w, id);\n"
+	"    };\n"
+	"  }\n"
+	"  t.set = function(hidden) {\n"
+	"    var d = w.document, s = d.getElementById('__tazweb');\n"
+	"    t.hidden = hidden;\n"
+	"    if (! d.documentElement)\n"
+	"      return d.addEventListener('DOMContentLoaded',\n"
+	"        function() { t.set(t.hidden); }, false);\n"
+	"    if (hidden && ! s) {\n"
+	"      s = d.createElement('style');\n"
+	"      s.id = '__tazweb';\n"
+	"      s.textContent = '*, *:before, *:after { '\n"
+	"        + '-webkit-animation-play-state: paused !important; }';\n"
+	"      d.documentElement.appendChild(s);\n"
+	"    } else if (! hidden && s) {\n"
+	"      s.parentNode.removeChild(s);\n"
+	"    }\n"
+	"  };\n"
+	"  t.media = function() {\n"
+	"    var m = w.document.querySelectorAll('audio, video'), i;\n"
+	"    for (i = 0; i < m.length; i++)\n"
+	"      if (! m[i].paused && ! m[i].ended) return 1;\n"
+	"    return 0;\n"
+	"  };\n"
+	"})(window);\n";
+
+/* Frames with the script, to the webview of their page */
+static GHashTable		*throttle_frames;
+
+/* Run a script in a frame, its result if it is a number */
+static gdouble
+throttle_eval(WebKitWebFrame *frame, const gchar *script)
+{
+	JSGlobalContextRef context;
+	JSStringRef string;
+	JSValueRef value;
+
+	context = webkit_web_frame_get_global_context(frame);
+	string = JSStringCreateWithUTF8CString(script);
+	value = JSEvaluateScript(context, string, NULL, NULL, 0, NULL);
+	JSStringRelease(string);
+	if (! value || ! JSValueIsNumber(context, value))
+		return (0);
+	return (JSValueToNumber(context, value, NULL));
+}
+
+/* Sum of a script over all the frames of a webview */
+static gdouble
+throttle_eval_all(WebKitWebView *webview, const gchar *script)
+{
+	GHashTableIter iter;
+	gpointer frame, view;
+	gdouble sum = 0;
+
+	g_hash_table_iter_init(&iter, throttle_frames);
+	while (g_hash_table_iter_next(&iter, &frame, &view))
+		if (view == webview)
+			sum += throttle_eval(frame, script);
+	return (sum);
+}
+
+static void
+throttle_frame_gone_cb(gpointer data, GObject *frame)
+{
+	g_hash_table_remove(throttle_frames, frame);
+}
+
+/* A new document: wrap its timers, throttled if the tab is hidden */
+static void
+throttle_window_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		gpointer context, gpointer window, gpointer data)
+{
+	if (! g_hash_table_lookup(throttle_frames, frame)) {
+		g_hash_table_insert(throttle_frames, frame, webview);
+		g_object_weak_ref(G_OBJECT(frame), throttle_frame_gone_cb, NULL);
+	}
+	throttle_eval(frame, throttle_script);
+	if (g_object_get_data(G_OBJECT(webview), "throttled"))
+		throttle_eval(frame, "__tazweb.set(true)");
+}
+
+/* Throttle or resume a page of this process, returns if it is throttled:
+ * not while it plays media */
+static gboolean
+throttle_view(WebKitWebView *webview, gboolean hidden)
+{
+	g_object_set_data(G_OBJECT(webview), "hidden", GINT_TO_POINTER(hidden));
+	if (hidden && throttle_eval_all(webview,
+			"window.__tazweb ? __tazweb.media() : 0") > 0)
+		hidden = FALSE;
+	g_object_set_data(G_OBJECT(webview), "throttled",
+		GINT_TO_POINTER(hidden));
+	throttle_eval_all(webview, hidden ? "window.__tazweb && __tazweb.set(true)"
+		: "window.__tazweb && __tazweb.set(false)");
+	return (hidden);
+}
+
+/* Renderer side: the state of its page for the browser */
+static void
+throttle_report(gboolean throttled)
+{
+	renderer_event("throttled\t%d\n", throttled);
+}
+
+/* Media started or stopped: a hidden page is checked again */
+static gboolean
+throttle_console_cb(WebKitWebView *webview, const gchar *message, gint line,
+		const gchar *source, gpointer data)
+{
+	struct tab *ttb;
+	gboolean throttled;
+
+	if (g_strcmp0(message, THROTTLE_MEDIA))
+		return (FALSE);
+	if (! g_object_get_data(G_OBJECT(webview), "hidden"))
+		return (TRUE);
+	throttled = throttle_view(webview, TRUE);
+	if (webview == renderer_view)
+		throttle_report(throttled);
+	TAILQ_FOREACH(ttb, &tabs, entry)
+		if (ttb->webview == webview)
+			ttb->throttled = throttled;
+	return (TRUE);
+}
+
+static void
+throttle_attach(WebKitWebView *webview, gboolean hidden)
+{
+	if (! throttle_frames)
+		throttle_frames = g_hash_table_new(NULL, NULL);
+	g_object_set_data(G_OBJECT(webview), "hidden", GINT_TO_POINTER(hidden));
+	g_object_set_data(G_OBJECT(webview), "throttled",
+		GINT_TO_POINTER(hidden));
+	g_signal_connect(webview, "window-object-cleared",
+		G_CALLBACK(throttle_window_cb), NULL);
+	g_signal_connect(webview, "console-message",
+		G_CALLBACK(throttle_console_cb), NULL);
+}
+
+/* Renderer tabs throttle their page themselves and tell their state. A
+ * tab not realized yet gets its page in this state */
+static void
+throttle_tab(struct tab *ttb, gboolean hidden)
+{
+	if (hidden && ttb->pinned)
+		return;
+	if (ttb->webview)
+		ttb->throttled = throttle_view(ttb->webview, hidden);
+	else if (ttb->renderer && ! ttb->renderer->dead)
+		renderer_send(ttb, hidden ? "hide\n" : "show\n");
+	else
+		ttb->throttled = hidden;
+}
+
+/* The shown tab runs at full speed, the one left is throttled */
+static void
+throttle_switch(struct tab *from, struct tab *to)
+{
+	if (from && from != to)
+		throttle_tab(from, TRUE);
+	if (to)
+		throttle_tab(to, FALSE);
+}
+
+static void
+throttle_pin_cb(GtkCheckMenuItem *item, struct tab *ttb)
+{
+	GtkWidget *current;
+
+	ttb->pinned = gtk_check_menu_item_get_active(item);
+	current = gtk_notebook_get_nth_page(notebook,
+		gtk_notebook_get_current_page(notebook));
+	throttle_tab(ttb, ! ttb->pinned && ttb->vbox != current);
+}
+
+/* Right click on a tab title: pin or unpin the tab */
+static gboolean
+throttle_label_cb(GtkWidget *widget, GdkEventButton *event, struct tab *ttb)
+{
+	GtkWidget *menu, *item;
+
+	if (event->button != 3)
+		return (FALSE);
+	menu = gtk_menu_new();
+	item = gtk_check_menu_item_new_with_label(_("Pinned tab"));
+	gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), ttb->pinned);
+	g_signal_connect(item, "toggled", G_CALLBACK(throttle_pin_cb), ttb);
+	gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+	g_signal_connect(menu, "deactivate", G_CALLBACK(gtk_widget_destroy), NULL);
+	gtk_widget_show_all(menu);
+	gtk_menu_popup(GTK_MENU(menu), NULL, NULL, NULL, NULL,
+		event->button, event->time);
+	return (TRUE);
+}
+
+/* Time spent in the timers and animation frames of an in-process tab
+ * in ms, -1 for a renderer tab */
+static gint64
+throttle_timers(struct tab *ttb)
+{
+	if (! ttb->webview)
+		return (-1);
+	return ((gint64)throttle_eval_all(ttb->webview,
+		"window.__tazweb ? __tazweb.busy : 0"));
+}
+
+/* CPU time of the renderer process of a tab in ms, -1 for an in-process
+ * tab */
+static gint64
+throttle_cpu(struct tab *ttb)
+{
+	gulong utime, stime;
+	gchar *file, *text, *p;
+	gint64 ms = 0;
+
+	if (! ttb->renderer)
+		return (-1);
+	if (ttb->renderer->dead)
+		return (0);
+
+	/* utime and stime are the fields 14 and 15, after the command */
+	file = g_strdup_printf("/proc/%d/stat", ttb->renderer->pid);
+	if (g_file_get_contents(file, &text, NULL, NULL)) {
+		if ((p = strrchr(text, ')')) && sscanf(p + 2, "%*c %*d %*d %*d %*d"
+				" %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2)
+			ms = (gint64)(utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+		g_free(text);
+	}
+	g_free(file);
+	return (ms);
+}
+
+/* Throttled tabs, the CPU time of the renderers and the timer time of
+ * in-process tabs, for the stats */
+static void
+throttle_sample(gint64 *throttled, gint64 *cpu, gint64 *timers)
+{
+	struct tab *ttb;
+
+	*throttled = *cpu = *timers = 0;
+	TAILQ_FOREACH(ttb, &tabs, entry) {
+		*throttled += ttb->throttled;
+		*cpu += MAX(throttle_cpu(ttb), 0);
+		*timers += MAX(throttle_timers(ttb), 0);
+	}
+}
+
+/* A stats table cell, - when it does not apply */
+static void
+throttle_cell(GString *html, gint64 ms)
+{
+	if (ms < 0)
+		g_string_append(html, "<td>-</td>");
+	else
+		g_string_append_printf(html, "<td>%" G_GINT64_FORMAT "</td>", ms);
+}
+
+/* One line per tab on the stats page */
+static void
+throttle_html(GString *html)
+{
+	struct tab *ttb;
+	gchar *title;
+
+	if (TAILQ_EMPTY(&tabs))
+		return;
+	g_string_append(html, "<h2>Tabs</h2>\n<table>\n"
+		"<tr><th>tab</th><th>state</th><th>cpu_ms</th>"
+		"<th>timer_ms</th></tr>\n");
+	TAILQ_FOREACH(ttb, &tabs, entry) {
+		title = g_markup_escape_text(gtk_label_get_text(
+			GTK_LABEL(ttb->label)), -1);
+		g_string_append_printf(html, "<tr><td>%s</td><td>%s</td>", title,
+			ttb->pinned ? "pinned" : ttb->throttled ? "throttled"
+			: "running");
+		throttle_cell(html, throttle_cpu(ttb));
+		throttle_cell(html, throttle_timers(ttb));
+		g_string_append(html, "</tr>\n");
+		g_free(title);
+	}
+	g_string_append(html, "</table>\n");
+}
+
+/* Statistics of the tabs, after the shared ones */
+const gchar		*stats_front_names[] = {
+	"tabs", "webviews", "renderers", "throttled", "renderers_cpu_ms",
+	"tabs_timer_ms", NULL
+};
+
+/* Tabs, webviews in this process and live renderers */
+static void
+stats_tabs(gint64 *n, gint64 *views, gint64 *renderers)
+{
+	struct tab *ttb;
+
+	*n = *views = *renderers = 0;
+	TAILQ_FOREACH(ttb, &tabs, entry) {
+		(*n)++;
+		*views += ttb->webview != NULL;
+		*renderers += ttb->renderer && ! ttb->renderer->dead;
+	}
+}
+
+void
+stats_front_sample(gint64 *values)
+{
+	stats_tabs(values, values + 1, values + 2);
+	values[1] += g_queue_get_length(&pool);
+	throttle_sample(values + 3, values + 4, values + 5);
+}
 
-	gtk_widget_show_all(GTK_WIDGET(menu));
+void
+stats_front_html(GString *html)
+{
+	throttle_html(html);
 }
 
-/* Create a new tab callback */
+/* Renderer tabs get the page as a data: uri */
 static void
-create_new_tab_cb()
+stats_show(struct tab *ttb)
 {
-	create_new_tab(WEBHOME, +1);
+	gchar *html, *data;
+
+	html = stats_html();
+	data = g_uri_escape_string(html, NULL, FALSE);
+	g_free(html);
+	html = g_strdup_printf("data:text/html;charset=utf-8,%s", data);
+	tab_load_uri(ttb, html);
+	g_free(data);
+	g_free(html);
 }
 
 /* The browser */
@@ -374,27 +1567,34 @@ GtkWidget *
 create_browser(struct tab *ttb)
 {
 	GtkWidget *window;
-	WebKitWebSettings *settings;
-	
+
+	/* Out-of-process tab: the page is embedded from a renderer */
+	if (process_tabs)
+		return (renderer_new(ttb));
+
 	window = gtk_scrolled_window_new(NULL, NULL);
 	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(window),
 		GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
 
-	ttb->webview = WEBKIT_WEB_VIEW(webkit_web_view_new());
+	/* Settings are set by webview_new(), the browser owns the webview */
+	ttb->webview = pool_take();
 	gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(ttb->webview));
-	
-	/* Webkit settings */
-	settings = webkit_web_view_get_settings (ttb->webview);
-	if (! useragent)
-		useragent = g_strdup_printf("%s", UA);
-	g_object_set(G_OBJECT(settings), "user-agent", useragent, NULL);
-	
-	if (private)
-		g_object_set(G_OBJECT(settings), "enable-private-browsing", TRUE);
+	g_object_unref(ttb->webview);
 
 	/* Connect Webkit events */
+	if (har_dir)
+		har_attach(ttb->webview);
+	filter_attach(ttb->webview);
+	site_attach(ttb->webview);
+	scheme_attach(ttb->webview);
+	throttle_attach(ttb->webview, ttb->throttled);
+	bfcache_attach(ttb->webview);
 	g_signal_connect(ttb->webview, "notify::load-status",
 		G_CALLBACK(notify_load_status_cb), ttb);
+	g_signal_connect(ttb->webview, "notify::title",
+		G_CALLBACK(notify_tab_cb), ttb);
+	g_signal_connect(ttb->webview, "notify::progress",
+		G_CALLBACK(notify_tab_cb), ttb);
 	
 	
 	// BUGGY We want to be able to open link in new tab from contextual menu
@@ -451,6 +1651,11 @@ create_toolbar(struct tab *ttb)
 	gtk_toolbar_insert(GTK_TOOLBAR(toolbar), item, -1);
 	g_signal_connect(G_OBJECT(ttb->urientry), "activate",
 		G_CALLBACK(uri_entry_cb), ttb);
+	/* Renderers have their own session, nothing to prepare here */
+	if (! process_tabs)
+		g_signal_connect(G_OBJECT(ttb->urientry), "changed",
+			G_CALLBACK(prefetch_entry_cb), NULL);
+	completion_attach(ttb->urientry);
 
 	/* Separator --> 4-6px */
 	item = gtk_separator_tool_item_new();
@@ -471,6 +1676,9 @@ create_toolbar(struct tab *ttb)
 		G_CALLBACK(search_icon_cb), ttb);
 	g_signal_connect(G_OBJECT(ttb->search_entry), "activate",
 		G_CALLBACK(search_entry_cb), ttb);
+	if (! process_tabs)
+		g_signal_connect(G_OBJECT(ttb->search_entry), "changed",
+			G_CALLBACK(prefetch_search_cb), NULL);
 
 	/* Home button */
 	ttb->home = gtk_tool_button_new_from_stock(GTK_STOCK_HOME);
@@ -488,6 +1696,599 @@ create_toolbar(struct tab *ttb)
 	return (toolbar);
 }
 
+/*
+ *
+ * Tab hibernation: when the process goes over the memory budget, the
+ * least recently used background tab gets its webview destroyed. Only
+ * the URL, title, scroll position and back/forward list are kept and
+ * the page is restored when the tab is selected again.
+ *
+ */
+
+/* Back/forward list as uri, title pairs, oldest first */
+static GPtrArray*
+back_forward_list(WebKitWebView *webview, guint *current)
+{
+	WebKitWebBackForwardList *bfl;
+	WebKitWebHistoryItem *item;
+	GPtrArray *history;
+	gint i, back, forward;
+
+	bfl = webkit_web_view_get_back_forward_list(webview);
+	back = MIN(webkit_web_back_forward_list_get_back_length(bfl),
+		HIBERNATE_HISTORY);
+	forward = MIN(webkit_web_back_forward_list_get_forward_length(bfl),
+		HIBERNATE_HISTORY);
+
+	history = g_ptr_array_new_with_free_func(g_free);
+	for (i = -back; i <= forward; i++) {
+		item = webkit_web_back_forward_list_get_nth_item(bfl, i);
+		if (! item)
+			continue;
+		if (i == 0)
+			*current = history->len / 2;
+		g_ptr_array_add(history,
+			g_strdup(webkit_web_history_item_get_uri(item)));
+		g_ptr_array_add(history,
+			g_strdup(webkit_web_history_item_get_title(item)));
+	}
+	if (! history->len) {
+		g_ptr_array_free(history, TRUE);
+		return (NULL);
+	}
+	return (history);
+}
+
+static void
+tab_hibernate(struct tab *ttb)
+{
+	GtkAdjustment *adj;
+
+	ttb->history = back_forward_list(ttb->webview, &ttb->history_current);
+	if (! ttb->history)
+		return;
+
+	adj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(ttb->browser));
+	ttb->scroll_x = gtk_adjustment_get_value(adj);
+	adj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(ttb->browser));
+	ttb->scroll_y = gtk_adjustment_get_value(adj);
+
+	if (ttb->ui_source) {
+		g_source_remove(ttb->ui_source);
+		ttb->ui_source = 0;
+	}
+	gtk_widget_destroy(ttb->toolbar);
+	gtk_widget_destroy(ttb->browser);
+	ttb->toolbar = ttb->browser = NULL;
+	ttb->webview = NULL;
+}
+
+/* Called by tab_realize() to bring back a hibernated page */
+static void
+tab_restore(struct tab *ttb)
+{
+	WebKitWebBackForwardList *bfl;
+	WebKitWebHistoryItem *item;
+	GPtrArray *items;
+	gchar *title;
+	guint i;
+
+	/* The renderer rebuilds the list, the scroll position is lost */
+	if (ttb->renderer) {
+		for (i = 0; i + 1 < ttb->history->len; i += 2) {
+			title = g_strdelimit(g_strdup(g_ptr_array_index(ttb->history,
+				i + 1)), "\t\r\n", ' ');
+			renderer_send(ttb, "item\t%s\t%s\n",
+				(gchar *)g_ptr_array_index(ttb->history, i),
+				title ? title : "");
+			g_free(title);
+		}
+		renderer_send(ttb, "goto\t%u\n", ttb->history_current);
+
+		/* The list sent is the mirror until the renderer reports */
+		if (ttb->renderer->history)
+			g_ptr_array_free(ttb->renderer->history, TRUE);
+		ttb->renderer->history = ttb->history;
+		ttb->renderer->current = ttb->history_current;
+		ttb->history = NULL;
+		return;
+	}
+
+	bfl = webkit_web_view_get_back_forward_list(ttb->webview);
+	items = g_ptr_array_new_with_free_func(g_object_unref);
+	for (i = 0; i + 1 < ttb->history->len; i += 2) {
+		item = webkit_web_history_item_new_with_data(
+			g_ptr_array_index(ttb->history, i),
+			g_ptr_array_index(ttb->history, i + 1));
+		webkit_web_back_forward_list_add_item(bfl, item);
+		g_ptr_array_add(items, item);
+	}
+
+	ttb->restore_scroll = TRUE;
+	webkit_web_view_go_to_back_forward_item(ttb->webview,
+		g_ptr_array_index(items, ttb->history_current));
+
+	g_ptr_array_free(items, TRUE);
+	g_ptr_array_free(ttb->history, TRUE);
+	ttb->history = NULL;
+}
+
+/* Scroll back where the user left a restored page */
+static void
+tab_restore_scroll(struct tab *ttb)
+{
+	GtkAdjustment *adj;
+
+	ttb->restore_scroll = FALSE;
+	adj = gtk_scrolled_window_get_hadjustment(GTK_SCROLLED_WINDOW(ttb->browser));
+	gtk_adjustment_set_value(adj, ttb->scroll_x);
+	adj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(ttb->browser));
+	gtk_adjustment_set_value(adj, ttb->scroll_y);
+}
+
+/* Hibernate one tab per check while over budget */
+static gboolean
+hibernate_check_cb(gpointer data)
+{
+	struct tab *ttb, *lru = NULL;
+	GtkWidget *current;
+	gint64 idle;
+
+	if (memory_rss() <= memory_budget)
+		return TRUE;
+
+	current = gtk_notebook_get_nth_page(notebook,
+		gtk_notebook_get_current_page(notebook));
+	idle = g_get_monotonic_time() - HIBERNATE_IDLE * G_USEC_PER_SEC;
+
+	TAILQ_FOREACH(ttb, &tabs, entry) {
+		if (! ttb->webview || ttb->loading || ttb->vbox == current
+				|| ttb->pinned || ttb->last_used > idle)
+			continue;
+		if (! lru || ttb->last_used < lru->last_used)
+			lru = ttb;
+	}
+	if (lru)
+		tab_hibernate(lru);
+
+	return TRUE;
+}
+
+/*
+ *
+ * Session journal: session.log records the tabs and their history as
+ * navigation happens. Lines are appended, the journal is rewritten from
+ * the live tabs once stale lines pile up. On startup every tab comes
+ * back as a placeholder, only the focused one is loaded.
+ *
+ *   +id          tab opened
+ *   -id          tab closed
+ *   nid TAB pos TAB uri    navigation at a back/forward position
+ *   tid TAB title          title of the current entry
+ *   fid          tab shown
+ *
+ */
+
+struct session_entry {
+	guint			id;
+	GPtrArray		*history;
+	guint			current;
+};
+
+static void
+session_entry_free(struct session_entry *se)
+{
+	if (se->history)
+		g_ptr_array_free(se->history, TRUE);
+	g_free(se);
+}
+
+static void
+session_log(const gchar *format, ...)
+{
+	va_list args;
+	gchar *line;
+
+	if (session_fd < 0 || session_restoring)
+		return;
+
+	va_start(args, format);
+	line = g_strdup_vprintf(format, args);
+	va_end(args);
+	if (write(session_fd, line, strlen(line)) < 0)
+		g_warning("Can't write the session journal");
+	g_free(line);
+
+	if (++session_lines > 2 * session_base + SESSION_STALE
+			&& ! session_compact_id)
+		session_compact_id = g_idle_add(session_compact, NULL);
+}
+
+/* Journal lines of one tab, return the number of lines */
+static guint
+session_write_entry(GString *string, guint id, GPtrArray *history,
+	guint current)
+{
+	gchar *title;
+	guint i, lines = 1;
+
+	g_string_append_printf(string, "+%u\n", id);
+	if (! history)
+		return (lines);
+
+	for (i = 0; i + 1 < history->len; i += 2) {
+		g_string_append_printf(string, "n%u\t%u\t%s\n", id, i / 2,
+			(gchar *)g_ptr_array_index(history, i));
+		lines++;
+		if (g_ptr_array_index(history, i + 1)) {
+			title = g_strdelimit(g_strdup(g_ptr_array_index(history, i + 1)),
+				"\t\r\n", ' ');
+			g_string_append_printf(string, "t%u\t%s\n", id, title);
+			g_free(title);
+			lines++;
+		}
+	}
+	g_string_append_printf(string, "n%u\t%u\t%s\n", id, current,
+		(gchar *)g_ptr_array_index(history, current * 2));
+	return (lines + 1);
+}
+
+/* Rewrite the journal from the live tabs */
+static gboolean
+session_compact(gpointer data)
+{
+	struct tab *ttb;
+	GPtrArray *history;
+	GString *string;
+	gchar *file;
+	guint current, lines = 0;
+
+	session_compact_id = 0;
+	if (session_fd < 0)
+		return FALSE;
+
+	string = g_string_new(NULL);
+	TAILQ_FOREACH(ttb, &tabs, entry) {
+		if (ttb->webview) {
+			current = 0;
+			history = back_forward_list(ttb->webview, &current);
+			lines += session_write_entry(string, ttb->sid, history, current);
+			if (history)
+				g_ptr_array_free(history, TRUE);
+		} else if (ttb->renderer && ttb->renderer->history
+				&& ttb->renderer->history->len) {
+			/* The list mirrored from what the renderer reported */
+			lines += session_write_entry(string, ttb->sid,
+				ttb->renderer->history, ttb->renderer->current);
+		} else if (ttb->history) {
+			lines += session_write_entry(string, ttb->sid, ttb->history,
+				ttb->history_current);
+		} else {
+			g_string_append_printf(string, "+%u\n", ttb->sid);
+			lines++;
+			if (ttb->pending) {
+				g_string_append_printf(string, "n%u\t0\t%s\n", ttb->sid,
+					ttb->pending);
+				lines++;
+			}
+		}
+	}
+	if (session_focus) {
+		g_string_append_printf(string, "f%u\n", session_focus);
+		lines++;
+	}
+
+	file = SESSION_LOG;
+	if (g_file_set_contents(file, string->str, string->len, NULL)) {
+		g_chmod(file, 0600);
+		close(session_fd);
+		session_fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+		session_base = session_lines = lines;
+	}
+	g_string_free(string, TRUE);
+	g_free(file);
+	return FALSE;
+}
+
+/* Replay a navigation: same entry or a new one dropping the forward list */
+static void
+session_navigate(struct session_entry *se, guint pos, const gchar *uri)
+{
+	pos *= 2;
+	if (pos + 1 < se->history->len
+			&& ! g_strcmp0(g_ptr_array_index(se->history, pos), uri)) {
+		se->current = pos / 2;
+		return;
+	}
+	if (pos > se->history->len)
+		pos = se->history->len;
+	g_ptr_array_set_size(se->history, pos);
+	g_ptr_array_add(se->history, g_strdup(uri));
+	g_ptr_array_add(se->history, NULL);
+	se->current = pos / 2;
+}
+
+/* Replay the journal, return the open tabs in order */
+static GList*
+session_read(guint *focus, gboolean *partial)
+{
+	struct session_entry *se;
+	GHashTable *index;
+	GList *list = NULL;
+	gchar *file, *data, *line, *next, *arg, *uri;
+	guint id, pos;
+
+	file = SESSION_LOG;
+	if (! g_file_get_contents(file, &data, NULL, NULL)) {
+		g_free(file);
+		return (NULL);
+	}
+	index = g_hash_table_new(NULL, NULL);
+
+	/* Only complete lines, a crash may have cut the last one */
+	for (line = data; (next = strchr(line, '\n')); line = next) {
+		*next++ = '\0';
+		session_lines++;
+		id = strtoul(line + 1, &arg, 10);
+		if (! id)
+			continue;
+		if (*arg == '\t')
+			arg++;
+		session_next_id = MAX(session_next_id, id + 1);
+		se = g_hash_table_lookup(index, GUINT_TO_POINTER(id));
+
+		switch (line[0]) {
+		case '+':
+			if (se)
+				break;
+			se = g_new0(struct session_entry, 1);
+			se->id = id;
+			se->history = g_ptr_array_new_with_free_func(g_free);
+			g_hash_table_insert(index, GUINT_TO_POINTER(id), se);
+			list = g_list_prepend(list, se);
+		break;
+
+		case '-':
+			if (! se)
+				break;
+			g_hash_table_remove(index, GUINT_TO_POINTER(id));
+			list = g_list_remove(list, se);
+			session_entry_free(se);
+		break;
+
+		case 'n':
+			pos = strtoul(arg, &uri, 10);
+			if (se && *uri == '\t' && uri[1])
+				session_navigate(se, pos, uri + 1);
+		break;
+
+		case 't':
+			if (se && se->history->len) {
+				g_free(g_ptr_array_index(se->history, se->current * 2 + 1));
+				g_ptr_array_index(se->history, se->current * 2 + 1) =
+					g_strdup(arg);
+			}
+		break;
+
+		case 'f':
+			*focus = id;
+		break;
+		}
+	}
+	*partial = *line != '\0';
+	session_base = session_lines;
+
+	g_hash_table_destroy(index);
+	g_free(data);
+	g_free(file);
+	return (g_list_reverse(list));
+}
+
+/* Take the session of this user, one process at a time */
+static gboolean
+session_open(void)
+{
+	gchar *dir, *file;
+	int lock;
+
+	dir = CONFIG;
+	g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+
+	/* The lock is held until exit */
+	file = SESSION_LOCK;
+	lock = open(file, O_RDWR | O_CREAT, 0600);
+	g_free(file);
+	if (lock < 0)
+		return FALSE;
+	if (flock(lock, LOCK_EX | LOCK_NB) < 0) {
+		close(lock);
+		return FALSE;
+	}
+
+	file = SESSION_LOG;
+	session_fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	g_free(file);
+	return (session_fd >= 0);
+}
+
+/* Bring back the tabs as placeholders, load the focused one if shown */
+static gboolean
+session_restore(gboolean show)
+{
+	struct session_entry *se;
+	struct tab *ttb, *focus_tab = NULL;
+	GList *list, *l;
+	gboolean partial = FALSE;
+	guint focus = 0;
+
+	list = session_read(&focus, &partial);
+	session_restoring = TRUE;
+	for (l = list; l; l = l->next) {
+		se = l->data;
+		if (! se->history->len)
+			continue;
+
+		ttb = create_new_tab(g_ptr_array_index(se->history, se->current * 2),
+			FALSE);
+		g_free(ttb->pending);
+		ttb->pending = NULL;
+		ttb->sid = se->id;
+		ttb->history = se->history;
+		ttb->history_current = se->current;
+		se->history = NULL;
+
+		if (g_ptr_array_index(ttb->history, se->current * 2 + 1))
+			gtk_label_set_text(GTK_LABEL(ttb->label),
+				g_ptr_array_index(ttb->history, se->current * 2 + 1));
+		if (! focus_tab || se->id == focus)
+			focus_tab = ttb;
+	}
+	session_restoring = FALSE;
+	g_list_free_full(list, (GDestroyNotify)session_entry_free);
+
+	/* Next appends must start on a new line */
+	if (partial)
+		session_compact(NULL);
+
+	if (! focus_tab)
+		return FALSE;
+	if (show) {
+		gtk_notebook_set_current_page(notebook,
+			gtk_notebook_page_num(notebook, focus_tab->vbox));
+		tab_realize(focus_tab);
+	}
+	return TRUE;
+}
+
+/*
+ *
+ * Tab loading: background tabs are placeholders holding only a URL and
+ * a title. Their webview is built when the tab is first selected or
+ * when the load scheduler has a free slot. The visible tab never waits.
+ *
+ */
+
+static void
+load_schedule(void)
+{
+	struct tab *ttb;
+
+	while (loads_active < load_limit
+			&& (ttb = g_queue_pop_head(&load_queue)))
+		tab_realize(ttb);
+}
+
+/* Build toolbar and browser of a placeholder tab and load its URL */
+void
+tab_realize(struct tab *ttb)
+{
+	gchar *pending = ttb->pending;
+
+	if (ttb->browser)
+		return;
+
+	ttb->pending = NULL;
+	g_queue_remove(&load_queue, ttb);
+
+	/* The page shown, or pinned, starts at full speed */
+	if (ttb->pinned || ttb->vbox == gtk_notebook_get_nth_page(notebook,
+			gtk_notebook_get_current_page(notebook)))
+		ttb->throttled = FALSE;
+
+	/* Toolbar */
+	ttb->toolbar = create_toolbar(ttb);
+	gtk_box_pack_start(GTK_BOX(ttb->vbox), ttb->toolbar,
+		FALSE, FALSE, 0);
+	trace_phase("create_toolbar");
+
+	/* Browser */
+	ttb->browser = create_browser(ttb);
+	gtk_box_pack_start(GTK_BOX(ttb->vbox), ttb->browser, TRUE, TRUE, 0);
+	trace_phase("create_browser");
+
+	gtk_widget_show_all(ttb->vbox);
+	if (notoolbar)
+		gtk_widget_hide(ttb->toolbar);
+
+	if (ttb->history) {
+		tab_restore(ttb);
+	} else if (pending) {
+		ttb->loading = 1;
+		loads_active++;
+		tab_load_uri(ttb, pending);
+		trace_phase("load_uri");
+		g_free(pending);
+	}
+}
+
+/* Load tracking for the scheduler */
+void
+tab_load_status(struct tab *ttb, WebKitLoadStatus status)
+{
+	switch (status) {
+	case WEBKIT_LOAD_PROVISIONAL:
+		if (! ttb->loading) {
+			ttb->loading = 1;
+			loads_active++;
+		}
+	break;
+
+	case WEBKIT_LOAD_FINISHED:
+	case WEBKIT_LOAD_FAILED:
+		if (ttb->loading) {
+			ttb->loading = 0;
+			loads_active--;
+			load_schedule();
+		}
+	break;
+
+	default:
+	break;
+	}
+}
+
+static struct tab*
+tab_from_page(gint page_num)
+{
+	GtkWidget *vbox = gtk_notebook_get_nth_page(notebook, page_num);
+	struct tab *ttb;
+
+	TAILQ_FOREACH(ttb, &tabs, entry)
+		if (ttb->vbox == vbox)
+			return (ttb);
+	return (NULL);
+}
+
+/* A placeholder or hibernated tab is loaded as soon as it is shown */
+static void
+switch_page_cb(GtkNotebook *nb, gpointer page, guint page_num, gpointer data)
+{
+	struct tab *ttb;
+	gint64 now = g_get_monotonic_time();
+
+	throttle_switch(tab_from_page(gtk_notebook_get_current_page(nb)),
+		tab_from_page(page_num));
+
+	/* Restored tabs stay placeholders until the session is back */
+	if (session_restoring)
+		return;
+
+	/* Still the previous page: it was in use until now */
+	if ((ttb = tab_from_page(gtk_notebook_get_current_page(nb))))
+		ttb->last_used = now;
+
+	if ((ttb = tab_from_page(page_num))) {
+		ttb->last_used = now;
+		if (! ttb->browser)
+			tab_realize(ttb);
+		if (ttb->sid != session_focus) {
+			session_focus = ttb->sid;
+			session_log("f%u\n", ttb->sid);
+		}
+	}
+}
+
 void
 close_tab(struct tab *ttb)
 {
@@ -495,11 +2296,25 @@ close_tab(struct tab *ttb)
 		return;
 
 	TAILQ_REMOVE(&tabs, ttb, entry);
+	session_log("-%u\n", ttb->sid);
 	if (TAILQ_EMPTY(&tabs))
 		create_new_tab(NULL, 1);
 
-	webkit_web_view_stop_loading(ttb->webview);
+	if (ttb->ui_source)
+		g_source_remove(ttb->ui_source);
+	g_queue_remove(&load_queue, ttb);
+	if (ttb->loading) {
+		loads_active--;
+		load_schedule();
+	}
+	if (ttb->webview)
+		webkit_web_view_stop_loading(ttb->webview);
+	if (ttb->renderer)
+		renderer_free(ttb);
 	gtk_widget_destroy(ttb->vbox);
+	if (ttb->history)
+		g_ptr_array_free(ttb->history, TRUE);
+	g_free(ttb->pending);
 	g_free(ttb);
 }
 
@@ -510,15 +2325,17 @@ close_tab_cb(GtkWidget *event_box, GdkEventButton *event, struct tab *ttb)
 	return (FALSE);
 }
 
-void
+struct tab *
 create_new_tab(char *title, int focus)
 {
 	struct tab	*ttb;
 	int	load = 1;
-	char *newuri = NULL;
-	GtkWidget *image, *hbox, *event_box;
+	GtkWidget *image, *hbox, *event_box, *label_box;
 
 	ttb = g_malloc0(sizeof *ttb);
+	ttb->last_used = g_get_monotonic_time();
+	ttb->throttled = ! focus;
+	ttb->sid = session_next_id++;
 	TAILQ_INSERT_TAIL(&tabs, ttb, entry);
 
 	if (title == NULL) {
@@ -526,6 +2343,10 @@ create_new_tab(char *title, int focus)
 		load = 0;
 	}
 
+	session_log("+%u\n", ttb->sid);
+	if (load)
+		session_log("n%u\t0\t%s\n", ttb->sid, title);
+
 	ttb->vbox = gtk_vbox_new(FALSE, 0);
 
 	/* Tab title, spinner & close button */
@@ -537,23 +2358,27 @@ create_new_tab(char *title, int focus)
 	event_box = gtk_event_box_new();
 	gtk_container_add(GTK_CONTAINER(event_box), image);
 
+	/* Right click on the title to pin the tab */
+	label_box = gtk_event_box_new();
+	gtk_event_box_set_visible_window(GTK_EVENT_BOX(label_box), FALSE);
+	gtk_container_add(GTK_CONTAINER(label_box), ttb->label);
+	g_signal_connect(G_OBJECT(label_box), "button_press_event",
+		G_CALLBACK(throttle_label_cb), ttb);
+
 	gtk_widget_set_size_request(ttb->label, 160, -1);
 	gtk_box_pack_start(GTK_BOX(hbox), ttb->spinner, FALSE, FALSE, 0);
-	gtk_box_pack_start(GTK_BOX(hbox), ttb->label, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(hbox), label_box, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(hbox), event_box, FALSE, FALSE, 0);
 
-	/* Toolbar */
-	ttb->toolbar = create_toolbar(ttb);
-	gtk_box_pack_start(GTK_BOX(ttb->vbox), ttb->toolbar,
-		FALSE, FALSE, 0);
-
-	/* Browser */
-	ttb->browser = create_browser(ttb);
-	gtk_box_pack_start(GTK_BOX(ttb->vbox), ttb->browser, TRUE, TRUE, 0);
+	/* Background tab: only a placeholder until shown or scheduled */
+	if (load && ! focus)
+		ttb->pending = g_strdup(title);
+	else
+		tab_realize(ttb);
 
 	/* Show all widgets */
 	gtk_widget_show_all(hbox);
-	gtk_widget_show_all(ttb->vbox);
+	gtk_widget_show(ttb->vbox);
 	ttb->tab_id = gtk_notebook_append_page(notebook, ttb->vbox, hbox);
 
 	/* Reorderable notebook tabs */
@@ -563,20 +2388,59 @@ create_new_tab(char *title, int focus)
 	g_signal_connect(G_OBJECT(event_box), "button_press_event",
 		G_CALLBACK(close_tab_cb), ttb);
 
-	if (notoolbar)
-		gtk_widget_hide(ttb->toolbar);
-
 	if (focus) {
 		gtk_notebook_set_current_page(notebook, ttb->tab_id);
 	}
 
-	if (load)
-		webkit_web_view_load_uri(ttb->webview, title);
-	else
+	/* A placeholder shown by the notebook has already been loaded,
+	 * restored tabs are only loaded when shown */
+	if (ttb->pending) {
+		if (! session_restoring) {
+			g_queue_push_tail(&load_queue, ttb);
+			load_schedule();
+		}
+	} else if (load && focus) {
+		tab_load_uri(ttb, title);
+		trace_phase("load_uri");
+	} else if (! load) {
 		gtk_widget_grab_focus(GTK_WIDGET(ttb->urientry));
+	}
+	return (ttb);
+}
+
+/*
+ *
+ * Single instance: each request line of the socket opens a new tab,
+ * the first one is shown.
+ *
+ */
+
+void
+instance_open(gchar *line, gboolean focus)
+{
+	gchar *location;
+
+	if (! (location = strchr(line, '\t')) || ! location[1])
+		return;
+	create_new_tab(location + 1, focus);
+	gtk_window_present(GTK_WINDOW(tazweb_window));
+}
 
-	if (newuri)
-		free(newuri);
+/* Hand the urls over to a running TazWeb NG, one line each */
+static gboolean
+instance_request(int argc, char **argv)
+{
+	GString *request;
+	gboolean done;
+
+	request = g_string_new(NULL);
+	if (! argc)
+		g_string_append_printf(request, "\t%s\n", WEBHOME);
+	while (argc--)
+		g_string_append_printf(request, "\t%s\n", *argv++);
+	done = instance_handoff("tazweb-ng", request->str);
+	g_string_free(request, TRUE);
+	return (done);
 }
 
 /* Main window */
@@ -609,17 +2473,20 @@ create_canvas(void)
 		gtk_notebook_set_show_tabs(GTK_NOTEBOOK(notebook), FALSE);
 
 	gtk_notebook_set_scrollable(notebook, TRUE);
+	g_signal_connect(notebook, "switch-page",
+		G_CALLBACK(switch_page_cb), NULL);
 	gtk_box_pack_start(GTK_BOX(vbox), GTK_WIDGET(notebook), TRUE, TRUE, 0);
 
 	tazweb_window = create_window();
 	gtk_container_add(GTK_CONTAINER(tazweb_window), vbox);
 	gtk_widget_show_all(tazweb_window);
 	
-	/* Handle cookies */
+	/* Handle cookies, renderers have their own cache */
 	if (! private) {
 		session = webkit_get_default_session();
-		snprintf(COOKIES, sizeof COOKIES, "%s", COOKIES);
 		cookies_setup();
+		if (! process_tabs)
+			cache_setup();
 	}
 	
 	/* Fullscreen for Kiosk mode */
@@ -641,6 +2508,19 @@ Options:\n\
   -k  --kiosk           Fullscreen, no bookmarks and download support\n\
   -r  --raw             Raw webkit window without toolbar and menu\n\
   -s  --small           Small Tazweb window for tiny web applications\n\
+  -l  --loads [n]       Background tabs loading at once (0: when shown)\n\
+  -m  --memory [MB]     Hibernate idle tabs over this memory budget\n\
+  -w  --pool [n]        Webviews prepared ahead for new tabs\n\
+  -c  --cache [MB]      Size of the disk cache (default: 50, 0: none),\n\
+                        shared by up to 4 processes, others run uncached\n\
+  -P  --profile [name]  Settings profile: lowmem, kiosk, throughput or one\n\
+                        of ~/.config/tazweb/tazweb.conf\n\
+  -H  --har [dir]       Record each page load as a HAR file in dir\n\
+  -E  --trace-events [dir] Record page loads as Chrome trace events\n\
+      --stats [file]    Append memory and resource stats as JSON lines\n\
+      --nosession       Do not restore or record the session\n\
+      --newinstance     Do not open urls in a running TazWeb\n\
+      --process-tabs    Run each tab in its own renderer process\n\
       --notoolbar       Disable the top toolbar\n\
       --nomenu          Disable TazWeb contextual menu\n\n");
     
@@ -653,14 +2533,23 @@ main(int argc, char *argv[])
 	//textdomain (GETTEXT_PACKAGE);
 	int	focus = 1;
 	int c;
+	gboolean restored = FALSE;
+
+	trace_open("tazweb-ng");
+	trace_phase("main");
+
+	/* Config file and profile, the options can override them */
+	config_load(argc, argv);
+	config_apply();
+	trace_phase("config_file");
 
 	/* Cmdline parsing with getopt_long to handle --option or -o */
 	while (1) {
 		static struct option long_options[] =
 		{
 			/* Set flag */
-			{ "notoolbar",  no_argument,		&notoolbar, 1 },
-			{ "nomenu",     no_argument,		&nomenu,    1 },
+			{ "newinstance", no_argument,		&newinstance, 1 },
+			{ "process-tabs", no_argument,		&process_tabs, 1 },
 			/* No flag */
 			{ "help",       no_argument,		0, 'h' },
 			{ "private",    no_argument,		0, 'p' },
@@ -668,11 +2557,23 @@ main(int argc, char *argv[])
 			{ "kiosk",      no_argument,		0, 'k' },
 			{ "raw",        no_argument,		0, 'r' },
 			{ "small",		no_argument,		0, 's' },
+			{ "loads",		required_argument,	0, 'l' },
+			{ "memory",		required_argument,	0, 'm' },
+			{ "pool",		required_argument,	0, 'w' },
+			{ "har",		required_argument,	0, 'H' },
+			{ "trace-events", required_argument,	0, 'E' },
+			{ "cache",		required_argument,	0, 'c' },
+			{ "stats",		required_argument,	0, 'S' },
+			{ "profile",	required_argument,	0, 'P' },
+			{ "renderer-fd", required_argument,	0, 'R' },
+			{ "notoolbar",  no_argument,		0, 't' },
+			{ "nomenu",     no_argument,		0, 'M' },
+			{ "nosession",  no_argument,		0, 'n' },
 			{ 0, 0, 0, 0}
 		};
 
 		int index = 0;
-		c = getopt_long (argc, argv, "hpu:krs", long_options, &index);
+		c = getopt_long (argc, argv, "hpu:krsl:m:w:H:E:c:P:", long_options, &index);
 
 		/* Detect the end of the options */
 		if (c == -1)
@@ -702,11 +2603,67 @@ main(int argc, char *argv[])
 			case 'r':
 				notoolbar++;
 				nomenu++;
+				config_option = TRUE;
+				break;
+
+			case 't':
+				notoolbar++;
+				config_option = TRUE;
+				break;
+
+			case 'M':
+				nomenu++;
+				config_option = TRUE;
+				break;
+
+			case 'n':
+				nosession++;
+				config_option = TRUE;
 				break;
 
 			case 's':
 				width = 640;
 				height = 480;
+				config_option = TRUE;
+				break;
+
+			case 'l':
+				load_limit = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'm':
+				memory_budget = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'w':
+				pool_size = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'H':
+			case 'E':
+				har_dir = optarg;
+				har_format = c == 'E' ? HAR_TRACE : 0;
+				break;
+
+			case 'c':
+				cache_size = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'S':
+				stats_file = optarg;
+				config_option = TRUE;
+				break;
+
+			case 'P':
+				/* Already loaded by config_load() */
+				break;
+
+			case 'R':
+				renderer_fd = atoi(optarg);
 				break;
 
 			default:
@@ -715,25 +2672,83 @@ main(int argc, char *argv[])
 		}
 	}
 
+	/* Out-of-process tabs run this same program as renderer */
+	if (renderer_fd >= 0)
+		return (renderer_main());
+	if (process_tabs) {
+		if (! (renderer_exe = g_file_read_link("/proc/self/exe", NULL)))
+			renderer_exe = g_strdup(argv[0]);
+		signal(SIGPIPE, SIG_IGN);
+	}
+
 	argc -= optind;
 	argv += optind;
 
+	/* A running TazWeb NG opens the urls in tabs of its window, the
+	 * other options are global to a process and need their own */
+	if (! private && ! kiosk && ! useragent && ! har_dir && ! process_tabs
+			&& ! config_option && ! newinstance && instance_request(argc, argv))
+		return (0);
+	trace_phase("instance");
+
 	/* FreeBSD style! */
 	TAILQ_INIT(&tabs);
 
+	/* Nothing is recorded on disk in private mode */
+	if (private)
+		har_dir = NULL;
+	if (har_dir && g_mkdir_with_parents(har_dir, 0700) < 0) {
+		g_warning("Can't create: %s", har_dir);
+		har_dir = NULL;
+	}
+
 	/* Initialize GTK */
 	gtk_init(&argc, &argv);
+	config_webkit();
+	config_session(webkit_get_default_session());
+	trace_phase("gtk_init");
+
+	/* Content filter lists and site rules, renderers map their own */
+	if (! process_tabs) {
+		filter_load();
+		site_load();
+	}
+	trace_phase("filter");
 	create_canvas();
+	trace_phase("create_canvas");
+
+	/* Previous session, shown only without urls */
+	if (! private && ! nosession && session_open())
+		restored = session_restore(argc == 0);
 
-	/* Open all urls in a new tab */
+	/* Open all urls in a new tab, the first one is shown over a session */
 	while (argc) {
-		create_new_tab(argv[0], FALSE);
+		create_new_tab(argv[0], restored && focus);
 		focus = 0;
 		argc--;
 		argv++;
 	}
-	if (focus == 1)
+	if (focus == 1 && ! restored)
 		create_new_tab(WEBHOME, 1);
+	trace_phase("tabs");
+
+	if (memory_budget > 0)
+		g_timeout_add_seconds(HIBERNATE_CHECK, hibernate_check_cb, NULL);
+
+	/* Renderers build their own webview */
+	if (! process_tabs) {
+		pool_fill();
+		g_timeout_add_seconds(POOL_CHECK, pool_check_cb, NULL);
+	}
+
+	/* Most used hosts are prepared once the first tab is started */
+	if (! private && ! process_tabs)
+		g_idle_add_full(G_PRIORITY_LOW, prefetch_bookmarks_cb, NULL, NULL);
+	g_idle_add_full(G_PRIORITY_LOW, completion_init_cb, NULL, NULL);
+	if (! private)
+		history_open();
+	if (stats_file)
+		g_timeout_add_seconds(STATS_INTERVAL, stats_write_cb, NULL);
 
 	gtk_main();
 
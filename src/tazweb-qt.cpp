@@ -8,10 +8,62 @@
  */
 #include <QtGui>
 #include <QtWebKit>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+/* Startup trace: same JSON lines as TAZWEB_TRACE in tazweb.c */
+static FILE *trace;
+static long long trace_start;
+
+static long long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void trace_open()
+{
+	const char *file = getenv("TAZWEB_TRACE");
+	unsigned long long start;
+	struct timespec ts;
+	char buf[1024], *p;
+	FILE *fp;
+
+	if (!file || !*file) return;
+	trace = strcmp(file, "-") ? fopen(file, "a") : stderr;
+	trace_start = now_us();
+	/* Process start, field 22 of /proc/self/stat (10 ms resolution),
+	 * counted from boot with the time suspended: CLOCK_BOOTTIME */
+	if ((fp = fopen("/proc/self/stat", "r"))) {
+		if (fgets(buf, sizeof(buf), fp) && (p = strrchr(buf, ')'))
+			&& sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+				"%*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &start) == 1
+			&& clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+			long long age = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000
+				- (long long)start * 1000000LL / sysconf(_SC_CLK_TCK);
+			if (age >= 0 && age < 60000000LL)
+				trace_start -= age; }
+		fclose(fp); }
+}
+
+static void trace_phase(const char *phase)
+{
+	if (!trace) return;
+	fprintf(trace, "{\"prog\":\"tazweb-qt\",\"phase\":\"%s\",\"us\":%lld}\n",
+		phase, now_us() - trace_start);
+	fflush(trace);
+}
 
 int main(int argc, char** argv)
 {
+	trace_open();
+	trace_phase("main");
 	QApplication app(argc, argv);
+	trace_phase("app_init");
 	QApplication::setWindowIcon(QIcon::fromTheme("tazweb"));
 	QFile file(QDir::homePath() + "/.config/slitaz/subox.conf");
 	QString msg, line;
@@ -48,6 +100,14 @@ int main(int argc, char** argv)
 	//view.settings()->setAttribute(QWebSettings::ZoomTextOnly, true);
 	//view.setTextSizeMultiplier(1);
 	view.showMaximized();
+	trace_phase("show");
 	view.load(url);
+	trace_phase("load_uri");
+	/* The trace ends with the first page, see 'make bench-startup' */
+	if (trace && getenv("TAZWEB_TRACE_QUIT")) {
+		QObject::connect(&view, SIGNAL(loadFinished(bool)), &app, SLOT(quit()));
+		int ret = app.exec();
+		trace_phase("finished");
+		return ret; }
 	return app.exec();
 }
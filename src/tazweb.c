@@ -9,44 +9,38 @@
  *
  */
 
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <getopt.h>
-#include <glib.h>
-#include <glib/gi18n.h>
 
-#include <gtk/gtk.h>
-#include <webkit/webkit.h>
-#include <libsoup/soup.h>
+#include "tazweb.h"
 
 #define VERSION			"1.12"
-#define GETTEXT_PACKAGE	"tazweb"
-#define WEBHOME			"file:///usr/share/webhome/index.html"
-#define SEARCH			"http://duckduckgo.com/?q=%s&t=slitaz"
-#define HOME			g_get_home_dir()
-#define CONFIG			g_strdup_printf("%s/.config/tazweb", HOME)
-#define BOOKMARKS		g_strdup_printf("%s/bookmarks.txt", CONFIG)
-#define COOKIES			g_strdup_printf("%s/cookies.txt", CONFIG)
-#define DOWNLOADS		g_strdup_printf("%s/Downloads", HOME)
-
-/* User agent string */
-#define UA_TAZWEB		g_strdup_printf("TazWeb/%s (X11; SliTaz GNU/Linux)", VERSION)
-#define UA_COMPAT		"Mozilla/5.0 AppleWebKit/535.22+"
-#define UA				g_strdup_printf("%s %s", UA_TAZWEB, UA_COMPAT)
 
+const gchar		*tazweb_version	= VERSION;
 int		width			= 800;
 int		height			= 600;
 int		private			= 0;
 
-static gchar			*useragent;
+gchar					*useragent;
 static gboolean		notoolbar;
 static gboolean		nomenu;
 static gboolean		kiosk;
+static gboolean		nosession;
+static gboolean		newinstance;
 
 static GtkWidget*		create_window(WebKitWebView** newwebview);
+static void				downloads_save(void);
+static void				download_page_status(WebKitWebView *webview);
+static void				session_load_status(WebKitWebView *webview);
+static void				session_window_close(GtkWidget *window);
+static void				supervise_uri(const gchar *uri);
 static GtkWidget		*tazweb_window, *vbox, *browser, *toolbar;
 static WebKitWebView	*webview;
 static WebKitWebFrame	*frame;
-static SoupSession		*session;
-static SoupCookieJar	*cookiejar;
+SoupSession				*session;
+SoupCookieJar			*cookiejar;
 static gint count		= 0;
 const gchar*			uri;
 
@@ -67,36 +61,81 @@ check_requested_uri()
 		: g_strdup_printf("http://%s", uri);
 }
 
-/* Update title */
+/* Title updates of a window are coalesced into one per frame */
+#define UI_FRAME		40
+
+struct title_update {
+	WebKitWebView	*webview;
+	gchar			*title;
+	guint			source;
+};
+
 static void
-update_title(GtkWindow* window, WebKitWebView* webview)
+title_update_free(struct title_update *tu)
+{
+	if (tu->source)
+		g_source_remove(tu->source);
+	g_free(tu->title);
+	g_free(tu);
+}
+
+/* Update title, only if the visible text changed */
+static gboolean
+update_title(GtkWidget* window)
 {
+	struct title_update *tu;
 	GString *string;
-	gdouble progress;
+	gint progress;
 	gchar *title;
 
-	string = g_string_new(webkit_web_view_get_title(webview));
-	progress = webkit_web_view_get_progress(webview) * 100;
+	tu = g_object_get_data(G_OBJECT(window), "title-update");
+	tu->source = 0;
+
+	string = g_string_new(webkit_web_view_get_title(tu->webview));
+	progress = webkit_web_view_get_progress(tu->webview) * 100;
 	if (progress < 100)
-		g_string_append_printf(string, " [ %f%% ] ", progress);
+		g_string_append_printf(string, " [ %d%% ] ", progress);
 
 	title = g_string_free(string, FALSE);
-	gtk_window_set_title(window, title);
-	g_free(title);
+	if (g_strcmp0(title, tu->title) != 0) {
+		gtk_window_set_title(GTK_WINDOW(window), title);
+		g_free(tu->title);
+		tu->title = title;
+	} else {
+		g_free(title);
+	}
+	return FALSE;
+}
+
+static void
+queue_title_update(GtkWidget* window, WebKitWebView* webview)
+{
+	struct title_update *tu;
+
+	tu = g_object_get_data(G_OBJECT(window), "title-update");
+	if (! tu) {
+		tu = g_new0(struct title_update, 1);
+		g_object_set_data_full(G_OBJECT(window), "title-update", tu,
+			(GDestroyNotify)title_update_free);
+	}
+	tu->webview = webview;
+	if (! tu->source)
+		tu->source = g_timeout_add(UI_FRAME, (GSourceFunc)update_title,
+			window);
 }
 
 /* Get the page title */
 static void
 notify_title_cb(WebKitWebView* webview, GParamSpec* pspec, GtkWidget* window)
 {
-	update_title(GTK_WINDOW(window), webview);
+	queue_title_update(window, webview);
 }
 
 /* Request progress in window title */
 static void
 notify_progress_cb(WebKitWebView* webview, GParamSpec* pspec, GtkWidget* window)
 {
-	update_title(GTK_WINDOW(window), webview);
+	queue_title_update(window, webview);
 }
 
 /* Notify url entry */
@@ -109,14 +148,38 @@ notify_load_status_cb(WebKitWebView* webview, GParamSpec* pspec, GtkWidget* urie
 		if (uri)
 			gtk_entry_set_text(GTK_ENTRY(urientry), uri);
 	}
+
+	/* Visited pages go to the history and the URL completion */
+	if (webkit_web_view_get_load_status(webview) == WEBKIT_LOAD_COMMITTED) {
+		history_visit(webkit_web_view_get_uri(webview));
+		supervise_uri(webkit_web_view_get_uri(webview));
+	}
+	if (webkit_web_view_get_load_status(webview) == WEBKIT_LOAD_FINISHED)
+		history_title(webkit_web_view_get_uri(webview),
+			webkit_web_view_get_title(webview));
+	session_load_status(webview);
+	download_page_status(webview);
+	trace_load_status(webkit_web_view_get_load_status(webview));
 }
 
 /* Destroy the window */
 static void
 destroy_cb(GtkWidget* widget, GtkWindow* window)
 {
-	if (g_atomic_int_dec_and_test(&count))
+	/* No pending title update on a destroyed window */
+	g_object_set_data(G_OBJECT(widget), "title-update", NULL);
+	session_window_close(widget);
+
+	if (g_atomic_int_dec_and_test(&count)) {
+		instance_close();
+		downloads_save();
+		cookies_flush(NULL);
+		cache_save();
+		history_flush(GINT_TO_POINTER(TRUE));
+		prefetch_report();
+		filter_report();
 		gtk_main_quit();
+	}
 }
 
 /* Show page source */
@@ -140,7 +203,8 @@ uri_entry_cb(GtkWidget* urientry, WebKitWebView* webview)
 	uri = gtk_entry_get_text(GTK_ENTRY(urientry));
 	g_assert(uri);
 	check_requested_uri();
-	webkit_web_view_load_uri(webview, uri);
+	prefetch_count(uri);
+	scheme_load(webview, uri);
 }
 
 /* Search entry and icon callback function */
@@ -149,7 +213,8 @@ search_web(GtkWidget* search, WebKitWebView* webview)
 {
 	uri = g_strdup_printf(SEARCH, gtk_entry_get_text(GTK_ENTRY(search)));
 	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	prefetch_count(uri);
+	scheme_load(webview, uri);
 }
 
 static void
@@ -165,6 +230,1016 @@ search_icon_press_cb(GtkWidget *search, GtkEntryIconPosition pos,
 	search_web(search, webview);
 }
 
+/*
+ *
+ * Download manager
+ *
+ * Downloads run on the shared SoupSession: large files served with
+ * Accept-Ranges are fetched in parallel Range segments, bandwidth is
+ * capped to download-rate KB/s with a token bucket while pages load so
+ * they are not starved, and the queue is saved to downloads.txt to be
+ * resumed on next start.
+ *
+ */
+
+#define DOWNLOAD_SEGMENTS	4
+#define DOWNLOAD_SPLIT		(4 * 1024 * 1024)
+#define DOWNLOAD_RATE		512
+#define DOWNLOAD_TICK		100
+#define DOWNLOADS_QUEUE		g_strdup_printf("%s/downloads.txt", CONFIG)
+
+struct download;
+
+struct segment {
+	struct download	*dl;
+	SoupMessage		*msg;
+	goffset			offset;
+	goffset			end;
+};
+
+struct download {
+	gchar			*uri;
+	gchar			*file;
+	goffset			size;
+	int				fd;
+	guint			nseg;
+	guint			active;
+	gboolean		failed;
+	gboolean		resumed;
+	GtkWidget		*bar;
+	struct segment	seg[DOWNLOAD_SEGMENTS];
+};
+
+static GList			*downloads;
+static GSList			*downloads_paused;
+static GtkWidget		*downloads_box;
+static gint64			download_budget;
+static gint				download_rate	= DOWNLOAD_RATE;
+static guint			download_timer;
+static guint			download_ticks;
+static guint			download_pages;
+
+static void download_segment_start(struct segment *seg);
+static gboolean download_tick_cb(gpointer data);
+
+/* Save unfinished downloads: uri|file|size|offset-end,... */
+static void
+downloads_save(void)
+{
+	struct download *dl;
+	GString *string;
+	GList *l;
+	gchar *file;
+	guint i;
+
+	/* Nothing is recorded in private mode */
+	if (private)
+		return;
+
+	string = g_string_new(NULL);
+	for (l = downloads; l; l = l->next) {
+		dl = l->data;
+		if (dl->failed)
+			continue;
+		g_string_append_printf(string, "%s|%s|%" G_GINT64_FORMAT "|",
+			dl->uri, dl->file, (gint64)dl->size);
+		for (i = 0; i < dl->nseg; i++)
+			g_string_append_printf(string, "%s%" G_GINT64_FORMAT
+				":%" G_GINT64_FORMAT, i ? "," : "",
+				(gint64)dl->seg[i].offset, (gint64)dl->seg[i].end);
+		g_string_append_c(string, '\n');
+	}
+
+	file = DOWNLOADS_QUEUE;
+	g_file_set_contents(file, string->str, string->len, NULL);
+	g_string_free(string, TRUE);
+	g_free(file);
+}
+
+/* Bytes received so far */
+static goffset
+download_received(struct download *dl)
+{
+	goffset left = 0;
+	guint i;
+
+	if (! dl->size || ! dl->nseg)
+		return dl->nseg ? dl->seg[0].offset : 0;
+	for (i = 0; i < dl->nseg; i++)
+		left += dl->seg[i].end + 1 - dl->seg[i].offset;
+	return dl->size - left;
+}
+
+static void
+download_update_bar(struct download *dl)
+{
+	gchar *text, *name;
+	goffset done;
+
+	if (! dl->bar)
+		return;
+
+	name = g_path_get_basename(dl->file);
+	done = download_received(dl);
+	if (dl->size) {
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(dl->bar),
+			CLAMP((gdouble)done / dl->size, 0.0, 1.0));
+		text = g_strdup_printf("%s - %d%%", name,
+			(int)(done * 100 / dl->size));
+	} else {
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(dl->bar));
+		text = g_strdup_printf("%s - %" G_GINT64_FORMAT " KB", name,
+			(gint64)done / 1024);
+	}
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(dl->bar), text);
+	g_free(text);
+	g_free(name);
+}
+
+static gboolean
+download_bar_remove_cb(GtkWidget *bar)
+{
+	gtk_widget_destroy(bar);
+	g_object_unref(bar);
+	return FALSE;
+}
+
+static void
+download_finish(struct download *dl)
+{
+	downloads = g_list_remove(downloads, dl);
+	downloads_save();
+	close(dl->fd);
+
+	if (dl->bar) {
+		download_update_bar(dl);
+		if (dl->failed)
+			gtk_progress_bar_set_text(GTK_PROGRESS_BAR(dl->bar),
+				_("Download failed"));
+		else
+			gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(dl->bar), 1.0);
+		g_timeout_add_seconds(4, (GSourceFunc)download_bar_remove_cb,
+			dl->bar);
+	}
+	g_free(dl->uri);
+	g_free(dl->file);
+	g_free(dl);
+}
+
+static void
+download_got_headers_cb(SoupMessage *msg, struct segment *seg)
+{
+	/* A ranged request must get a partial answer, except a single
+	 * stream that the server restarts from the beginning */
+	if (msg->status_code == SOUP_STATUS_OK && seg->offset > 0) {
+		if (seg->dl->nseg == 1 && seg->end < 0) {
+			seg->offset = 0;
+			if (ftruncate(seg->dl->fd, 0) < 0)
+				seg->dl->failed = TRUE;
+		} else {
+			seg->dl->failed = TRUE;
+			soup_session_cancel_message(session, msg, SOUP_STATUS_CANCELLED);
+		}
+	}
+}
+
+static void
+download_got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk,
+		struct segment *seg)
+{
+	if (! SOUP_STATUS_IS_SUCCESSFUL(msg->status_code))
+		return;
+	if (pwrite(seg->dl->fd, chunk->data, chunk->length, seg->offset) < 0) {
+		seg->dl->failed = TRUE;
+		soup_session_cancel_message(session, msg, SOUP_STATUS_CANCELLED);
+		return;
+	}
+	seg->offset += chunk->length;
+
+	/* Token bucket: wait for the next tick when the budget is spent */
+	download_budget -= chunk->length;
+	if (download_budget <= 0 && download_rate > 0 && download_pages) {
+		soup_session_pause_message(session, msg);
+		downloads_paused = g_slist_prepend(downloads_paused, seg);
+	}
+}
+
+static void
+download_segment_done_cb(SoupSession *session, SoupMessage *msg,
+		struct segment *seg)
+{
+	struct download *dl = seg->dl;
+
+	seg->msg = NULL;
+	downloads_paused = g_slist_remove(downloads_paused, seg);
+
+	/* 416: nothing left to fetch, like wget -c on a complete file */
+	if (! SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)
+			&& msg->status_code != SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE)
+		dl->failed = TRUE;
+	else if (seg->end >= 0)
+		seg->offset = seg->end + 1;
+
+	if (--dl->active == 0)
+		download_finish(dl);
+}
+
+static void
+download_segment_start(struct segment *seg)
+{
+	SoupMessage *msg;
+
+	if (seg->end >= 0 && seg->offset > seg->end)
+		return;
+
+	msg = soup_message_new("GET", seg->dl->uri);
+	if (! msg) {
+		seg->dl->failed = TRUE;
+		return;
+	}
+	if (seg->offset > 0 || seg->end >= 0)
+		soup_message_headers_set_range(msg->request_headers,
+			seg->offset, seg->end);
+	soup_message_body_set_accumulate(msg->response_body, FALSE);
+	g_signal_connect(msg, "got-headers",
+		G_CALLBACK(download_got_headers_cb), seg);
+	g_signal_connect(msg, "got-chunk",
+		G_CALLBACK(download_got_chunk_cb), seg);
+
+	seg->msg = msg;
+	seg->dl->active++;
+	soup_session_queue_message(session, msg,
+		(SoupSessionCallback)download_segment_done_cb, seg);
+
+	if (! download_timer)
+		download_timer = g_timeout_add(DOWNLOAD_TICK, download_tick_cb, NULL);
+}
+
+/* Split in segments if the server supports ranges for a large file */
+static void
+download_head_cb(SoupSession *session, SoupMessage *msg,
+		struct download *dl)
+{
+	const gchar *ranges;
+	struct stat st;
+	goffset part;
+	guint i;
+
+	ranges = soup_message_headers_get_one(msg->response_headers,
+		"Accept-Ranges");
+	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code))
+		dl->size = soup_message_headers_get_content_length(
+			msg->response_headers);
+
+	if (dl->size > DOWNLOAD_SPLIT && ranges && strstr(ranges, "bytes")
+			&& ftruncate(dl->fd, dl->size) == 0) {
+		/* Exactly the size: no bytes of an older file are left */
+		dl->nseg = DOWNLOAD_SEGMENTS;
+		part = dl->size / dl->nseg;
+		for (i = 0; i < dl->nseg; i++) {
+			dl->seg[i].offset = i * part;
+			dl->seg[i].end = (i == dl->nseg - 1) ?
+				dl->size - 1 : (i + 1) * part - 1;
+		}
+	} else {
+		/* Single stream, a queued download goes on like wget -c */
+		dl->nseg = 1;
+		dl->seg[0].offset = dl->resumed && fstat(dl->fd, &st) == 0 ?
+			st.st_size : 0;
+		dl->seg[0].end = -1;
+	}
+
+	downloads_save();
+	for (i = 0; i < dl->nseg; i++)
+		download_segment_start(&dl->seg[i]);
+	if (dl->active == 0)
+		download_finish(dl);
+}
+
+/* Only downloads of the saved queue go on with what is on disk */
+/* A new file, never one already there: name (1).ext, name (2).ext... */
+static int
+download_create(const gchar *file, gchar **created)
+{
+	gchar *name, *dot, *base, *dir;
+	guint n;
+	int fd;
+
+	*created = g_strdup(file);
+	dir = g_path_get_dirname(file);
+	base = g_path_get_basename(file);
+	dot = strrchr(base, '.');
+	for (n = 1; (fd = open(*created, O_WRONLY | O_CREAT | O_EXCL, 0644)) < 0
+			&& errno == EEXIST && n < 1000; n++) {
+		g_free(*created);
+		name = dot && dot != base ? g_strdup_printf("%.*s (%u)%s",
+			(int)(dot - base), base, n, dot)
+			: g_strdup_printf("%s (%u)", base, n);
+		*created = g_build_filename(dir, name, NULL);
+		g_free(name);
+	}
+	g_free(base);
+	g_free(dir);
+	return fd;
+}
+
+/* Only a resumed download opens a file that is already there */
+static struct download*
+download_new(const gchar *uri, const gchar *file, goffset size,
+		gboolean resumed)
+{
+	struct download *dl;
+	gchar *created, *dir;
+	guint i;
+
+	dir = g_path_get_dirname(file);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	dl = g_new0(struct download, 1);
+	if (resumed) {
+		created = g_strdup(file);
+		dl->fd = open(file, O_WRONLY | O_CREAT, 0644);
+	} else {
+		dl->fd = download_create(file, &created);
+	}
+	if (dl->fd < 0) {
+		g_warning("Can't write: %s", created);
+		g_free(created);
+		g_free(dl);
+		return NULL;
+	}
+	dl->uri = g_strdup(uri);
+	dl->file = created;
+	dl->size = size;
+	dl->resumed = resumed;
+	for (i = 0; i < DOWNLOAD_SEGMENTS; i++)
+		dl->seg[i].dl = dl;
+	downloads = g_list_append(downloads, dl);
+
+	if (downloads_box) {
+		dl->bar = g_object_ref(gtk_progress_bar_new());
+		gtk_box_pack_start(GTK_BOX(downloads_box), dl->bar, FALSE, FALSE, 0);
+		gtk_widget_show(dl->bar);
+		download_update_bar(dl);
+	}
+	return dl;
+}
+
+/* Ask for size and range support before the transfer */
+static void
+download_probe(struct download *dl)
+{
+	SoupMessage *msg;
+
+	msg = soup_message_new("HEAD", dl->uri);
+	if (! msg) {
+		dl->failed = TRUE;
+		download_finish(dl);
+		return;
+	}
+	soup_session_queue_message(session, msg,
+		(SoupSessionCallback)download_head_cb, dl);
+}
+
+static void
+download_start(const gchar *uri, const gchar *file)
+{
+	struct download *dl;
+
+	if ((dl = download_new(uri, file, 0, FALSE)))
+		download_probe(dl);
+}
+
+/* Refill the bandwidth budget and refresh progress bars */
+static gboolean
+download_tick_cb(gpointer data)
+{
+	struct segment *seg;
+	GList *l;
+
+	download_budget = (gint64)download_rate * 1024 * DOWNLOAD_TICK / 1000;
+	while (downloads_paused) {
+		seg = downloads_paused->data;
+		downloads_paused = g_slist_delete_link(downloads_paused,
+			downloads_paused);
+		if (seg->msg)
+			soup_session_unpause_message(session, seg->msg);
+	}
+
+	/* Progress is only shown and saved twice a second */
+	if (++download_ticks % 5 == 0) {
+		for (l = downloads; l; l = l->next)
+			download_update_bar(l->data);
+		if (download_ticks % 50 == 0)
+			downloads_save();
+	}
+
+	if (! downloads) {
+		download_timer = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+download_page_done(gpointer data)
+{
+	download_pages--;
+}
+
+/* Webviews loading a page, the downloads only give way to them */
+static void
+download_page_status(WebKitWebView *webview)
+{
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_FINISHED:
+		case WEBKIT_LOAD_FAILED:
+			g_object_set_data(G_OBJECT(webview), "download-page", NULL);
+			break;
+
+		default:
+			if (g_object_get_data(G_OBJECT(webview), "download-page"))
+				break;
+			g_object_set_data_full(G_OBJECT(webview), "download-page",
+				GINT_TO_POINTER(TRUE), download_page_done);
+			download_pages++;
+			break;
+	}
+}
+
+/* Resume the queue saved by downloads_save() */
+static void
+downloads_resume(void)
+{
+	struct download *dl;
+	gchar *file, *data, *end, **lines, **fields, **segs;
+	guint i, j;
+
+	file = DOWNLOADS_QUEUE;
+	if (! g_file_get_contents(file, &data, NULL, NULL)) {
+		g_free(file);
+		return;
+	}
+
+	lines = g_strsplit(data, "\n", -1);
+	for (i = 0; lines[i]; i++) {
+		fields = g_strsplit(lines[i], "|", 4);
+		if (g_strv_length(fields) == 4
+				&& (dl = download_new(fields[0], fields[1],
+					g_ascii_strtoll(fields[2], NULL, 10), TRUE))) {
+			segs = g_strsplit(fields[3], ",", DOWNLOAD_SEGMENTS);
+			for (j = 0; segs[j] && *segs[j]; j++) {
+				dl->seg[j].offset = g_ascii_strtoll(segs[j], &end, 10);
+				dl->seg[j].end = *end == ':' ?
+					g_ascii_strtoll(end + 1, NULL, 10) : -1;
+			}
+			dl->nseg = j;
+			g_strfreev(segs);
+
+			/* Stopped before the server answered the probe */
+			if (! dl->nseg) {
+				download_probe(dl);
+			} else {
+				for (j = 0; j < dl->nseg; j++)
+					download_segment_start(&dl->seg[j]);
+				if (dl->active == 0)
+					download_finish(dl);
+			}
+		}
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+	g_free(data);
+	g_free(file);
+}
+
+/*
+ *
+ * Session journal
+ *
+ * session.log records the open windows and their history as navigation
+ * happens. Lines are appended, the journal is rewritten from the live
+ * windows once stale lines pile up. On startup every window comes back
+ * but only the focused one is loaded, the others load on first focus.
+ *
+ *   +id          window opened
+ *   -id          window closed
+ *   nid TAB pos TAB uri    navigation at a back/forward position
+ *   tid TAB title          title of the current entry
+ *   fid          window focused
+ *
+ */
+
+#define SESSION_LOG		g_strdup_printf("%s/session.log", CONFIG)
+#define SESSION_LOCK	g_strdup_printf("%s/session.lock", CONFIG)
+#define SESSION_HISTORY	50
+#define SESSION_STALE	256
+
+struct session_window {
+	guint			id;
+	GtkWidget		*window;
+	WebKitWebView	*webview;
+	GPtrArray		*history;
+	guint			current;
+};
+
+static GList			*session_windows;
+static int				session_fd		= -1;
+static guint			session_next_id	= 1;
+static guint			session_lines;
+static guint			session_base;
+static guint			session_focus;
+static guint			session_compact_id;
+static gboolean		session_restoring;
+
+static gboolean session_compact(gpointer data);
+
+static void
+session_window_free(struct session_window *sw)
+{
+	session_windows = g_list_remove(session_windows, sw);
+	if (sw->history)
+		g_ptr_array_free(sw->history, TRUE);
+	g_free(sw);
+}
+
+static void
+session_log(const gchar *format, ...)
+{
+	va_list args;
+	gchar *line;
+
+	if (session_fd < 0 || session_restoring)
+		return;
+
+	va_start(args, format);
+	line = g_strdup_vprintf(format, args);
+	va_end(args);
+	if (write(session_fd, line, strlen(line)) < 0)
+		g_warning("Can't write the session journal");
+	g_free(line);
+
+	if (++session_lines > 2 * session_base + SESSION_STALE
+			&& ! session_compact_id)
+		session_compact_id = g_idle_add(session_compact, NULL);
+}
+
+/* Back/forward list as uri, title pairs, oldest first */
+static GPtrArray*
+back_forward_list(WebKitWebView *webview, guint *current)
+{
+	WebKitWebBackForwardList *bfl;
+	WebKitWebHistoryItem *item;
+	GPtrArray *history;
+	gint i, back, forward;
+
+	bfl = webkit_web_view_get_back_forward_list(webview);
+	back = MIN(webkit_web_back_forward_list_get_back_length(bfl),
+		SESSION_HISTORY);
+	forward = MIN(webkit_web_back_forward_list_get_forward_length(bfl),
+		SESSION_HISTORY);
+
+	history = g_ptr_array_new_with_free_func(g_free);
+	for (i = -back; i <= forward; i++) {
+		item = webkit_web_back_forward_list_get_nth_item(bfl, i);
+		if (! item)
+			continue;
+		if (i == 0)
+			*current = history->len / 2;
+		g_ptr_array_add(history,
+			g_strdup(webkit_web_history_item_get_uri(item)));
+		g_ptr_array_add(history,
+			g_strdup(webkit_web_history_item_get_title(item)));
+	}
+	if (! history->len) {
+		g_ptr_array_free(history, TRUE);
+		return NULL;
+	}
+	return history;
+}
+
+/* Journal lines of one window, return the number of lines */
+static guint
+session_write_entry(GString *string, guint id, GPtrArray *history,
+		guint current)
+{
+	gchar *title;
+	guint i, lines = 1;
+
+	g_string_append_printf(string, "+%u\n", id);
+	if (! history)
+		return lines;
+
+	for (i = 0; i + 1 < history->len; i += 2) {
+		g_string_append_printf(string, "n%u\t%u\t%s\n", id, i / 2,
+			(gchar*)g_ptr_array_index(history, i));
+		lines++;
+		if (g_ptr_array_index(history, i + 1)) {
+			title = g_strdelimit(g_strdup(g_ptr_array_index(history, i + 1)),
+				"\t\r\n", ' ');
+			g_string_append_printf(string, "t%u\t%s\n", id, title);
+			g_free(title);
+			lines++;
+		}
+	}
+	g_string_append_printf(string, "n%u\t%u\t%s\n", id, current,
+		(gchar*)g_ptr_array_index(history, current * 2));
+	return lines + 1;
+}
+
+/* Rewrite the journal from the live windows */
+static gboolean
+session_compact(gpointer data)
+{
+	struct session_window *sw;
+	GPtrArray *history;
+	GString *string;
+	GList *l;
+	gchar *file;
+	guint current, lines = 0;
+
+	session_compact_id = 0;
+	if (session_fd < 0)
+		return FALSE;
+
+	string = g_string_new(NULL);
+	for (l = session_windows; l; l = l->next) {
+		sw = l->data;
+		if (sw->history) {
+			lines += session_write_entry(string, sw->id, sw->history,
+				sw->current);
+		} else {
+			current = 0;
+			history = back_forward_list(sw->webview, &current);
+			lines += session_write_entry(string, sw->id, history, current);
+			if (history)
+				g_ptr_array_free(history, TRUE);
+		}
+	}
+	if (session_focus) {
+		g_string_append_printf(string, "f%u\n", session_focus);
+		lines++;
+	}
+
+	file = SESSION_LOG;
+	if (g_file_set_contents(file, string->str, string->len, NULL)) {
+		g_chmod(file, 0600);
+		close(session_fd);
+		session_fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+		session_base = session_lines = lines;
+	}
+	g_string_free(string, TRUE);
+	g_free(file);
+	return FALSE;
+}
+
+/* Replay a navigation: same entry or a new one dropping the forward list */
+static void
+session_navigate(struct session_window *sw, guint pos, const gchar *uri)
+{
+	pos *= 2;
+	if (pos + 1 < sw->history->len
+			&& ! g_strcmp0(g_ptr_array_index(sw->history, pos), uri)) {
+		sw->current = pos / 2;
+		return;
+	}
+	if (pos > sw->history->len)
+		pos = sw->history->len;
+	g_ptr_array_set_size(sw->history, pos);
+	g_ptr_array_add(sw->history, g_strdup(uri));
+	g_ptr_array_add(sw->history, NULL);
+	sw->current = pos / 2;
+}
+
+/* Replay the journal, return the open windows in order. Windows are
+ * not created yet, only id, history and current are set. */
+static GList*
+session_read(guint *focus, gboolean *partial)
+{
+	struct session_window *sw;
+	GHashTable *index;
+	GList *list = NULL;
+	gchar *file, *data, *line, *next, *arg, *uri;
+	guint id, pos;
+
+	file = SESSION_LOG;
+	if (! g_file_get_contents(file, &data, NULL, NULL)) {
+		g_free(file);
+		return NULL;
+	}
+	index = g_hash_table_new(NULL, NULL);
+
+	/* Only complete lines, a crash may have cut the last one */
+	for (line = data; (next = strchr(line, '\n')); line = next) {
+		*next++ = '\0';
+		session_lines++;
+		id = strtoul(line + 1, &arg, 10);
+		if (! id)
+			continue;
+		if (*arg == '\t')
+			arg++;
+		session_next_id = MAX(session_next_id, id + 1);
+		sw = g_hash_table_lookup(index, GUINT_TO_POINTER(id));
+
+		switch (line[0]) {
+			case '+':
+				if (sw)
+					break;
+				sw = g_new0(struct session_window, 1);
+				sw->id = id;
+				sw->history = g_ptr_array_new_with_free_func(g_free);
+				g_hash_table_insert(index, GUINT_TO_POINTER(id), sw);
+				list = g_list_prepend(list, sw);
+				break;
+
+			case '-':
+				if (! sw)
+					break;
+				g_hash_table_remove(index, GUINT_TO_POINTER(id));
+				list = g_list_remove(list, sw);
+				g_ptr_array_free(sw->history, TRUE);
+				g_free(sw);
+				break;
+
+			case 'n':
+				pos = strtoul(arg, &uri, 10);
+				if (sw && *uri == '\t' && uri[1])
+					session_navigate(sw, pos, uri + 1);
+				break;
+
+			case 't':
+				if (sw && sw->history->len) {
+					g_free(g_ptr_array_index(sw->history, sw->current * 2 + 1));
+					g_ptr_array_index(sw->history, sw->current * 2 + 1) =
+						g_strdup(arg);
+				}
+				break;
+
+			case 'f':
+				*focus = id;
+				break;
+		}
+	}
+	*partial = *line != '\0';
+	session_base = session_lines;
+
+	g_hash_table_destroy(index);
+	g_free(data);
+	g_free(file);
+	return g_list_reverse(list);
+}
+
+/* Take the session of this user, one process at a time */
+static gboolean
+session_open(void)
+{
+	gchar *dir, *file;
+	int lock;
+
+	dir = CONFIG;
+	g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+
+	/* The lock is held until exit */
+	file = SESSION_LOCK;
+	lock = open(file, O_RDWR | O_CREAT, 0600);
+	g_free(file);
+	if (lock < 0)
+		return FALSE;
+	if (flock(lock, LOCK_EX | LOCK_NB) < 0) {
+		close(lock);
+		return FALSE;
+	}
+
+	file = SESSION_LOG;
+	session_fd = open(file, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	g_free(file);
+	return session_fd >= 0;
+}
+
+/* Load a restored window: back/forward list then the current entry */
+static void
+session_window_load(struct session_window *sw)
+{
+	WebKitWebBackForwardList *bfl;
+	WebKitWebHistoryItem *item;
+	GPtrArray *items;
+	guint i;
+
+	bfl = webkit_web_view_get_back_forward_list(sw->webview);
+	items = g_ptr_array_new_with_free_func(g_object_unref);
+	for (i = 0; i + 1 < sw->history->len; i += 2) {
+		item = webkit_web_history_item_new_with_data(
+			g_ptr_array_index(sw->history, i),
+			g_ptr_array_index(sw->history, i + 1));
+		webkit_web_back_forward_list_add_item(bfl, item);
+		g_ptr_array_add(items, item);
+	}
+	webkit_web_view_go_to_back_forward_item(sw->webview,
+		g_ptr_array_index(items, sw->current));
+
+	g_ptr_array_free(items, TRUE);
+	g_ptr_array_free(sw->history, TRUE);
+	sw->history = NULL;
+}
+
+/* A window left from the session is loaded when it gets the focus */
+static gboolean
+session_focus_cb(GtkWidget *window, GdkEventFocus *event,
+		struct session_window *sw)
+{
+	if (sw->history)
+		session_window_load(sw);
+	if (sw->id != session_focus) {
+		session_focus = sw->id;
+		session_log("f%u\n", sw->id);
+	}
+	return FALSE;
+}
+
+/* Journal the navigation at its back/forward position and its title */
+static void
+session_load_status(WebKitWebView *webview)
+{
+	struct session_window *sw;
+	WebKitWebBackForwardList *bfl;
+	const gchar *location, *title;
+	gchar *text;
+
+	if (! (sw = g_object_get_data(G_OBJECT(webview), "session")))
+		return;
+
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_COMMITTED:
+			location = webkit_web_view_get_uri(webview);
+			bfl = webkit_web_view_get_back_forward_list(webview);
+			if (location)
+				session_log("n%u\t%d\t%s\n", sw->id,
+					webkit_web_back_forward_list_get_back_length(bfl),
+					location);
+			break;
+
+		case WEBKIT_LOAD_FINISHED:
+			if ((title = webkit_web_view_get_title(webview))) {
+				text = g_strdelimit(g_strdup(title), "\t\r\n", ' ');
+				session_log("t%u\t%s\n", sw->id, text);
+				g_free(text);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/* The last window stays in the session for next start */
+static void
+session_window_close(GtkWidget *window)
+{
+	struct session_window *sw;
+
+	if (! (sw = g_object_get_data(G_OBJECT(window), "session")))
+		return;
+	if (g_atomic_int_get(&count) > 1)
+		session_log("-%u\n", sw->id);
+	g_object_set_data(G_OBJECT(window), "session", NULL);
+}
+
+/* Journal a new window */
+static void
+session_window_new(GtkWidget *window, WebKitWebView *webview)
+{
+	struct session_window *sw;
+
+	sw = g_new0(struct session_window, 1);
+	sw->id = session_next_id++;
+	sw->window = window;
+	sw->webview = webview;
+	session_windows = g_list_append(session_windows, sw);
+
+	g_object_set_data_full(G_OBJECT(window), "session", sw,
+		(GDestroyNotify)session_window_free);
+	g_object_set_data(G_OBJECT(webview), "session", sw);
+	g_signal_connect(window, "focus-in-event",
+		G_CALLBACK(session_focus_cb), sw);
+	session_log("+%u\n", sw->id);
+}
+
+/* Bring back the windows, none of them is loaded yet. Return the
+ * focused one if shown, NULL without a session. */
+static struct session_window*
+session_restore(gboolean show)
+{
+	struct session_window *se, *sw, *focus_sw = NULL;
+	WebKitWebView *view;
+	GtkWidget *window;
+	GList *list, *l;
+	gboolean partial = FALSE;
+	guint focus = 0;
+
+	list = session_read(&focus, &partial);
+	session_restoring = TRUE;
+	for (l = list; l; l = l->next) {
+		se = l->data;
+		if (! se->history->len)
+			continue;
+
+		window = create_window(&view);
+		sw = g_object_get_data(G_OBJECT(window), "session");
+		sw->id = se->id;
+		sw->history = se->history;
+		sw->current = se->current;
+		se->history = NULL;
+
+		gtk_window_set_title(GTK_WINDOW(window),
+			g_ptr_array_index(sw->history, sw->current * 2 + 1) ?
+			g_ptr_array_index(sw->history, sw->current * 2 + 1) :
+			g_ptr_array_index(sw->history, sw->current * 2));
+		if (! focus_sw || se->id == focus)
+			focus_sw = sw;
+	}
+	session_restoring = FALSE;
+	for (l = list; l; l = l->next) {
+		se = l->data;
+		if (se->history)
+			g_ptr_array_free(se->history, TRUE);
+		g_free(se);
+	}
+	g_list_free(list);
+
+	/* Next appends must start on a new line */
+	if (partial)
+		session_compact(NULL);
+
+	if (! focus_sw)
+		return NULL;
+
+	/* The focused window is mapped last to get the focus */
+	for (l = session_windows; l; l = l->next) {
+		sw = l->data;
+		if (sw != focus_sw)
+			gtk_widget_show_all(sw->window);
+	}
+	gtk_widget_show_all(focus_sw->window);
+	return show ? focus_sw : NULL;
+}
+
+/*
+ *
+ * Single instance: each request line of the socket opens a new window,
+ * with the options t (no toolbar), m (no menu) and s (small window).
+ *
+ */
+
+void
+instance_open(gchar *line, gboolean focus)
+{
+	GtkWidget *window;
+	WebKitWebView *view;
+	gboolean toolbar = notoolbar, menu = nomenu;
+	int w = width, h = height;
+	gchar *location;
+
+	if (! (location = strchr(line, '\t')) || ! location[1])
+		return;
+	*location++ = '\0';
+
+	if (strchr(line, 't'))
+		notoolbar = TRUE;
+	if (strchr(line, 'm'))
+		nomenu = TRUE;
+	if (strchr(line, 's')) {
+		width = 640;
+		height = 480;
+	}
+
+	window = create_window(&view);
+	gtk_widget_show_all(window);
+	scheme_load(view, location);
+	gtk_widget_grab_focus(GTK_WIDGET(view));
+	gtk_window_present(GTK_WINDOW(window));
+
+	notoolbar = toolbar;
+	nomenu = menu;
+	width = w;
+	height = h;
+}
+
+/* Hand the url over to a running TazWeb with the options of this one */
+static gboolean
+instance_request(const gchar *location)
+{
+	gchar *request;
+	gboolean done;
+
+	request = g_strdup_printf("%s%s%s\t%s\n", notoolbar ? "t" : "",
+		nomenu ? "m" : "", width == 640 ? "s" : "", location);
+	done = instance_handoff("tazweb", request);
+	g_free(request);
+	return done;
+}
+
 /*
  *
  * Navigation functions
@@ -180,10 +1255,8 @@ bookmarks_edit_cb()
 static void
 go_bookmarks_cb(GtkWidget* widget, WebKitWebView* webview)
 {
-	system("/usr/lib/tazweb/helper.sh html_bookmarks");
-	uri = g_strdup_printf("file://%s/bookmarks.html", CONFIG);
-	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	uri = SCHEME "bookmarks";
+	scheme_load(webview, uri);
 }
 
 static void
@@ -191,41 +1264,53 @@ go_home_cb(GtkWidget* widget, WebKitWebView* webview)
 {
 	uri = WEBHOME;
 	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	scheme_load(webview, uri);
 }
 
 static void
 go_back_cb(GtkWidget* widget, WebKitWebView* webview)
 {
-	webkit_web_view_go_back(webview);
+	bfcache_go(webview, -1);
 }
 
 static void
 go_forward_cb(GtkWidget* widget, WebKitWebView* webview)
 {
-	webkit_web_view_go_forward(webview);
+	bfcache_go(webview, 1);
 }
 
 /* Documentation callback */
 static void
 tazweb_doc_cb(GtkWidget* widget, WebKitWebView *webview)
 {
-	uri = ("file:///usr/share/doc/tazweb/tazweb.html");
-	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	uri = SCHEME "doc";
+	scheme_load(webview, uri);
 }
 
-/* Download callback */
+/* Download callback: WebKit drops its own transfer, we handle it */
 static gboolean
 download_requested_cb(WebKitWebView *webview, WebKitDownload *download,
 		gpointer user_data)
 {
-	const gchar* buffer;
+	const gchar *suggested;
+	gchar *name, *dir, *file;
+
+	/* The server names the file: no directory, nothing above DOWNLOADS */
 	uri = webkit_download_get_uri(download);
-	asprintf(&buffer, "xterm -T 'TazWeb Download' -geom 72x12+0-24 -e \
-				'mkdir -p %s && wget -P %s -c %s; sleep 2' &",
-				DOWNLOADS, DOWNLOADS, uri);
-	system(buffer);
+	suggested = webkit_download_get_suggested_filename(download);
+	name = g_path_get_basename(suggested && *suggested ? suggested : ".");
+	if (! strcmp(name, ".") || ! strcmp(name, "..") || ! strcmp(name, "/")) {
+		g_free(name);
+		name = g_strdup("index.html");
+	}
+
+	dir = DOWNLOADS;
+	file = g_build_filename(dir, name, NULL);
+	download_start(uri, file);
+	g_free(file);
+	g_free(dir);
+	g_free(name);
+	return FALSE;
 }
 
 /* Printing callback function */
@@ -263,46 +1348,26 @@ close_webview_cb(WebKitWebView* webview, GtkWidget* window)
 
 /* Add a bookmark */
 void
-add_bookmark_cb(GtkWidget *widget, gpointer data)
+add_bookmark_cb(GtkWidget *widget, WebKitWebView* webview)
 {
 	const gchar* title;
-	const gchar* buffer;
-
-	title = webkit_web_view_get_title(WEBKIT_WEB_VIEW (webview));
-	uri = webkit_web_view_get_uri(WEBKIT_WEB_VIEW (webview));
 
-	asprintf(&buffer, "echo '%s|%s' >> %s", title, uri, BOOKMARKS);
-	system(buffer);
-}
-
-/* Setup session cookies */
-void
-cookies_setup(void)
-{
-	if (cookiejar) {
-		soup_session_remove_feature(session,
-			(SoupSessionFeature*)cookiejar);
-		g_object_unref(cookiejar);
-		cookiejar = NULL;
-	}
-
-	cookiejar = soup_cookie_jar_text_new(COOKIES, 0);
-	soup_session_add_feature(session, (SoupSessionFeature*)cookiejar);
+	title = webkit_web_view_get_title(webview);
+	uri = webkit_web_view_get_uri(webview);
+	bookmarks_add(title, uri);
 }
 
 static void
 cookies_view_cb(GtkWidget* widget, WebKitWebView* webview)
 {
-	system("/usr/lib/tazweb/helper.sh html_cookies");
-	uri = g_strdup_printf("file://%s/cookies.html", CONFIG);
-	g_assert(uri);
-	webkit_web_view_load_uri(webview, uri);
+	uri = SCHEME "cookies";
+	scheme_load(webview, uri);
 }
 
 static void
 cookies_clean_cb()
 {
-	system("/usr/lib/tazweb/helper.sh clean_cookies");
+	cookies_clean();
 }
 
 /* Add items to WebKit contextual menu */
@@ -396,29 +1461,630 @@ populate_menu_cb(WebKitWebView *webview, GtkMenu *menu, gpointer data)
 	gtk_widget_show_all(GTK_WIDGET(menu));
 }
 
+/*
+ *
+ * Batch rendering
+ *
+ * tazweb --batch list renders each url of the list (- for stdin) in an
+ * offscreen window and writes a PNG screenshot and a thumbnail named
+ * after the url line number. The list is shared round robin between the
+ * worker processes, each one loads its urls one after the other in a
+ * single webview. A line per url is printed: status, file and url.
+ * Nothing is shown so it runs as well under Xvfb.
+ *
+ */
+
+#define BATCH_WIDTH		1024
+#define BATCH_HEIGHT	768
+#define BATCH_THUMB		256
+#define BATCH_TIMEOUT	30
+#define BATCH_SETTLE	200
+
+static gchar			*batch_list;
+static gchar			*batch_output	= ".";
+static gint				batch_width		= BATCH_WIDTH;
+static gint				batch_height	= BATCH_HEIGHT;
+static gint				batch_thumb		= BATCH_THUMB;
+static gint				batch_jobs;
+
+struct batch {
+	GPtrArray		*urls;
+	guint			next;
+	guint			workers;
+	guint			index;
+	GtkWidget		*window;
+	WebKitWebView	*webview;
+	const gchar		*status;
+	guint			timeout_id;
+	guint			settle_id;
+	gint			failures;
+};
+
+/* Urls of a list file, one per line, # for comments */
+static GPtrArray*
+batch_read(const gchar *file)
+{
+	GPtrArray *urls;
+	GIOChannel *channel;
+	gchar *line;
+
+	if (strcmp(file, "-"))
+		channel = g_io_channel_new_file(file, "r", NULL);
+	else
+		channel = g_io_channel_unix_new(STDIN_FILENO);
+	if (! channel)
+		return NULL;
+
+	urls = g_ptr_array_new_with_free_func(g_free);
+	while (g_io_channel_read_line(channel, &line, NULL, NULL, NULL)
+			== G_IO_STATUS_NORMAL) {
+		g_strstrip(line);
+		if (*line && *line != '#')
+			g_ptr_array_add(urls, g_strrstr(line, "://") ? g_strdup(line)
+				: g_strdup_printf("http://%s", line));
+		g_free(line);
+	}
+	g_io_channel_unref(channel);
+	return urls;
+}
+
+static void batch_next(struct batch *b);
+
+/* Screenshot and thumbnail of the page as it is now */
+static gboolean
+batch_snapshot_cb(gpointer data)
+{
+	struct batch *b = data;
+	GdkPixbuf *pixbuf, *thumb;
+	GError *error = NULL;
+	gchar *file, *thumb_file, *failed = NULL;
+
+	b->settle_id = 0;
+	file = g_strdup_printf("%s/%05u.png", batch_output, b->index + 1);
+	thumb_file = g_strdup_printf("%s/%05u-thumb.png", batch_output,
+		b->index + 1);
+
+	if ((pixbuf = gtk_offscreen_window_get_pixbuf(
+			GTK_OFFSCREEN_WINDOW(b->window)))) {
+		/* A very wide page still gets a thumbnail a pixel high */
+		thumb = gdk_pixbuf_scale_simple(pixbuf, batch_thumb,
+			MAX(batch_thumb * batch_height / batch_width, 1),
+			GDK_INTERP_BILINEAR);
+		if (! gdk_pixbuf_save(pixbuf, file, "png", &error, NULL))
+			failed = file;
+		else if (! thumb || ! gdk_pixbuf_save(thumb, thumb_file, "png",
+				&error, NULL))
+			failed = thumb_file;
+		if (failed) {
+			g_warning("Can't write %s: %s", failed,
+				error ? error->message : "no thumbnail");
+			if (error)
+				g_error_free(error);
+			b->status = "failed";
+		}
+		if (thumb)
+			g_object_unref(thumb);
+		g_object_unref(pixbuf);
+	} else {
+		b->status = "failed";
+	}
+
+	if (strcmp(b->status, "ok"))
+		b->failures++;
+	printf("%s\t%s\t%s\n", b->status, file,
+		(gchar*)g_ptr_array_index(b->urls, b->index));
+	fflush(stdout);
+
+	g_free(thumb_file);
+	g_free(file);
+	batch_next(b);
+	return FALSE;
+}
+
+/* Give the page a moment to paint before the snapshot */
+static void
+batch_settle(struct batch *b, const gchar *status)
+{
+	if (b->settle_id)
+		return;
+	if (b->timeout_id) {
+		g_source_remove(b->timeout_id);
+		b->timeout_id = 0;
+	}
+	b->status = status;
+	b->settle_id = g_timeout_add(BATCH_SETTLE, batch_snapshot_cb, b);
+}
+
+static gboolean
+batch_timeout_cb(gpointer data)
+{
+	struct batch *b = data;
+
+	b->timeout_id = 0;
+	batch_settle(b, "timeout");
+	webkit_web_view_stop_loading(b->webview);
+	return FALSE;
+}
+
+static void
+batch_load_status_cb(WebKitWebView *webview, GParamSpec *pspec,
+		gpointer data)
+{
+	switch (webkit_web_view_get_load_status(webview)) {
+		case WEBKIT_LOAD_FINISHED:
+			batch_settle(data, "ok");
+			break;
+		case WEBKIT_LOAD_FAILED:
+			batch_settle(data, "failed");
+			break;
+		default:
+			break;
+	}
+}
+
+/* No dialog may wait for a click */
+static gboolean
+batch_script_dialog_cb(WebKitWebView *webview, WebKitWebFrame *frame,
+		const gchar *message, gpointer data)
+{
+	return TRUE;
+}
+
+/* Load the next url of this worker, quit after the last one */
+static void
+batch_next(struct batch *b)
+{
+	if (b->next >= b->urls->len) {
+		gtk_main_quit();
+		return;
+	}
+	b->index = b->next;
+	b->next += b->workers;
+	b->timeout_id = g_timeout_add_seconds(BATCH_TIMEOUT,
+		batch_timeout_cb, b);
+	scheme_load(b->webview,
+		g_ptr_array_index(b->urls, b->index));
+}
+
+/* A worker renders the urls worker, worker + workers... */
+static int
+batch_worker(GPtrArray *urls, guint worker, guint workers)
+{
+	struct batch b = { urls, worker, workers };
+
+	gtk_init(NULL, NULL);
+
+	/* The webview is reused from one url to the next */
+	b.window = gtk_offscreen_window_new();
+	gtk_window_set_default_size(GTK_WINDOW(b.window), batch_width,
+		batch_height);
+	b.webview = webview_new();
+	gtk_widget_set_size_request(GTK_WIDGET(b.webview), batch_width,
+		batch_height);
+	gtk_container_add(GTK_CONTAINER(b.window), GTK_WIDGET(b.webview));
+	g_object_unref(b.webview);
+
+	g_signal_connect(b.webview, "notify::load-status",
+		G_CALLBACK(batch_load_status_cb), &b);
+	g_signal_connect(b.webview, "script-alert",
+		G_CALLBACK(batch_script_dialog_cb), NULL);
+	g_signal_connect(b.webview, "script-confirm",
+		G_CALLBACK(batch_script_dialog_cb), NULL);
+	g_signal_connect(b.webview, "script-prompt",
+		G_CALLBACK(batch_script_dialog_cb), NULL);
+	gtk_widget_show_all(b.window);
+
+	batch_next(&b);
+	gtk_main();
+	gtk_widget_destroy(b.window);
+
+	return b.failures ? 1 : 0;
+}
+
+/* Fork the workers before GTK is initialized and wait for them */
+static int
+batch_run(void)
+{
+	GPtrArray *urls;
+	guint i, workers;
+	int status, ret = 0;
+	pid_t pid;
+
+	if (! (urls = batch_read(batch_list))) {
+		fprintf(stderr, "Can't read url list: %s\n", batch_list);
+		return 1;
+	}
+	if (g_mkdir_with_parents(batch_output, 0755) < 0) {
+		fprintf(stderr, "Can't create: %s\n", batch_output);
+		return 1;
+	}
+
+	workers = batch_jobs > 0 ? batch_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+	workers = CLAMP(workers, 1, MAX(urls->len, 1));
+	if (workers == 1)
+		return batch_worker(urls, 0, 1);
+
+	for (i = 0; i < workers; i++) {
+		if ((pid = fork()) == 0)
+			_exit(batch_worker(urls, i, workers));
+		if (pid < 0) {
+			fprintf(stderr, "Can't start worker: %s\n", strerror(errno));
+			ret = 1;
+			break;
+		}
+	}
+	while (wait(&status) > 0)
+		if (! WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+
+	g_ptr_array_free(urls, TRUE);
+	return ret;
+}
+
+/*
+ *
+ * Kiosk supervisor
+ *
+ * With --supervise, a parent process without GTK forks the browser and
+ * watches a pipe where the child main loop writes a heartbeat every
+ * second, the last committed url and its fullscreen state. A child that
+ * misses heartbeats for SUPERVISE_HANG seconds, or sends none within
+ * SUPERVISE_START seconds of its start, is killed. A killed or crashed
+ * child is started again on its last url and fullscreen state, a clean
+ * exit ends the supervisor. Restarts are logged with their reason and
+ * timings to stderr and supervise.log. A child dying soon after its
+ * start is restarted with a growing delay. SIGTERM, SIGINT or SIGHUP
+ * sent to the supervisor is passed on to the child, which is killed if
+ * it is not gone after SUPERVISE_QUIT seconds, and ends the supervisor.
+ *
+ *   b                  heartbeat
+ *   u TAB url          committed url
+ *   f TAB 0|1          fullscreen state
+ *
+ */
+
+#define SUPERVISE_LOG		g_strdup_printf("%s/supervise.log", CONFIG)
+#define SUPERVISE_BEAT		1
+#define SUPERVISE_HANG		15
+#define SUPERVISE_START		60
+#define SUPERVISE_QUIT		5
+#define SUPERVISE_UPTIME	60
+#define SUPERVISE_DELAY		60
+
+static gboolean		supervise;
+static gboolean		supervise_fullscreen;
+static int				supervise_fd	= -1;
+static volatile sig_atomic_t	supervise_signal;
+
+/* Child side, the supervisor is lost on error */
+static void
+supervise_send(const gchar *format, ...)
+{
+	va_list args;
+	gchar *line;
+
+	if (supervise_fd < 0)
+		return;
+	va_start(args, format);
+	line = g_strdup_vprintf(format, args);
+	va_end(args);
+	if (write(supervise_fd, line, strlen(line)) < 0 && errno != EAGAIN) {
+		close(supervise_fd);
+		supervise_fd = -1;
+	}
+	g_free(line);
+}
+
+static gboolean
+supervise_beat_cb(gpointer data)
+{
+	supervise_send("b\n");
+	return GPOINTER_TO_INT(data);
+}
+
+static void
+supervise_uri(const gchar *uri)
+{
+	if (uri && ! strpbrk(uri, "\t\r\n"))
+		supervise_send("u\t%s\n", uri);
+}
+
+static gboolean
+supervise_state_cb(GtkWidget *window, GdkEventWindowState *event,
+		gpointer data)
+{
+	if (event->changed_mask & GDK_WINDOW_STATE_FULLSCREEN)
+		supervise_send("f\t%d\n", (event->new_window_state
+			& GDK_WINDOW_STATE_FULLSCREEN) != 0);
+	return FALSE;
+}
+
+/* First heartbeat as soon as the main loop runs */
+static void
+supervise_attach(GtkWidget *window)
+{
+	if (supervise_fd < 0)
+		return;
+	g_signal_connect(window, "window-state-event",
+		G_CALLBACK(supervise_state_cb), NULL);
+	g_idle_add(supervise_beat_cb, GINT_TO_POINTER(FALSE));
+	g_timeout_add_seconds(SUPERVISE_BEAT, supervise_beat_cb,
+		GINT_TO_POINTER(TRUE));
+}
+
+/* Supervisor side: stderr and supervise.log */
+static void
+supervise_log(const gchar *format, ...)
+{
+	GDateTime *date;
+	va_list args;
+	gchar *text, *stamp, *file;
+	FILE *log;
+
+	va_start(args, format);
+	text = g_strdup_vprintf(format, args);
+	va_end(args);
+	date = g_date_time_new_now_local();
+	stamp = g_date_time_format(date, "%Y-%m-%d %H:%M:%S");
+	fprintf(stderr, "tazweb: %s\n", text);
+
+	file = SUPERVISE_LOG;
+	if ((log = fopen(file, "a"))) {
+		fprintf(log, "%s %d %s\n", stamp, getpid(), text);
+		fclose(log);
+	}
+	g_free(file);
+	g_free(stamp);
+	g_date_time_unref(date);
+	g_free(text);
+}
+
+/* Lines of the child: heartbeat time, url and fullscreen state */
+static void
+supervise_read(GString *buffer, gint64 *beat, gchar **last, gboolean *full)
+{
+	gchar *line, *end;
+
+	while ((end = strchr(buffer->str, '\n'))) {
+		*end = '\0';
+		line = buffer->str;
+		if (line[0] == 'b') {
+			*beat = g_get_monotonic_time();
+		} else if (line[0] == 'u' && line[1] == '\t') {
+			g_free(*last);
+			*last = g_strdup(line + 2);
+		} else if (line[0] == 'f' && line[1] == '\t') {
+			*full = line[2] == '1';
+		}
+		g_string_erase(buffer, 0, end + 1 - buffer->str);
+	}
+}
+
+static void
+supervise_signal_cb(int signum)
+{
+	supervise_signal = signum;
+}
+
+/* Stop signals end the supervisor, they interrupt its waits */
+static void
+supervise_signals(void (*handler)(int))
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+}
+
+/* Watch a child until it is gone, NULL if it exited cleanly */
+static gchar*
+supervise_watch(pid_t pid, int fd, gint64 start, gchar **last,
+		gboolean *full)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	GString *buffer;
+	gchar data[1024], *reason = NULL;
+	gint64 beat = 0, stop = 0, now;
+	ssize_t n;
+	int status;
+
+	buffer = g_string_new(NULL);
+	while (1) {
+		if (poll(&pfd, 1, 1000) > 0) {
+			if ((n = read(pfd.fd, data, sizeof(data))) > 0) {
+				if (! beat)
+					supervise_log("started in %ld ms",
+						(long)((g_get_monotonic_time() - start) / 1000));
+				g_string_append_len(buffer, data, n);
+				supervise_read(buffer, &beat, last, full);
+				if (! beat)
+					beat = g_get_monotonic_time();
+			} else if (n == 0 || errno != EINTR) {
+				/* The child is gone */
+				break;
+			}
+		}
+
+		/* The child gets the signal, then a while to quit */
+		now = g_get_monotonic_time();
+		if (supervise_signal && ! stop) {
+			kill(pid, supervise_signal);
+			stop = now;
+		}
+		if (stop) {
+			if (now - stop > SUPERVISE_QUIT * G_USEC_PER_SEC) {
+				kill(pid, SIGKILL);
+				break;
+			}
+			continue;
+		}
+
+		/* A slow start is not a hang */
+		if (! beat && now - start > SUPERVISE_START * G_USEC_PER_SEC) {
+			kill(pid, SIGKILL);
+			reason = g_strdup_printf("no heartbeat %d s after start",
+				SUPERVISE_START);
+			break;
+		}
+		if (beat && now - beat > SUPERVISE_HANG * G_USEC_PER_SEC) {
+			kill(pid, SIGKILL);
+			reason = g_strdup_printf("hang, no heartbeat for %ld s",
+				(long)((now - beat) / G_USEC_PER_SEC));
+			break;
+		}
+	}
+	close(fd);
+	g_string_free(buffer, TRUE);
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+	if (reason)
+		return reason;
+	if (WIFSIGNALED(status))
+		return g_strdup_printf("crash, signal %d", WTERMSIG(status));
+	if (WIFEXITED(status) && WEXITSTATUS(status))
+		return g_strdup_printf("exit status %d", WEXITSTATUS(status));
+	return NULL;
+}
+
+/* Returns the exit code in the supervisor, -1 in a child that goes on */
+static int
+supervise_run(void)
+{
+	gchar *last, *reason;
+	gboolean full = kiosk;
+	guint restarts = 0, delay = 0;
+	gint64 start, uptime;
+	int fds[2];
+	pid_t pid;
+
+	last = g_strdup(uri);
+	supervise_log("supervising %s", last);
+	supervise_signals(supervise_signal_cb);
+	while (1) {
+		if (supervise_signal) {
+			supervise_log("stopped by signal %d after %u restarts",
+				(int)supervise_signal, restarts);
+			return 128 + supervise_signal;
+		}
+		if (pipe(fds) < 0) {
+			supervise_log("can't create pipe: %s", strerror(errno));
+			return 1;
+		}
+		start = g_get_monotonic_time();
+		if ((pid = fork()) == 0) {
+			supervise_signals(SIG_DFL);
+			close(fds[0]);
+			fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+			fcntl(fds[1], F_SETFL, O_NONBLOCK);
+			signal(SIGPIPE, SIG_IGN);
+			supervise_fd = fds[1];
+			supervise_fullscreen = full;
+			uri = last;
+			return -1;
+		}
+		close(fds[1]);
+		if (pid < 0) {
+			supervise_log("can't start: %s", strerror(errno));
+			close(fds[0]);
+			return 1;
+		}
+
+		reason = supervise_watch(pid, fds[0], start, &last, &full);
+		if (supervise_signal) {
+			g_free(reason);
+			continue;
+		}
+		if (! reason) {
+			supervise_log("exited after %u restarts", restarts);
+			return 0;
+		}
+
+		/* Crash loops back off up to SUPERVISE_DELAY seconds */
+		uptime = (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+		delay = uptime < SUPERVISE_UPTIME ?
+			MIN(MAX(delay * 2, 1), SUPERVISE_DELAY) : 0;
+		supervise_log("restart %u: %s, up %ld s, restarting in %u s on %s%s",
+			++restarts, reason, (long)uptime, delay, last,
+			full ? " (fullscreen)" : "");
+		g_free(reason);
+		if (delay)
+			sleep(delay);
+	}
+}
+
+/* Statistics of the windows, after the shared ones */
+const gchar		*stats_front_names[] = {
+	"windows", "webviews", "downloads", NULL
+};
+
+void
+stats_front_sample(gint64 *values)
+{
+	GList *l;
+	gint64 n = 0;
+
+	for (l = downloads; l; l = l->next)
+		n += ! ((struct download *)l->data)->failed;
+	values[0] = count;
+	values[1] = count + g_queue_get_length(&pool);
+	values[2] = n;
+}
+
+void
+stats_front_html(GString *html)
+{
+}
+
+/* TazWeb globals, before the options */
+static void
+config_apply(void)
+{
+	if (config.width > 0)
+		width = config.width;
+	if (config.height > 0)
+		height = config.height;
+	if (config.pool >= 0)
+		pool_size = config.pool;
+	if (config.cache >= 0)
+		cache_size = config.cache;
+	if (config.bfcache >= 0)
+		bfcache_entries = config.bfcache;
+	if (config.bfcache_size >= 0)
+		bfcache_size = config.bfcache_size;
+	if (config.kiosk >= 0)
+		kiosk = config.kiosk;
+	if (config.toolbar >= 0)
+		notoolbar = ! config.toolbar;
+	if (config.menu >= 0)
+		nomenu = ! config.menu;
+	if (config.download_rate >= 0)
+		download_rate = config.download_rate;
+}
+
 /* Scrolled window for the webview */
 static GtkWidget*
 create_browser(GtkWidget* window, GtkWidget* urientry, GtkWidget* search,
 		WebKitWebView* webview)
 {
-	WebKitWebSettings *settings;
-
 	browser = gtk_scrolled_window_new(NULL, NULL);
 	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(browser),
 			GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
 
+	/* Settings are set by webview_new(), the browser owns the webview */
 	gtk_container_add(GTK_CONTAINER(browser), GTK_WIDGET(webview));
+	g_object_unref(webview);
 
-	/* Webkit settings */
-	settings = webkit_web_view_get_settings (webview);
-	if (! useragent)
-		useragent = g_strdup_printf("%s", UA);
-	g_object_set(G_OBJECT(settings), "user-agent", useragent, NULL);
-	
-	if (private)
-		g_object_set(G_OBJECT(settings), "enable-private-browsing", TRUE);
-	
 	/* Connect Webkit events */
+	if (har_dir)
+		har_attach(webview);
+	filter_attach(webview);
+	site_attach(webview);
+	scheme_attach(webview);
+	bfcache_attach(webview);
 	g_signal_connect(webview, "notify::title",
 			G_CALLBACK(notify_title_cb), window);
 	g_signal_connect(webview, "notify::progress",
@@ -476,6 +2142,9 @@ create_toolbar(GtkWidget* urientry, GtkWidget* search, WebKitWebView* webview)
 	gtk_toolbar_insert(GTK_TOOLBAR(toolbar), item, -1);
 	g_signal_connect(G_OBJECT(urientry), "activate",
 			G_CALLBACK(uri_entry_cb), webview);
+	g_signal_connect(G_OBJECT(urientry), "changed",
+			G_CALLBACK(prefetch_entry_cb), NULL);
+	completion_attach(urientry);
 
 	/* Separator */
 	item = gtk_separator_tool_item_new();
@@ -493,6 +2162,8 @@ create_toolbar(GtkWidget* urientry, GtkWidget* search, WebKitWebView* webview)
 			G_CALLBACK(search_icon_press_cb), webview);
 	g_signal_connect(G_OBJECT(search), "activate",
 			G_CALLBACK(search_entry_cb), webview);
+	g_signal_connect(G_OBJECT(search), "changed",
+			G_CALLBACK(prefetch_search_cb), NULL);
 
 	/* Home button */
 	item = gtk_tool_button_new_from_stock(GTK_STOCK_HOME);
@@ -530,23 +2201,35 @@ create_window(WebKitWebView** newwebview)
 	g_signal_connect(window, "destroy", G_CALLBACK(destroy_cb), NULL);
 
 	/* Webview and widgets */
-	webview = WEBKIT_WEB_VIEW(webkit_web_view_new());
+	webview = pool_take();
 	urientry = gtk_entry_new();
 	search = gtk_entry_new();
 	vbox = gtk_vbox_new(FALSE, 0);
 
 	/* Pack box and container */
-	if (! notoolbar)
+	if (! notoolbar) {
 		gtk_box_pack_start(GTK_BOX(vbox),
 			create_toolbar(urientry, search, webview), FALSE, FALSE, 0);
+		trace_phase("create_toolbar");
+	}
 	gtk_box_pack_start(GTK_BOX(vbox),
 			create_browser(window, urientry, search, webview), TRUE, TRUE, 0);
 
+	/* Downloads progress in the first window */
+	if (! downloads_box) {
+		downloads_box = gtk_vbox_new(FALSE, 0);
+		gtk_box_pack_end(GTK_BOX(vbox), downloads_box, FALSE, FALSE, 0);
+		g_signal_connect(downloads_box, "destroy",
+			G_CALLBACK(gtk_widget_destroyed), &downloads_box);
+	}
+
 	gtk_container_add(GTK_CONTAINER(window), vbox);
+	session_window_new(window, webview);
 
 	if (newwebview)
 		*newwebview = webview;
 
+	trace_phase("create_window");
 	return window;
 }
 
@@ -564,8 +2247,25 @@ Options:\n\
   -k  --kiosk           Fullscreen, no bookmarks and download support\n\
   -r  --raw             Raw webkit window without toolbar and menu\n\
   -s  --small           Small Tazweb window for tiny web applications\n\
+  -w  --pool [n]        Webviews prepared ahead for new windows\n\
+  -H  --har [dir]       Record each page load as a HAR file in dir\n\
+  -E  --trace-events [dir] Record page loads as Chrome trace events\n\
+  -b  --batch [file]    Render each url of file (- for stdin) to PNG\n\
+      --viewport [WxH]  Batch viewport size (default: 1024x768)\n\
+      --thumbnail [w]   Batch thumbnail width (default: 256)\n\
+  -j  --jobs [n]        Batch worker processes (default: cpu count)\n\
+  -o  --output [dir]    Batch screenshots directory\n\
+  -c  --cache [MB]      Size of the disk cache (default: 50, 0: none),\n\
+                        shared by up to 4 processes, others run uncached\n\
+  -P  --profile [name]  Settings profile: lowmem, kiosk, throughput or one\n\
+                        of ~/.config/tazweb/tazweb.conf\n\
+      --filter-bench [file] Time the content filter lists with urls of file\n\
+      --stats [file]    Append memory and resource stats as JSON lines\n\
       --notoolbar       Disable the top toolbar\n\
-      --nomenu          Disable TazWeb contextual menu\n\n");
+      --nomenu          Disable TazWeb contextual menu\n\
+      --nosession       Do not restore or record the session\n\
+      --newinstance     Do not open the url in a running TazWeb\n\
+      --supervise       Restart on the last url after a hang or a crash\n\n");
     
 	return;
 }
@@ -573,9 +2273,19 @@ Options:\n\
 int
 main(int argc, char *argv[])
 {
-	textdomain (GETTEXT_PACKAGE);
+	struct session_window *restored = NULL;
+	GPtrArray *urls;
 	int c;
 
+	trace_open("tazweb");
+	trace_phase("main");
+	textdomain (GETTEXT_PACKAGE);
+
+	/* Config file and profile, the options can override them */
+	config_load(argc, argv);
+	config_apply();
+	trace_phase("config_file");
+
 	/* Cmdline parsing with getopt_long to handle --option or -o */
 	while (1) {
 		static struct option long_options[] =
@@ -583,6 +2293,8 @@ main(int argc, char *argv[])
 			/* Set flag */
 			{ "notoolbar",  no_argument,		&notoolbar, 1 },
 			{ "nomenu",     no_argument,		&nomenu,    1 },
+			{ "newinstance", no_argument,		&newinstance, 1 },
+			{ "supervise",	no_argument,		&supervise, 1 },
 			/* No flag */
 			{ "help",       no_argument,		0, 'h' },
 			{ "private",    no_argument,		0, 'p' },
@@ -590,11 +2302,24 @@ main(int argc, char *argv[])
 			{ "kiosk",      no_argument,		0, 'k' },
 			{ "raw",        no_argument,		0, 'r' },
 			{ "small",		no_argument,		0, 's' },
+			{ "pool",		required_argument,	0, 'w' },
+			{ "har",		required_argument,	0, 'H' },
+			{ "trace-events", required_argument,	0, 'E' },
+			{ "batch",		required_argument,	0, 'b' },
+			{ "viewport",	required_argument,	0, 'V' },
+			{ "thumbnail",	required_argument,	0, 'T' },
+			{ "jobs",		required_argument,	0, 'j' },
+			{ "output",		required_argument,	0, 'o' },
+			{ "cache",		required_argument,	0, 'c' },
+			{ "filter-bench", required_argument,	0, 'F' },
+			{ "stats",		required_argument,	0, 'S' },
+			{ "profile",	required_argument,	0, 'P' },
+			{ "nosession",  no_argument,		0, 'n' },
 			{ 0, 0, 0, 0}
 		};
 
 		int index = 0;
-		c = getopt_long (argc, argv, "hpu:krs", long_options, &index);
+		c = getopt_long (argc, argv, "hpu:krsw:H:E:b:j:o:c:P:", long_options, &index);
 
 		/* Detect the end of the options */
 		if (c == -1)
@@ -631,6 +2356,67 @@ main(int argc, char *argv[])
 				height = 480;
 				break;
 
+			case 'w':
+				pool_size = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'H':
+			case 'E':
+				har_dir = optarg;
+				har_format = c == 'E' ? HAR_TRACE : 0;
+				break;
+
+			case 'b':
+				batch_list = optarg;
+				break;
+
+			case 'V':
+				if (sscanf(optarg, "%dx%d", &batch_width, &batch_height) != 2
+						|| batch_width <= 0 || batch_height <= 0) {
+					help();
+					return 1;
+				}
+				break;
+
+			case 'T':
+				batch_thumb = MAX(atoi(optarg), 1);
+				break;
+
+			case 'j':
+				batch_jobs = atoi(optarg);
+				break;
+
+			case 'o':
+				batch_output = optarg;
+				break;
+
+			case 'c':
+				cache_size = atoi(optarg);
+				config_option = TRUE;
+				break;
+
+			case 'F':
+				if (! (urls = batch_read(optarg)) || ! urls->len) {
+					fprintf(stderr, "No urls in: %s\n", optarg);
+					return 1;
+				}
+				return filter_bench(urls);
+
+			case 'S':
+				stats_file = optarg;
+				config_option = TRUE;
+				break;
+
+			case 'n':
+				nosession++;
+				config_option = TRUE;
+				break;
+
+			case 'P':
+				/* Already loaded by config_load() */
+				break;
+
 			default:
 				help();
 				return 0;
@@ -640,9 +2426,38 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	/* No new windows in kiosk mode, no webview to prepare */
+	if (kiosk)
+		pool_size = 0;
+
+	/* Headless rendering, no window, session or running instance */
+	if (batch_list)
+		return batch_run();
+
+	/* Load the start page or the url in argument */
+	uri =(char*)(argc == 1 ? argv[0] : WEBHOME);
+	if (argv[0])
+		check_requested_uri();
+
+	/* A running TazWeb opens the url, private, kiosk, user agent,
+	 * recording, profile, cache, pool, stats and session settings are
+	 * global to a process and need their own */
+	if (! private && ! kiosk && ! useragent && ! har_dir && ! newinstance
+			&& ! supervise && ! config_option && instance_request(uri))
+		return 0;
+	trace_phase("instance");
+
+	/* Only supervised children go on, they recover without the session */
+	if (supervise) {
+		if ((c = supervise_run()) >= 0)
+			return c;
+		nosession = TRUE;
+	}
 
 	/* Initialize GTK */
 	gtk_init(NULL, NULL);
+	config_webkit();
+	trace_phase("gtk_init");
 
 	/* Get a default bookmarks.txt if missing */
 	if (! g_file_test(BOOKMARKS, G_FILE_TEST_EXISTS)) {
@@ -650,28 +2465,70 @@ main(int argc, char *argv[])
 		system("install -m 0600 /usr/share/tazweb/bookmarks.txt \
 			$HOME/.config/tazweb/bookmarks.txt");
 	}
+	trace_phase("config");
 
-	/* Load the start page or the url in argument */
-	uri =(char*)(argc == 1 ? argv[0] : WEBHOME);
-	if (argv[0])
-		check_requested_uri();
+	/* Content filter lists and site rules, compiled when they changed */
+	filter_load();
+	site_load();
+	trace_phase("filter");
 
-	tazweb_window = create_window(&webview);
-	gtk_widget_show_all(tazweb_window);
+	/* Nothing is recorded on disk in private mode */
+	if (private)
+		har_dir = NULL;
+	if (har_dir && g_mkdir_with_parents(har_dir, 0700) < 0) {
+		g_warning("Can't create: %s", har_dir);
+		har_dir = NULL;
+	}
+
+	/* Previous session, shown only without url */
+	if (! private && ! nosession && session_open())
+		restored = session_restore(argc == 0);
+	if (restored) {
+		tazweb_window = restored->window;
+		webview = restored->webview;
+	} else {
+		tazweb_window = create_window(&webview);
+		gtk_widget_show_all(tazweb_window);
+	}
+	trace_phase("show");
 
 	/* Handle cookies */
+	session = webkit_get_default_session();
+	config_session(session);
 	if (! private) {
-		session = webkit_get_default_session();
-		snprintf(COOKIES, sizeof COOKIES, "%s", COOKIES);
 		cookies_setup();
+		cache_setup();
 	}
+	trace_phase("cookies");
 
-	/* Fullscreen for Kiosk mode */
-	if (kiosk)
+	/* Resume unfinished downloads */
+	if (! kiosk)
+		downloads_resume();
+
+	/* Fullscreen for Kiosk mode or as before a restart */
+	if (kiosk || supervise_fullscreen)
 		gtk_window_fullscreen(GTK_WINDOW(tazweb_window));
+	supervise_attach(tazweb_window);
+
+	pool_fill();
+	if (pool_size > 0)
+		g_timeout_add_seconds(POOL_CHECK, pool_check_cb, NULL);
 
-	webkit_web_view_load_uri(webview, uri);
+	if (restored)
+		session_window_load(restored);
+	else
+		scheme_load(webview, uri);
+	trace_phase("load_uri");
 	gtk_widget_grab_focus(GTK_WIDGET(webview));
+
+	/* Most used hosts are prepared once the first page is started */
+	if (! private)
+		g_idle_add_full(G_PRIORITY_LOW, prefetch_bookmarks_cb, NULL, NULL);
+	g_idle_add_full(G_PRIORITY_LOW, completion_init_cb, NULL, NULL);
+	if (! private)
+		history_open();
+	if (stats_file)
+		g_timeout_add_seconds(STATS_INTERVAL, stats_write_cb, NULL);
 	gtk_main();
 
 	return 0;
@@ -0,0 +1,213 @@
+/*
+ * Shared parts of TazWeb and TazWeb NG: each front-end builds its
+ * windows or tabs around the same history, bookmarks, cookies, cache,
+ * content filter, site settings, internal pages and configuration.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#ifndef TAZWEB_H
+#define TAZWEB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+
+#include <gtk/gtk.h>
+#include <webkit/webkit.h>
+#include <libsoup/soup.h>
+
+#define GETTEXT_PACKAGE	"tazweb"
+#define SCHEME			"tazweb://"
+#define WEBHOME			SCHEME "home"
+#define SEARCH			"http://duckduckgo.com/?q=%s&t=slitaz"
+#define HOME			g_get_home_dir()
+#define CONFIG			g_strdup_printf("%s/.config/tazweb", HOME)
+#define BOOKMARKS		g_strdup_printf("%s/bookmarks.txt", CONFIG)
+#define COOKIES			g_strdup_printf("%s/cookies.txt", CONFIG)
+#define DOWNLOADS		g_strdup_printf("%s/Downloads", HOME)
+#define CACHE_DIR		g_strdup_printf("%s/tazweb", g_get_user_cache_dir())
+
+/* User agent string */
+#define UA_TAZWEB		g_strdup_printf("TazWeb/%s (X11; SliTaz GNU/Linux)", tazweb_version)
+#define UA_COMPAT		"Mozilla/5.0 AppleWebKit/535.22+"
+#define UA				g_strdup_printf("%s %s", UA_TAZWEB, UA_COMPAT)
+
+/* Defined by the front-end */
+extern const gchar		*tazweb_version;
+extern int				width;
+extern int				height;
+extern int				private;
+extern gchar			*useragent;
+extern SoupSession		*session;
+extern SoupCookieJar	*cookiejar;
+
+void		instance_open(gchar *line, gboolean focus);
+void		stats_front_sample(gint64 *values);
+void		stats_front_html(GString *html);
+extern const gchar		*stats_front_names[];
+
+/* Startup trace */
+extern FILE				*trace;
+
+void		trace_open(const gchar *prog);
+void		trace_phase(const gchar *phase);
+void		trace_load_status(WebKitLoadStatus status);
+
+/* URL completion */
+void		completion_add(const gchar *url, const gchar *title, guint visits,
+				gint64 last, gboolean bookmark);
+const gchar	*completion_best(const gchar *text);
+void		completion_attach(GtkWidget *entry);
+gboolean	completion_init_cb(gpointer data);
+
+/* History */
+extern GHashTable		*history;
+
+gboolean	history_flush(gpointer data);
+void		history_visit(const gchar *url);
+void		history_title(const gchar *url, const gchar *title);
+gboolean	history_merge_cb(gpointer data);
+void		history_open(void);
+
+/* Bookmarks */
+struct bookmark {
+	gchar	*title;
+	gchar	*url;
+};
+
+extern GPtrArray		*bookmarks;
+
+void		bookmarks_load(void);
+void		bookmarks_add(const gchar *title, const gchar *url);
+void		html_header(GString *string, const gchar *title);
+void		html_footer(GString *string, const gchar *counter);
+gchar		*bookmarks_html(void);
+
+/* DNS prefetch */
+extern guint			prefetch_dns;
+extern guint			prefetch_hits;
+
+void		prefetch_count(const gchar *text);
+void		prefetch_entry_cb(GtkWidget *entry, gpointer data);
+void		prefetch_search_cb(GtkWidget *entry, gpointer data);
+gboolean	prefetch_bookmarks_cb(gpointer data);
+void		prefetch_report(void);
+
+/* Cookies */
+gboolean	cookies_flush(gpointer data);
+void		cookies_setup(void);
+gchar		*cookies_html(void);
+void		cookies_clean(void);
+
+/* Disk cache */
+extern gchar			*cache_path;
+extern gint				cache_size;
+
+void		cache_setup(void);
+void		cache_save(void);
+
+/* HAR capture */
+#define HAR_TRACE		1
+
+extern gchar			*har_dir;
+extern gint				har_format;
+
+void		har_attach(WebKitWebView *webview);
+
+/* Content filter */
+extern guint			filter_blocked;
+
+guint32		filter_hash(const gchar *text, gsize length);
+void		filter_source(GString *sources, const gchar *file,
+				const GStatBuf *st);
+void		filter_pad(GString *sources);
+guint32		filter_pow2(guint n);
+void		filter_load(void);
+void		filter_attach(WebKitWebView *webview);
+void		filter_report(void);
+int			filter_bench(GPtrArray *urls);
+
+/* Site settings */
+void		site_load(void);
+void		site_attach(WebKitWebView *webview);
+
+/* Webview pool */
+#define POOL_CHECK		30
+
+extern GQueue			pool;
+extern gint				pool_size;
+extern gint				memory_budget;
+
+glong		memory_available(void);
+glong		memory_rss(void);
+WebKitWebView	*webview_new(void);
+void		pool_fill(void);
+gboolean	pool_check_cb(gpointer data);
+WebKitWebView	*pool_take(void);
+
+/* Statistics */
+#define STATS_INTERVAL	30
+
+extern gchar			*stats_file;
+
+gboolean	stats_write_cb(gpointer data);
+gchar		*stats_html(void);
+
+/* Internal pages */
+void		scheme_load(WebKitWebView *webview, const gchar *uri);
+void		scheme_attach(WebKitWebView *webview);
+
+/* Back/forward cache */
+extern gint				bfcache_entries;
+extern gint				bfcache_size;
+
+void		bfcache_attach(WebKitWebView *webview);
+void		bfcache_go(WebKitWebView *webview, gint step);
+
+/* Configuration, only gint fields: config_merge() walks them as an array */
+struct config {
+	gint			cache_model;
+	gint			page_cache;
+	gint			images;
+	gint			scripts;
+	gint			plugins;
+	gint			conns;
+	gint			conns_host;
+	gint			width;
+	gint			height;
+	gint			pool;
+	gint			cache;
+	gint			bfcache;
+	gint			bfcache_size;
+	gint			kiosk;
+	gint			toolbar;
+	gint			menu;
+	gint			download_rate;
+};
+
+extern struct config	config;
+extern gchar			*config_profile;
+extern gboolean			config_option;
+
+void		config_load(int argc, char *argv[]);
+void		config_settings(WebKitWebSettings *settings);
+void		config_webkit(void);
+void		config_session(SoupSession *session);
+
+/* Single instance */
+gboolean	instance_handoff(const gchar *name, const gchar *request);
+void		instance_close(void);
+
+#endif /* TAZWEB_H */
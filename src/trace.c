@@ -0,0 +1,109 @@
+/*
+ * Startup trace of TazWeb and TazWeb NG.
+ *
+ * Copyright (C) 2011-2017 SliTaz GNU/Linux - BSD License
+ * See AUTHORS and LICENSE for detailed information
+ *
+ */
+
+#include <time.h>
+#include "tazweb.h"
+
+/*
+ *
+ * Startup trace
+ *
+ * With TAZWEB_TRACE=file (or - for stderr) the startup phases are
+ * written as JSON lines, in microseconds since the process was started.
+ * The trace ends when the first page is loaded and, with TAZWEB_TRACE_QUIT
+ * set, the browser then quits. This is used by 'make bench-startup'.
+ *
+ */
+
+FILE					*trace;
+static gint64			trace_start;
+static const gchar		*trace_prog;
+
+/* Process start on the monotonic clock, from /proc/self/stat (10 ms
+ * resolution). starttime counts from boot with the time suspended, so
+ * the age of the process is taken on CLOCK_BOOTTIME. Falls back to now,
+ * when main() is entered. */
+static gint64
+trace_exec_time(void)
+{
+	unsigned long long start;
+	struct timespec ts;
+	gint64 now = g_get_monotonic_time(), exec = now, age;
+	gchar *data, *p;
+
+	if (! g_file_get_contents("/proc/self/stat", &data, NULL, NULL))
+		return now;
+
+	/* Field 22 is starttime, fields are counted after the command name */
+	if ((p = strrchr(data, ')')) && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d "
+			"%*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+			&start) == 1 && clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+		age = (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000
+			- (gint64)start * G_USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+		if (age >= 0 && age <= 60 * G_USEC_PER_SEC)
+			exec = now - age;
+	}
+	g_free(data);
+	return exec;
+}
+
+/* Phases are tagged with the name of the program */
+void
+trace_open(const gchar *prog)
+{
+	const gchar *file;
+
+	if (! (file = g_getenv("TAZWEB_TRACE")) || ! *file)
+		return;
+	trace_prog = prog;
+	trace = strcmp(file, "-") ? fopen(file, "a") : stderr;
+	trace_start = trace_exec_time();
+}
+
+void
+trace_phase(const gchar *phase)
+{
+	if (! trace)
+		return;
+	fprintf(trace, "{\"prog\":\"%s\",\"phase\":\"%s\",\"us\":%"
+		G_GINT64_FORMAT "}\n", trace_prog, phase,
+		g_get_monotonic_time() - trace_start);
+	fflush(trace);
+}
+
+/* Main frame load phases, the trace ends with the first page */
+void
+trace_load_status(WebKitLoadStatus status)
+{
+	if (! trace)
+		return;
+
+	switch (status) {
+		case WEBKIT_LOAD_COMMITTED:
+			trace_phase("committed");
+			return;
+		case WEBKIT_LOAD_FIRST_VISUALLY_NON_EMPTY_LAYOUT:
+			trace_phase("first_layout");
+			return;
+		case WEBKIT_LOAD_FINISHED:
+			trace_phase("finished");
+			break;
+		case WEBKIT_LOAD_FAILED:
+			trace_phase("failed");
+			break;
+		default:
+			return;
+	}
+
+	if (trace != stderr)
+		fclose(trace);
+	trace = NULL;
+	if (g_getenv("TAZWEB_TRACE_QUIT"))
+		gtk_main_quit();
+}
+